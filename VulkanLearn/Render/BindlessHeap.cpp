@@ -0,0 +1,254 @@
+#include "BindlessHeap.h"
+#include "VulkanCheck.h"
+
+#include <algorithm>
+#include <iostream>
+
+void BindlessHeap::SlotAllocator::Create(uint32_t capacity)
+{
+    _capacity = capacity;
+    _next = 0;
+    _liveCount = 0;
+    _free.clear();
+    _retired.clear();
+}
+
+uint32_t BindlessHeap::SlotAllocator::Allocate()
+{
+    uint32_t index = kInvalidIndex;
+    if (!_free.empty())
+    {
+        index = _free.back();
+        _free.pop_back();
+    }
+    else if (_next < _capacity)
+    {
+        index = _next++;
+    }
+    else
+    {
+        return kInvalidIndex;
+    }
+    _liveCount++;
+    return index;
+}
+
+void BindlessHeap::SlotAllocator::Release(uint32_t index, uint64_t frame)
+{
+    if (index == kInvalidIndex)
+        return;
+    _retired.emplace_back(frame, index);
+    _liveCount--;
+}
+
+void BindlessHeap::SlotAllocator::Collect(uint64_t completedFrame)
+{
+    while (!_retired.empty() && _retired.front().first <= completedFrame)
+    {
+        _free.push_back(_retired.front().second);
+        _retired.pop_front();
+    }
+}
+
+void BindlessHeap::Create(VkPhysicalDevice physicalDevice, VkDevice device, const HostAllocator* hostAllocator,
+    uint32_t textureCapacity, uint32_t bufferCapacity)
+{
+    _device = device;
+    _hostAllocator = hostAllocator;
+
+    //update after bind descriptors have their own, usually much higher, limits
+    VkPhysicalDeviceVulkan12Properties properties12{};
+    properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &properties12;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+    textureCapacity = (std::min)({ textureCapacity,
+        properties12.maxDescriptorSetUpdateAfterBindSampledImages,
+        properties12.maxDescriptorSetUpdateAfterBindSamplers,
+        properties12.maxPerStageDescriptorUpdateAfterBindSampledImages });
+    bufferCapacity = (std::min)({ bufferCapacity,
+        properties12.maxDescriptorSetUpdateAfterBindStorageBuffers,
+        properties12.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+
+    VkDescriptorSetLayoutBinding bindings[2]{};
+    bindings[0].binding = kTextureBinding;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = textureCapacity;
+    bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+    bindings[1].binding = kBufferBinding;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = bufferCapacity;
+    bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+    //slots are written while earlier frames are still executing and most of them are never written at all
+    VkDescriptorBindingFlags bindingFlags[2] =
+    {
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flagsInfo.bindingCount = 2;
+    flagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &flagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 2;
+    layoutInfo.pBindings = bindings;
+    VkResult res = vkCreateDescriptorSetLayout(_device, &layoutInfo,
+        _hostAllocator->Get(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT), &_setLayout);
+    CHECK_SUCCESS(res, "failed to create bindless descriptor set layout!!!")
+
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = VK_SHADER_STAGE_ALL;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(PushConstants);
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &_setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+    res = vkCreatePipelineLayout(_device, &pipelineLayoutInfo,
+        _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE_LAYOUT), &_pipelineLayout);
+    CHECK_SUCCESS(res, "failed to create bindless pipeline layout!!!")
+
+    VkDescriptorPoolSize poolSizes[2];
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = textureCapacity;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = bufferCapacity;
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    res = vkCreateDescriptorPool(_device, &poolInfo,
+        _hostAllocator->Get(VK_OBJECT_TYPE_DESCRIPTOR_POOL), &_pool);
+    CHECK_SUCCESS(res, "failed to create bindless descriptor pool!!!")
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = _pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &_setLayout;
+    res = vkAllocateDescriptorSets(_device, &allocInfo, &_set);
+    CHECK_SUCCESS(res, "failed to allocate bindless descriptor set!!!")
+
+    _textureSlots.Create(textureCapacity);
+    _bufferSlots.Create(bufferCapacity);
+    _frame = 0;
+    std::cout << "bindless heap: " << textureCapacity << " textures, " << bufferCapacity << " buffers" << std::endl;
+}
+
+void BindlessHeap::Destroy()
+{
+    if (_device == VK_NULL_HANDLE)
+        return;
+    //the set is freed together with its pool
+    vkDestroyDescriptorPool(_device, _pool, _hostAllocator->Get(VK_OBJECT_TYPE_DESCRIPTOR_POOL));
+    vkDestroyPipelineLayout(_device, _pipelineLayout, _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE_LAYOUT));
+    vkDestroyDescriptorSetLayout(_device, _setLayout, _hostAllocator->Get(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT));
+    _pool = VK_NULL_HANDLE;
+    _pipelineLayout = VK_NULL_HANDLE;
+    _setLayout = VK_NULL_HANDLE;
+    _set = VK_NULL_HANDLE;
+    _pendingWrites.clear();
+    _device = VK_NULL_HANDLE;
+}
+
+uint32_t BindlessHeap::AddTexture(VkImageView imageView, VkSampler sampler, VkImageLayout layout)
+{
+    uint32_t index = _textureSlots.Allocate();
+    if (index == kInvalidIndex)
+        return kInvalidIndex;
+
+    PendingWrite write{};
+    write.binding = kTextureBinding;
+    write.index = index;
+    write.image.imageView = imageView;
+    write.image.sampler = sampler;
+    write.image.imageLayout = layout;
+    _pendingWrites.push_back(write);
+    return index;
+}
+
+uint32_t BindlessHeap::AddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+    uint32_t index = _bufferSlots.Allocate();
+    if (index == kInvalidIndex)
+        return kInvalidIndex;
+
+    PendingWrite write{};
+    write.binding = kBufferBinding;
+    write.index = index;
+    write.buffer.buffer = buffer;
+    write.buffer.offset = offset;
+    write.buffer.range = range;
+    _pendingWrites.push_back(write);
+    return index;
+}
+
+void BindlessHeap::ReleaseTexture(uint32_t index)
+{
+    _textureSlots.Release(index, _frame);
+}
+
+void BindlessHeap::ReleaseBuffer(uint32_t index)
+{
+    _bufferSlots.Release(index, _frame);
+}
+
+void BindlessHeap::Collect(uint64_t completedFrame)
+{
+    _textureSlots.Collect(completedFrame);
+    _bufferSlots.Collect(completedFrame);
+}
+
+void BindlessHeap::Update()
+{
+    if (_pendingWrites.empty())
+        return;
+
+    _writes.clear();
+    for (const auto& pending : _pendingWrites)
+    {
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = _set;
+        write.dstBinding = pending.binding;
+        write.dstArrayElement = pending.index;
+        write.descriptorCount = 1;
+        if (pending.binding == kTextureBinding)
+        {
+            write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            write.pImageInfo = &pending.image;
+        }
+        else
+        {
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write.pBufferInfo = &pending.buffer;
+        }
+        _writes.push_back(write);
+    }
+    vkUpdateDescriptorSets(_device, static_cast<uint32_t>(_writes.size()), _writes.data(), 0, nullptr);
+    _pendingWrites.clear();
+}
+
+void BindlessHeap::Bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint)
+{
+    vkCmdBindDescriptorSets(commandBuffer, bindPoint, _pipelineLayout, 0, 1, &_set, 0, nullptr);
+}
+
+void BindlessHeap::Push(VkCommandBuffer commandBuffer, const PushConstants& constants)
+{
+    vkCmdPushConstants(commandBuffer, _pipelineLayout, VK_SHADER_STAGE_ALL, 0, sizeof(PushConstants), &constants);
+}
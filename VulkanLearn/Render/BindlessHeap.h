@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <deque>
+#include <cstdint>
+
+#include "HostAllocator.h"
+
+//one update after bind descriptor set holding every texture and storage buffer of the scene.
+//it is bound once per command buffer and draws only push the indices of what they use:
+//
+//  layout(set = 0, binding = 0) uniform sampler2D textures[];
+//  layout(set = 0, binding = 1) buffer Buffers { uint data[]; } buffers[];
+//  layout(push_constant) uniform Indices { uint texture; uint buffer; uint draw; uint user; } indices;
+//
+//needs descriptor indexing, core in vulkan 1.2
+class BindlessHeap
+{
+public:
+    static const uint32_t kInvalidIndex = 0xffffffff;
+    static const uint32_t kTextureBinding = 0;
+    static const uint32_t kBufferBinding = 1;
+
+    //mirrors the push constant block above
+    struct PushConstants
+    {
+        uint32_t textureIndex = kInvalidIndex;
+        uint32_t bufferIndex = kInvalidIndex;
+        uint32_t drawIndex = 0;
+        uint32_t user = 0;
+    };
+
+    void Create(VkPhysicalDevice physicalDevice, VkDevice device, const HostAllocator* hostAllocator,
+        uint32_t textureCapacity, uint32_t bufferCapacity);
+    void Destroy();
+
+    //the returned index stays valid until it is released
+    uint32_t AddTexture(VkImageView imageView, VkSampler sampler,
+        VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    uint32_t AddBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+    //frames in flight may still read the slot, it is reused once Collect passes the current frame
+    void ReleaseTexture(uint32_t index);
+    void ReleaseBuffer(uint32_t index);
+
+    //same frame numbers as the DeletionQueue
+    void SetFrame(uint64_t frame) { _frame = frame; }
+    void Collect(uint64_t completedFrame);
+
+    //write every pending descriptor with a single vkUpdateDescriptorSets
+    void Update();
+    void Bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint);
+    void Push(VkCommandBuffer commandBuffer, const PushConstants& constants);
+
+    VkDescriptorSetLayout GetSetLayout() const { return _setLayout; }
+    VkPipelineLayout GetPipelineLayout() const { return _pipelineLayout; }
+    uint32_t GetTextureCount() const { return _textureSlots.GetLiveCount(); }
+    uint32_t GetBufferCount() const { return _bufferSlots.GetLiveCount(); }
+
+private:
+    //indices handed out from a free list, released ones wait for their frame to complete
+    class SlotAllocator
+    {
+    public:
+        void Create(uint32_t capacity);
+        uint32_t Allocate();
+        void Release(uint32_t index, uint64_t frame);
+        void Collect(uint64_t completedFrame);
+        uint32_t GetLiveCount() const { return _liveCount; }
+
+    private:
+        uint32_t _capacity = 0;
+        uint32_t _next = 0;
+        uint32_t _liveCount = 0;
+        std::vector<uint32_t> _free;
+        std::deque<std::pair<uint64_t, uint32_t>> _retired;
+    };
+
+    struct PendingWrite
+    {
+        uint32_t binding;
+        uint32_t index;
+        VkDescriptorImageInfo image;
+        VkDescriptorBufferInfo buffer;
+    };
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    VkDescriptorSetLayout _setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout _pipelineLayout = VK_NULL_HANDLE;
+    VkDescriptorPool _pool = VK_NULL_HANDLE;
+    VkDescriptorSet _set = VK_NULL_HANDLE;
+    uint64_t _frame = 0;
+
+    SlotAllocator _textureSlots;
+    SlotAllocator _bufferSlots;
+    std::vector<PendingWrite> _pendingWrites;
+    //scratch array reused by Update
+    std::vector<VkWriteDescriptorSet> _writes;
+};
@@ -0,0 +1,703 @@
+#include "Bvh.h"
+#include "FrustumCuller.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+    //half the surface area, only ever compared
+    float Area(const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        glm::vec3 extent = boxMax - boxMin;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    //queries keep the first levels on the stack and only allocate for unusually deep trees
+    template <typename T>
+    class TraversalStack
+    {
+    public:
+        void Push(const T& value)
+        {
+            if (_size < kInline)
+                _inline[_size] = value;
+            else
+                _spill.push_back(value);
+            _size++;
+        }
+
+        T Pop()
+        {
+            _size--;
+            if (_size < kInline)
+                return _inline[_size];
+            T value = _spill.back();
+            _spill.pop_back();
+            return value;
+        }
+
+        bool Empty() const { return _size == 0; }
+
+    private:
+        static const uint32_t kInline = 64;
+        T _inline[kInline];
+        std::vector<T> _spill;
+        uint32_t _size = 0;
+    };
+}
+
+uint32_t Bvh::Add(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t id)
+{
+    return AllocateObject(boxMin, boxMax, id);
+}
+
+uint32_t Bvh::Insert(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t id)
+{
+    uint32_t object = AllocateObject(boxMin, boxMax, id);
+    InsertLeaf(CreateLeaf(object));
+    return object;
+}
+
+void Bvh::Remove(uint32_t proxy)
+{
+    Object& object = _objects[proxy];
+    if (object.node != kInvalidIndex)
+    {
+        RemoveLeaf(object.node);
+        FreeNode(object.node);
+    }
+    object.node = kFreeObject;
+    _freeObjects.push_back(proxy);
+    _objectCount--;
+}
+
+void Bvh::Update(uint32_t proxy, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    Object& object = _objects[proxy];
+    object.min = boxMin;
+    object.max = boxMax;
+    //a static object not built yet picks the new bounds up at the next Build
+    if (object.node == kInvalidIndex)
+        return;
+    Node& leaf = _nodes[object.node];
+    leaf.min = boxMin;
+    leaf.max = boxMax;
+    Refit(_parents[object.node]);
+}
+
+void Bvh::Clear()
+{
+    _nodes.clear();
+    _parents.clear();
+    _freeNodes.clear();
+    _root = kInvalidIndex;
+    _objects.clear();
+    _freeObjects.clear();
+    _objectCount = 0;
+    _rotations = 0;
+}
+
+void Bvh::Build()
+{
+    PROFILE_FUNCTION();
+    _nodes.clear();
+    _parents.clear();
+    _freeNodes.clear();
+    _root = kInvalidIndex;
+    _rotations = 0;
+    if (_objectCount == 0)
+        return;
+
+    std::vector<BuildObject> objects;
+    objects.reserve(_objectCount);
+    for (uint32_t i = 0; i < _objects.size(); i++)
+    {
+        const Object& object = _objects[i];
+        if (object.node == kFreeObject)
+            continue;
+        objects.push_back({ object.min, object.max, (object.min + object.max) * 0.5f, i });
+    }
+    _nodes.reserve(2 * objects.size() - 1);
+    _parents.reserve(2 * objects.size() - 1);
+    _root = BuildRange(objects, 0, static_cast<uint32_t>(objects.size()), kInvalidIndex);
+}
+
+void Bvh::Flatten()
+{
+    PROFILE_FUNCTION();
+    _rotations = 0;
+    if (_root == kInvalidIndex)
+    {
+        _nodes.clear();
+        _parents.clear();
+        _freeNodes.clear();
+        return;
+    }
+
+    //pre order with the left child popped first, so it lands right after its parent
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> remap(_nodes.size());
+    std::vector<uint32_t> stack;
+    order.reserve(_nodes.size() - _freeNodes.size());
+    stack.push_back(_root);
+    while (!stack.empty())
+    {
+        uint32_t node = stack.back();
+        stack.pop_back();
+        remap[node] = static_cast<uint32_t>(order.size());
+        order.push_back(node);
+        if (_nodes[node].right != kInvalidIndex)
+        {
+            stack.push_back(_nodes[node].right);
+            stack.push_back(_nodes[node].left);
+        }
+    }
+
+    std::vector<Node> nodes(order.size());
+    std::vector<uint32_t> parents(order.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        Node node = _nodes[order[i]];
+        if (node.right != kInvalidIndex)
+        {
+            node.left = remap[node.left];
+            node.right = remap[node.right];
+        }
+        else
+        {
+            _objects[node.left].node = i;
+        }
+        nodes[i] = node;
+        uint32_t parent = _parents[order[i]];
+        parents[i] = parent == kInvalidIndex ? kInvalidIndex : remap[parent];
+    }
+    _nodes.swap(nodes);
+    _parents.swap(parents);
+    _freeNodes.clear();
+    _root = 0;
+}
+
+void Bvh::QueryFrustum(const glm::mat4& viewProjection, std::vector<uint32_t>& ids) const
+{
+    PROFILE_FUNCTION();
+    if (_root == kInvalidIndex)
+        return;
+    glm::vec4 planes[6];
+    glm::vec3 absNormals[6];
+    FrustumCuller::ExtractPlanes(viewProjection, planes);
+    for (int i = 0; i < 6; i++)
+    {
+        absNormals[i] = glm::abs(glm::vec3(planes[i]));
+    }
+
+    //a bit per plane the node still straddles, children of a node inside a plane skip it
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t planeMask;
+    };
+    TraversalStack<Entry> stack;
+    stack.Push({ _root, 0x3f });
+    while (!stack.Empty())
+    {
+        Entry entry = stack.Pop();
+        const Node& node = _nodes[entry.node];
+        glm::vec3 center = (node.min + node.max) * 0.5f;
+        glm::vec3 extent = (node.max - node.min) * 0.5f;
+        bool outside = false;
+        for (int i = 0; i < 6 && !outside; i++)
+        {
+            if ((entry.planeMask & (1u << i)) == 0)
+                continue;
+            float distance = glm::dot(glm::vec3(planes[i]), center) + planes[i].w;
+            float radius = glm::dot(absNormals[i], extent);
+            if (distance + radius < 0.0f)
+                outside = true;
+            else if (distance - radius >= 0.0f)
+                entry.planeMask &= ~(1u << i);
+        }
+        if (outside)
+            continue;
+
+        if (node.right == kInvalidIndex)
+            ids.push_back(_objects[node.left].id);
+        else if (entry.planeMask == 0)
+            CollectLeaves(entry.node, ids);
+        else
+        {
+            stack.Push({ node.right, entry.planeMask });
+            stack.Push({ node.left, entry.planeMask });
+        }
+    }
+}
+
+void Bvh::QuerySphere(const glm::vec4& sphere, std::vector<uint32_t>& ids) const
+{
+    if (_root == kInvalidIndex)
+        return;
+    glm::vec3 center(sphere);
+    float radiusSquared = sphere.w * sphere.w;
+    TraversalStack<uint32_t> stack;
+    stack.Push(_root);
+    while (!stack.Empty())
+    {
+        const Node& node = _nodes[stack.Pop()];
+        //the closest point of the box to the center decides the overlap
+        glm::vec3 offset = glm::clamp(center, node.min, node.max) - center;
+        if (glm::dot(offset, offset) > radiusSquared)
+            continue;
+        if (node.right == kInvalidIndex)
+            ids.push_back(_objects[node.left].id);
+        else
+        {
+            stack.Push(node.right);
+            stack.Push(node.left);
+        }
+    }
+}
+
+void Bvh::QueryBox(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& ids) const
+{
+    if (_root == kInvalidIndex)
+        return;
+    TraversalStack<uint32_t> stack;
+    stack.Push(_root);
+    while (!stack.Empty())
+    {
+        const Node& node = _nodes[stack.Pop()];
+        if (glm::any(glm::lessThan(boxMax, node.min)) || glm::any(glm::lessThan(node.max, boxMin)))
+            continue;
+        if (node.right == kInvalidIndex)
+            ids.push_back(_objects[node.left].id);
+        else
+        {
+            stack.Push(node.right);
+            stack.Push(node.left);
+        }
+    }
+}
+
+bool Bvh::RayCast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+    uint32_t& id, float& distance, const RayTest& test) const
+{
+    id = kInvalidIndex;
+    distance = maxDistance;
+    if (_root == kInvalidIndex)
+        return false;
+
+    //slab test, a zero direction component turns into an infinity that never limits the range
+    glm::vec3 inverseDirection = 1.0f / direction;
+    auto enter = [&](uint32_t index, float& entry)
+    {
+        const Node& node = _nodes[index];
+        glm::vec3 t0 = (node.min - origin) * inverseDirection;
+        glm::vec3 t1 = (node.max - origin) * inverseDirection;
+        glm::vec3 tMin = glm::min(t0, t1);
+        glm::vec3 tMax = glm::max(t0, t1);
+        entry = (std::max)((std::max)(tMin.x, tMin.y), (std::max)(tMin.z, 0.0f));
+        float exit = (std::min)((std::min)(tMax.x, tMax.y), tMax.z);
+        return entry <= exit && entry < distance;
+    };
+
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+    TraversalStack<Entry> stack;
+    float rootEntry;
+    if (!enter(_root, rootEntry))
+        return false;
+    stack.Push({ _root, rootEntry });
+    while (!stack.Empty())
+    {
+        Entry entry = stack.Pop();
+        //a closer hit was found since the node was pushed
+        if (entry.distance >= distance)
+            continue;
+        const Node& node = _nodes[entry.node];
+        if (node.right == kInvalidIndex)
+        {
+            const Object& object = _objects[node.left];
+            float hitDistance = entry.distance;
+            if ((!test || test(object.id, hitDistance)) && hitDistance < distance)
+            {
+                id = object.id;
+                distance = hitDistance;
+            }
+            continue;
+        }
+
+        //the nearer child is popped first, so its hits can prune the farther one
+        float leftEntry, rightEntry;
+        bool hitLeft = enter(node.left, leftEntry);
+        bool hitRight = enter(node.right, rightEntry);
+        if (hitLeft && hitRight)
+        {
+            if (leftEntry <= rightEntry)
+            {
+                stack.Push({ node.right, rightEntry });
+                stack.Push({ node.left, leftEntry });
+            }
+            else
+            {
+                stack.Push({ node.left, leftEntry });
+                stack.Push({ node.right, rightEntry });
+            }
+        }
+        else if (hitLeft)
+            stack.Push({ node.left, leftEntry });
+        else if (hitRight)
+            stack.Push({ node.right, rightEntry });
+    }
+    return id != kInvalidIndex;
+}
+
+Bvh::Statistics Bvh::GetStatistics() const
+{
+    Statistics statistics;
+    statistics.objects = _objectCount;
+    statistics.nodes = static_cast<uint32_t>(_nodes.size() - _freeNodes.size());
+    statistics.rotations = _rotations;
+    return statistics;
+}
+
+uint32_t Bvh::AllocateObject(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t id)
+{
+    uint32_t object;
+    if (!_freeObjects.empty())
+    {
+        object = _freeObjects.back();
+        _freeObjects.pop_back();
+    }
+    else
+    {
+        object = static_cast<uint32_t>(_objects.size());
+        _objects.push_back(Object());
+    }
+    _objects[object].min = boxMin;
+    _objects[object].max = boxMax;
+    _objects[object].id = id;
+    _objects[object].node = kInvalidIndex;
+    _objectCount++;
+    return object;
+}
+
+uint32_t Bvh::AllocateNode()
+{
+    uint32_t node;
+    if (!_freeNodes.empty())
+    {
+        node = _freeNodes.back();
+        _freeNodes.pop_back();
+    }
+    else
+    {
+        node = static_cast<uint32_t>(_nodes.size());
+        _nodes.push_back(Node());
+        _parents.emplace_back();
+    }
+    _parents[node] = kInvalidIndex;
+    return node;
+}
+
+void Bvh::FreeNode(uint32_t node)
+{
+    _freeNodes.push_back(node);
+}
+
+uint32_t Bvh::CreateLeaf(uint32_t object)
+{
+    uint32_t leaf = AllocateNode();
+    _nodes[leaf].min = _objects[object].min;
+    _nodes[leaf].max = _objects[object].max;
+    _nodes[leaf].left = object;
+    _nodes[leaf].right = kInvalidIndex;
+    _objects[object].node = leaf;
+    return leaf;
+}
+
+void Bvh::InsertLeaf(uint32_t leaf)
+{
+    if (_root == kInvalidIndex)
+    {
+        _root = leaf;
+        _parents[leaf] = kInvalidIndex;
+        return;
+    }
+
+    //walks down to the sibling that grows the total surface area the least, descending only while
+    //the children promise a cheaper spot than pairing the leaf with the current node
+    glm::vec3 leafMin = _nodes[leaf].min;
+    glm::vec3 leafMax = _nodes[leaf].max;
+    auto childCost = [&](uint32_t child)
+    {
+        const Node& node = _nodes[child];
+        float combined = Area(glm::min(node.min, leafMin), glm::max(node.max, leafMax));
+        return node.right == kInvalidIndex ? combined : combined - Area(node.min, node.max);
+    };
+    uint32_t sibling = _root;
+    while (_nodes[sibling].right != kInvalidIndex)
+    {
+        const Node& node = _nodes[sibling];
+        float area = Area(node.min, node.max);
+        float combinedArea = Area(glm::min(node.min, leafMin), glm::max(node.max, leafMax));
+        float cost = 2.0f * combinedArea;
+        //every node below this one also grows this node
+        float inheritedCost = 2.0f * (combinedArea - area);
+        float leftCost = childCost(node.left) + inheritedCost;
+        float rightCost = childCost(node.right) + inheritedCost;
+        if (cost < leftCost && cost < rightCost)
+            break;
+        sibling = leftCost < rightCost ? node.left : node.right;
+    }
+
+    uint32_t oldParent = _parents[sibling];
+    uint32_t parent = AllocateNode();
+    _parents[parent] = oldParent;
+    _nodes[parent].left = sibling;
+    _nodes[parent].right = leaf;
+    _parents[sibling] = parent;
+    _parents[leaf] = parent;
+    if (oldParent == kInvalidIndex)
+        _root = parent;
+    else if (_nodes[oldParent].left == sibling)
+        _nodes[oldParent].left = parent;
+    else
+        _nodes[oldParent].right = parent;
+    Refit(parent);
+}
+
+void Bvh::RemoveLeaf(uint32_t leaf)
+{
+    if (leaf == _root)
+    {
+        _root = kInvalidIndex;
+        return;
+    }
+
+    //the sibling takes the place of the parent
+    uint32_t parent = _parents[leaf];
+    uint32_t grandParent = _parents[parent];
+    uint32_t sibling = _nodes[parent].left == leaf ? _nodes[parent].right : _nodes[parent].left;
+    _parents[sibling] = grandParent;
+    FreeNode(parent);
+    if (grandParent == kInvalidIndex)
+    {
+        _root = sibling;
+        return;
+    }
+    if (_nodes[grandParent].left == parent)
+        _nodes[grandParent].left = sibling;
+    else
+        _nodes[grandParent].right = sibling;
+    Refit(grandParent);
+}
+
+void Bvh::Refit(uint32_t node)
+{
+    while (node != kInvalidIndex)
+    {
+        Node& current = _nodes[node];
+        current.min = glm::min(_nodes[current.left].min, _nodes[current.right].min);
+        current.max = glm::max(_nodes[current.left].max, _nodes[current.right].max);
+        Rotate(node);
+        node = _parents[node];
+    }
+}
+
+void Bvh::Rotate(uint32_t node)
+{
+    //swapping a child with a grandchild on the other side leaves the node's own bounds as they
+    //are, but can shrink the child that takes the other one in. the largest saving is applied
+    uint32_t children[2] = { _nodes[node].left, _nodes[node].right };
+    float bestSaving = 0.0f;
+    uint32_t bestChild = kInvalidIndex;
+    uint32_t bestGrandChild = kInvalidIndex;
+    for (int side = 0; side < 2; side++)
+    {
+        uint32_t child = children[side];
+        uint32_t other = children[1 - side];
+        const Node& childNode = _nodes[child];
+        if (childNode.right == kInvalidIndex)
+            continue;
+        const Node& otherNode = _nodes[other];
+        float area = Area(childNode.min, childNode.max);
+        uint32_t grandChildren[2] = { childNode.left, childNode.right };
+        for (int i = 0; i < 2; i++)
+        {
+            //other moves down next to the grandchild that stays
+            const Node& kept = _nodes[grandChildren[1 - i]];
+            float saving = area - Area(glm::min(otherNode.min, kept.min), glm::max(otherNode.max, kept.max));
+            if (saving > bestSaving)
+            {
+                bestSaving = saving;
+                bestChild = child;
+                bestGrandChild = grandChildren[i];
+            }
+        }
+    }
+    if (bestChild == kInvalidIndex)
+        return;
+
+    uint32_t other = _nodes[node].left == bestChild ? _nodes[node].right : _nodes[node].left;
+    if (_nodes[node].left == other)
+        _nodes[node].left = bestGrandChild;
+    else
+        _nodes[node].right = bestGrandChild;
+    Node& child = _nodes[bestChild];
+    if (child.left == bestGrandChild)
+        child.left = other;
+    else
+        child.right = other;
+    _parents[bestGrandChild] = node;
+    _parents[other] = bestChild;
+    child.min = glm::min(_nodes[child.left].min, _nodes[child.right].min);
+    child.max = glm::max(_nodes[child.left].max, _nodes[child.right].max);
+    _rotations++;
+}
+
+uint32_t Bvh::BuildRange(std::vector<BuildObject>& objects, uint32_t begin, uint32_t end, uint32_t parent)
+{
+    //nodes are appended in pre order, the left child always follows its parent
+    uint32_t node = static_cast<uint32_t>(_nodes.size());
+    _nodes.push_back(Node());
+    _parents.push_back(parent);
+    if (end - begin == 1)
+    {
+        const BuildObject& object = objects[begin];
+        _nodes[node].min = object.min;
+        _nodes[node].max = object.max;
+        _nodes[node].left = object.object;
+        _nodes[node].right = kInvalidIndex;
+        _objects[object.object].node = node;
+        return node;
+    }
+
+    //the bins span the centroids, the split between two bins is scored by the areas and object
+    //counts of both sides
+    glm::vec3 centroidMin(FLT_MAX);
+    glm::vec3 centroidMax(-FLT_MAX);
+    for (uint32_t i = begin; i < end; i++)
+    {
+        centroidMin = glm::min(centroidMin, objects[i].centroid);
+        centroidMax = glm::max(centroidMax, objects[i].centroid);
+    }
+    glm::vec3 extent = centroidMax - centroidMin;
+    //a flat axis maps everything into bin 0 and never yields a split
+    glm::vec3 scale = glm::vec3(
+        extent.x > 0.0f ? kBins / extent.x : 0.0f,
+        extent.y > 0.0f ? kBins / extent.y : 0.0f,
+        extent.z > 0.0f ? kBins / extent.z : 0.0f);
+    auto binOf = [&](const glm::vec3& centroid, int axis)
+    {
+        return (std::min)(kBins - 1, static_cast<uint32_t>((centroid[axis] - centroidMin[axis]) * scale[axis]));
+    };
+
+    //all three axes are binned in the same pass over the objects
+    struct Bin
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        uint32_t count;
+    };
+    Bin bins[3][kBins];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (uint32_t i = 0; i < kBins; i++)
+        {
+            bins[axis][i] = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), 0 };
+        }
+    }
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const BuildObject& object = objects[i];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            Bin& bin = bins[axis][binOf(object.centroid, axis)];
+            bin.min = glm::min(bin.min, object.min);
+            bin.max = glm::max(bin.max, object.max);
+            bin.count++;
+        }
+    }
+
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent[axis] <= 0.0f)
+            continue;
+        //right side costs swept from the last bin, split i puts bins [0, i] on the left
+        float rightCosts[kBins];
+        glm::vec3 sideMin(FLT_MAX);
+        glm::vec3 sideMax(-FLT_MAX);
+        uint32_t sideCount = 0;
+        for (uint32_t i = kBins - 1; i > 0; i--)
+        {
+            sideMin = glm::min(sideMin, bins[axis][i].min);
+            sideMax = glm::max(sideMax, bins[axis][i].max);
+            sideCount += bins[axis][i].count;
+            rightCosts[i] = sideCount == 0 ? FLT_MAX : sideCount * Area(sideMin, sideMax);
+        }
+        sideMin = glm::vec3(FLT_MAX);
+        sideMax = glm::vec3(-FLT_MAX);
+        sideCount = 0;
+        for (uint32_t i = 0; i < kBins - 1; i++)
+        {
+            sideMin = glm::min(sideMin, bins[axis][i].min);
+            sideMax = glm::max(sideMax, bins[axis][i].max);
+            sideCount += bins[axis][i].count;
+            if (sideCount == 0 || rightCosts[i + 1] == FLT_MAX)
+                continue;
+            float cost = sideCount * Area(sideMin, sideMax) + rightCosts[i + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    uint32_t middle = begin + (end - begin) / 2;
+    if (bestAxis >= 0)
+    {
+        auto split = std::partition(objects.begin() + begin, objects.begin() + end, [&](const BuildObject& object)
+        {
+            return binOf(object.centroid, bestAxis) <= bestSplit;
+        });
+        middle = static_cast<uint32_t>(split - objects.begin());
+    }
+    //every centroid in the same spot, any halves are as good as the other
+    if (middle == begin || middle == end)
+        middle = begin + (end - begin) / 2;
+
+    uint32_t left = BuildRange(objects, begin, middle, node);
+    uint32_t right = BuildRange(objects, middle, end, node);
+    Node& current = _nodes[node];
+    current.left = left;
+    current.right = right;
+    current.min = glm::min(_nodes[left].min, _nodes[right].min);
+    current.max = glm::max(_nodes[left].max, _nodes[right].max);
+    return node;
+}
+
+void Bvh::CollectLeaves(uint32_t node, std::vector<uint32_t>& ids) const
+{
+    TraversalStack<uint32_t> stack;
+    stack.Push(node);
+    while (!stack.Empty())
+    {
+        const Node& current = _nodes[stack.Pop()];
+        if (current.right == kInvalidIndex)
+            ids.push_back(_objects[current.left].id);
+        else
+        {
+            stack.Push(current.right);
+            stack.Push(current.left);
+        }
+    }
+}
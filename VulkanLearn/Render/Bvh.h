@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+//dynamic bounding volume hierarchy over axis aligned boxes, one object per leaf. static geometry
+//is added in bulk and built top down with a binned surface area heuristic, moving objects are
+//inserted one by one and refit their ancestors on every update, rotating nodes on the way up
+//where that shrinks the surface area. queries only touch the branches they overlap, so their
+//cost grows with the log of the scene instead of with the scene
+//
+//nodes are 32 bytes, two per cache line. Build lays them out depth first, so a traversal walks
+//memory forward, Flatten restores that order once dynamic changes scattered the nodes
+class Bvh
+{
+public:
+    static const uint32_t kInvalidIndex = 0xffffffff;
+
+    struct Statistics
+    {
+        uint32_t objects = 0;
+        uint32_t nodes = 0;
+        //since the last Build or Flatten
+        uint32_t rotations = 0;
+    };
+
+    //decides whether the ray hits the object itself and where, e.g. with glm::intersectRayTriangle
+    //from glm/gtx/intersect.hpp over its triangles. distance is along the ray direction, the box
+    //entry when called
+    using RayTest = std::function<bool(uint32_t id, float& distance)>;
+
+    //static object, joins the tree at the next Build. the returned proxy stays valid until the
+    //object is removed, id is what the queries report
+    uint32_t Add(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t id);
+    //dynamic object, linked into the tree right away
+    uint32_t Insert(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t id);
+    void Remove(uint32_t proxy);
+    //refits the ancestors of a moved object and rotates them where that lowers the cost
+    void Update(uint32_t proxy, const glm::vec3& boxMin, const glm::vec3& boxMax);
+    void Clear();
+
+    //rebuilds the whole tree from every object with the binned surface area heuristic
+    void Build();
+    //moves the nodes into depth first order again, proxies are unaffected
+    void Flatten();
+
+    //the queries append the ids they find to ids and may run concurrently with each other
+    void QueryFrustum(const glm::mat4& viewProjection, std::vector<uint32_t>& ids) const;
+    //sphere is xyz center and w radius
+    void QuerySphere(const glm::vec4& sphere, std::vector<uint32_t>& ids) const;
+    void QueryBox(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& ids) const;
+    //nearest object along the ray within maxDistance, direction does not need to be normalized
+    //and distances are in its units. without a test the object's box is what gets hit
+    bool RayCast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+        uint32_t& id, float& distance, const RayTest& test = nullptr) const;
+
+    uint32_t GetCount() const { return _objectCount; }
+    Statistics GetStatistics() const;
+
+private:
+    //bins per axis of the build, more finds slightly better splits at a higher build cost
+    static const uint32_t kBins = 16;
+    //node of an object slot on the free list
+    static const uint32_t kFreeObject = 0xfffffffe;
+
+    //a leaf has right == kInvalidIndex and keeps its object in left
+    struct Node
+    {
+        glm::vec3 min;
+        uint32_t left;
+        glm::vec3 max;
+        uint32_t right;
+    };
+
+    struct Object
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        uint32_t id;
+        //leaf of the object, kInvalidIndex until a static one is built, kFreeObject once removed
+        uint32_t node;
+    };
+
+    //copy of an object the build partitions in place, so every pass reads memory in order
+    struct BuildObject
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        glm::vec3 centroid;
+        uint32_t object;
+    };
+
+    uint32_t AllocateObject(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t id);
+    uint32_t AllocateNode();
+    void FreeNode(uint32_t node);
+    uint32_t CreateLeaf(uint32_t object);
+    void InsertLeaf(uint32_t leaf);
+    void RemoveLeaf(uint32_t leaf);
+    //recomputes the bounds of node and every ancestor, rotating each of them
+    void Refit(uint32_t node);
+    void Rotate(uint32_t node);
+    //builds objects [begin, end) of the scratch list below parent, returns the subtree's root
+    uint32_t BuildRange(std::vector<BuildObject>& objects, uint32_t begin, uint32_t end, uint32_t parent);
+    void CollectLeaves(uint32_t node, std::vector<uint32_t>& ids) const;
+
+private:
+    std::vector<Node> _nodes;
+    //kept apart from the nodes, only the updates need them
+    std::vector<uint32_t> _parents;
+    std::vector<uint32_t> _freeNodes;
+    uint32_t _root = kInvalidIndex;
+
+    std::vector<Object> _objects;
+    std::vector<uint32_t> _freeObjects;
+    uint32_t _objectCount = 0;
+    uint32_t _rotations = 0;
+};
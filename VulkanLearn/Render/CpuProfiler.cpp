@@ -0,0 +1,186 @@
+#include "CpuProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+std::atomic<bool> CpuProfiler::s_enabled{ true };
+thread_local CpuProfiler::ThreadBuffer* CpuProfiler::s_threadBuffer = nullptr;
+std::mutex CpuProfiler::s_mutex;
+std::vector<std::unique_ptr<CpuProfiler::ThreadBuffer>> CpuProfiler::s_threads;
+std::vector<CpuProfiler::TimelineEvent> CpuProfiler::s_timeline;
+std::vector<CpuProfiler::GpuEvent> CpuProfiler::s_gpuTimeline;
+
+namespace
+{
+    void WriteJsonString(std::ostream& out, const char* text)
+    {
+        out << '"';
+        for (const char* c = text; *c != '\0'; c++)
+        {
+            if (*c == '"' || *c == '\\')
+                out << '\\' << *c;
+            else if (static_cast<unsigned char>(*c) < 0x20)
+                out << ' ';
+            else
+                out << *c;
+        }
+        out << '"';
+    }
+
+    //trace timestamps are microseconds, fractions keep the nanoseconds
+    double ToMicroseconds(uint64_t time, uint64_t base)
+    {
+        return static_cast<double>(time - base) / 1000.0;
+    }
+
+    const uint32_t kCpuProcess = 1;
+    const uint32_t kGpuProcess = 2;
+}
+
+void CpuProfiler::SetThreadName(const char* name)
+{
+    ThreadBuffer& buffer = GetThreadBuffer();
+    std::lock_guard<std::mutex> lock(s_mutex);
+    buffer.name = name;
+}
+
+void CpuProfiler::Record(const char* name, uint64_t begin, uint64_t end)
+{
+    ThreadBuffer& buffer = GetThreadBuffer();
+    uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    if (head - buffer.tail.load(std::memory_order_acquire) >= kRingSize)
+    {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Event& event = buffer.events[head & (kRingSize - 1)];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    //publishes the event to Collect
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void CpuProfiler::AddGpuFrame(const std::vector<GpuProfiler::ScopeResult>& scopes, uint64_t cpuAnchor)
+{
+    if (!IsEnabled() || scopes.empty() || cpuAnchor == 0)
+        return;
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (const auto& scope : scopes)
+    {
+        GpuEvent event;
+        event.name = scope.name;
+        event.begin = cpuAnchor + static_cast<uint64_t>(scope.beginMs * 1000000.0);
+        event.end = cpuAnchor + static_cast<uint64_t>(scope.endMs * 1000000.0);
+        s_gpuTimeline.push_back(std::move(event));
+    }
+    if (s_gpuTimeline.size() > kMaxEvents)
+        s_gpuTimeline.erase(s_gpuTimeline.begin(), s_gpuTimeline.begin() + s_gpuTimeline.size() / 2);
+}
+
+void CpuProfiler::Collect()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (auto& buffer : s_threads)
+    {
+        uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        for (uint64_t i = tail; i < head; i++)
+        {
+            const Event& event = buffer->events[i & (kRingSize - 1)];
+            s_timeline.push_back({ event.name, buffer->threadId, event.begin, event.end });
+        }
+        //hands the slots back to the producer
+        buffer->tail.store(head, std::memory_order_release);
+    }
+    if (s_timeline.size() > kMaxEvents)
+        s_timeline.erase(s_timeline.begin(), s_timeline.begin() + s_timeline.size() / 2);
+}
+
+bool CpuProfiler::WriteChromeTrace(const std::string& path)
+{
+    Collect();
+    std::lock_guard<std::mutex> lock(s_mutex);
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        std::cout << "cpu profiler: failed to open " << path << std::endl;
+        return false;
+    }
+
+    uint64_t base = ~0ull;
+    for (const auto& event : s_timeline)
+    {
+        base = (std::min)(base, event.begin);
+    }
+    for (const auto& event : s_gpuTimeline)
+    {
+        base = (std::min)(base, event.begin);
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << kCpuProcess
+        << ",\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << kGpuProcess
+        << ",\"tid\":0,\"args\":{\"name\":\"GPU\"}},\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << kGpuProcess
+        << ",\"tid\":0,\"args\":{\"name\":\"graphics queue\"}}";
+    uint64_t dropped = 0;
+    for (const auto& buffer : s_threads)
+    {
+        std::string name = buffer->name.empty() ? "thread " + std::to_string(buffer->threadId) : buffer->name;
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << kCpuProcess
+            << ",\"tid\":" << buffer->threadId << ",\"args\":{\"name\":";
+        WriteJsonString(out, name.c_str());
+        out << "}}";
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+
+    for (const auto& event : s_timeline)
+    {
+        out << ",\n{\"name\":";
+        WriteJsonString(out, event.name);
+        out << ",\"ph\":\"X\",\"pid\":" << kCpuProcess << ",\"tid\":" << event.threadId
+            << ",\"ts\":" << ToMicroseconds(event.begin, base)
+            << ",\"dur\":" << ToMicroseconds(event.end, event.begin) << "}";
+    }
+    for (const auto& event : s_gpuTimeline)
+    {
+        out << ",\n{\"name\":";
+        WriteJsonString(out, event.name.c_str());
+        out << ",\"ph\":\"X\",\"pid\":" << kGpuProcess << ",\"tid\":0"
+            << ",\"ts\":" << ToMicroseconds(event.begin, base)
+            << ",\"dur\":" << ToMicroseconds(event.end, event.begin) << "}";
+    }
+    out << "\n]}\n";
+
+    std::cout << "cpu profiler: wrote " << s_timeline.size() << " cpu and " << s_gpuTimeline.size()
+        << " gpu events to " << path << ", " << dropped << " dropped" << std::endl;
+    return static_cast<bool>(out);
+}
+
+void CpuProfiler::Clear()
+{
+    Collect();
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_timeline.clear();
+    s_gpuTimeline.clear();
+}
+
+CpuProfiler::ThreadBuffer& CpuProfiler::GetThreadBuffer()
+{
+    if (s_threadBuffer == nullptr)
+        s_threadBuffer = RegisterThread();
+    return *s_threadBuffer;
+}
+
+CpuProfiler::ThreadBuffer* CpuProfiler::RegisterThread()
+{
+    //buffers outlive their threads, so events of a finished thread still reach the trace
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_threads.push_back(std::make_unique<ThreadBuffer>());
+    ThreadBuffer* buffer = s_threads.back().get();
+    buffer->threadId = static_cast<uint32_t>(s_threads.size());
+    return buffer;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "GpuProfiler.h"
+
+//cpu time per zone, cheap enough to stay enabled in release builds. every thread records into
+//its own single producer ring, so opening and closing a zone never takes a lock. Collect drains
+//the rings into one timeline, WriteChromeTrace dumps it together with the gpu scopes as a json
+//trace that chrome://tracing and ui.perfetto.dev load
+class CpuProfiler
+{
+public:
+    //events a thread can hold between two Collect calls, later ones are dropped and counted
+    static const uint32_t kRingSize = 1u << 14;
+    //events kept for the trace, the oldest half is dropped once it is full
+    static const size_t kMaxEvents = size_t(1) << 20;
+
+    //closes the zone when it goes out of scope, name must outlive the profiler, i.e. a literal
+    class Zone
+    {
+    public:
+        explicit Zone(const char* name) : _name(name), _begin(IsEnabled() ? Now() : 0) {}
+        ~Zone()
+        {
+            if (_begin != 0)
+                Record(_name, _begin, Now());
+        }
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        const char* _name;
+        uint64_t _begin;
+    };
+
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static void SetEnabled(bool enabled) { s_enabled.store(enabled, std::memory_order_relaxed); }
+    //nanoseconds on the steady clock, never 0 so it doubles as the disabled marker of a zone
+    static uint64_t Now()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count()) | 1;
+    }
+
+    //shown as the track name in the trace, call once from the thread itself
+    static void SetThreadName(const char* name);
+    static void Record(const char* name, uint64_t begin, uint64_t end);
+
+    //gpu timestamps run on their own clock, the frame is placed at cpuAnchor, the cpu time
+    //its command buffer was submitted, since the gpu cannot start it any earlier
+    static void AddGpuFrame(const std::vector<GpuProfiler::ScopeResult>& scopes, uint64_t cpuAnchor);
+
+    //moves what every thread recorded into the timeline, call once per frame
+    static void Collect();
+    static bool WriteChromeTrace(const std::string& path);
+    static void Clear();
+
+private:
+    struct Event
+    {
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    //written by its thread only, read by Collect under the collect mutex
+    struct ThreadBuffer
+    {
+        uint32_t threadId = 0;
+        std::string name;
+        Event events[kRingSize];
+        std::atomic<uint64_t> head{ 0 };
+        std::atomic<uint64_t> tail{ 0 };
+        std::atomic<uint64_t> dropped{ 0 };
+    };
+
+    struct TimelineEvent
+    {
+        const char* name;
+        uint32_t threadId;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    struct GpuEvent
+    {
+        std::string name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    static ThreadBuffer& GetThreadBuffer();
+    static ThreadBuffer* RegisterThread();
+
+private:
+    static std::atomic<bool> s_enabled;
+    static thread_local ThreadBuffer* s_threadBuffer;
+    //guards the buffer list and the timeline, taken once per thread and by Collect only
+    static std::mutex s_mutex;
+    static std::vector<std::unique_ptr<ThreadBuffer>> s_threads;
+    static std::vector<TimelineEvent> s_timeline;
+    static std::vector<GpuEvent> s_gpuTimeline;
+};
+
+#define CPU_PROFILER_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILER_CONCAT(a, b) CPU_PROFILER_CONCAT_INNER(a, b)
+//defining VULKAN_LEARN_NO_PROFILER compiles every zone out
+#ifdef VULKAN_LEARN_NO_PROFILER
+#define PROFILE_SCOPE(name) ((void)0)
+#else
+#define PROFILE_SCOPE(name) CpuProfiler::Zone CPU_PROFILER_CONCAT(profileZone, __LINE__)(name)
+#endif
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
@@ -0,0 +1,250 @@
+#include "DebugMessageSink.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+    void CopyTruncated(char* dst, const char* src, size_t capacity)
+    {
+        size_t length = src ? std::strlen(src) : 0;
+        length = length < capacity - 1 ? length : capacity - 1;
+        if (length > 0)
+            std::memcpy(dst, src, length);
+        dst[length] = '\0';
+    }
+
+    const char* SeverityName(VkDebugUtilsMessageSeverityFlagBitsEXT severity)
+    {
+        if (severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT)
+            return "error";
+        if (severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+            return "warning";
+        return "info";
+    }
+
+    //the ring is drained this often, repeats are summed up over a whole report period
+    const auto kFlushPeriod = std::chrono::milliseconds(50);
+    const uint32_t kFlushesPerReport = 20;
+}
+
+void DebugMessageSink::Create(bool performanceReport)
+{
+    _performanceReport = performanceReport;
+    _ring.reset(new Message[kRingSize]);
+    for (uint32_t i = 0; i < kRingSize; i++)
+    {
+        _ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    _writePos.store(0, std::memory_order_relaxed);
+    _readPos = 0;
+    _stop = false;
+    _flusher = std::thread(&DebugMessageSink::FlushLoop, this);
+}
+
+void DebugMessageSink::Destroy()
+{
+    if (!_ring)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(_stopMutex);
+        _stop = true;
+    }
+    _stopSignal.notify_one();
+    _flusher.join();
+
+    Drain();
+    ReportRepeats();
+    uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+    if (dropped > 0)
+        std::cout << "validation: " << dropped << " messages dropped, the sink ring was full" << std::endl;
+    if (_performanceReport)
+        PrintPerformanceReport(std::cout);
+    _ids.clear();
+    _ring.reset();
+}
+
+void DebugMessageSink::Push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type,
+    const VkDebugUtilsMessengerCallbackDataEXT* callbackData)
+{
+    uint64_t pos = _writePos.load(std::memory_order_relaxed);
+    Message* slot = nullptr;
+    for (;;)
+    {
+        slot = &_ring[pos & (kRingSize - 1)];
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(sequence - pos);
+        if (diff == 0)
+        {
+            //claims the slot, on failure pos is reloaded and the next slot is tried
+            if (_writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            //the flusher has not read the slot from one lap ago yet
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = _writePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->severity = severity;
+    slot->type = type;
+    slot->messageId = callbackData->messageIdNumber;
+    slot->frame = _frame.load(std::memory_order_relaxed);
+    CopyTruncated(slot->messageIdName, callbackData->pMessageIdName, kMaxIdNameLength);
+    CopyTruncated(slot->text, callbackData->pMessage, kMaxMessageLength);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+VkBool32 DebugMessageSink::Callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+    VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT* callbackData,
+    void* userData)
+{
+    if (severity < VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+        return VK_FALSE;
+    auto sink = reinterpret_cast<DebugMessageSink*>(userData);
+    if (sink != nullptr && sink->_ring)
+        sink->Push(severity, type, callbackData);
+    else
+        std::cout << callbackData->pMessage << std::endl;
+    //the call that raised the message must not be aborted
+    return VK_FALSE;
+}
+
+void DebugMessageSink::FlushLoop()
+{
+    uint32_t flushes = 0;
+    std::unique_lock<std::mutex> lock(_stopMutex);
+    while (!_stop)
+    {
+        _stopSignal.wait_for(lock, kFlushPeriod, [this] { return _stop; });
+        lock.unlock();
+        Drain();
+        if (++flushes == kFlushesPerReport)
+        {
+            ReportRepeats();
+            flushes = 0;
+        }
+        lock.lock();
+    }
+}
+
+void DebugMessageSink::Drain()
+{
+    for (;;)
+    {
+        Message& slot = _ring[_readPos & (kRingSize - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != _readPos + 1)
+            return;
+        Consume(slot);
+        //hands the slot to the producer one lap ahead
+        slot.sequence.store(_readPos + kRingSize, std::memory_order_release);
+        _readPos++;
+    }
+}
+
+void DebugMessageSink::Consume(const Message& message)
+{
+    MakeKey(message);
+    auto it = _ids.find(_key);
+    if (it == _ids.end())
+    {
+        IdCount& id = _ids[_key];
+        id.messageId = message.messageId;
+        id.messageIdName = message.messageIdName;
+        id.count = 1;
+        std::cout << "validation " << SeverityName(message.severity) << ": " << message.text << std::endl;
+    }
+    else
+    {
+        it->second.count++;
+        it->second.unreported++;
+    }
+
+    if (!_performanceReport || (message.type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) == 0)
+        return;
+    std::lock_guard<std::mutex> lock(_reportMutex);
+    //messages of a frame may arrive after the next frame started, look back a few frames
+    auto report = _reports.rbegin();
+    while (report != _reports.rend() && report->frame > message.frame)
+    {
+        ++report;
+    }
+    if (report == _reports.rend() || report->frame != message.frame)
+    {
+        if (report != _reports.rbegin())
+            return;
+        _reports.emplace_back();
+        _reports.back().frame = message.frame;
+        if (_reports.size() > kReportFrames)
+            _reports.pop_front();
+        report = _reports.rbegin();
+    }
+    for (auto& entry : report->messages)
+    {
+        if (entry.messageId == message.messageId && entry.messageIdName == message.messageIdName)
+        {
+            entry.count++;
+            return;
+        }
+    }
+    PerformanceCount entry;
+    entry.messageId = message.messageId;
+    entry.messageIdName = message.messageIdName;
+    entry.count = 1;
+    report->messages.push_back(std::move(entry));
+}
+
+void DebugMessageSink::MakeKey(const Message& message)
+{
+    _key = std::to_string(message.messageId);
+    _key += ':';
+    _key += message.messageIdName;
+    if (message.messageId == 0)
+    {
+        _key += '\n';
+        _key += message.text;
+    }
+}
+
+void DebugMessageSink::ReportRepeats()
+{
+    for (auto& entry : _ids)
+    {
+        IdCount& id = entry.second;
+        if (id.unreported == 0)
+            continue;
+        std::cout << "validation: " << (id.messageIdName.empty() ? "message" : id.messageIdName)
+            << " (" << id.messageId << ") repeated " << id.unreported << " more times, "
+            << id.count << " total" << std::endl;
+        id.unreported = 0;
+    }
+}
+
+std::vector<DebugMessageSink::FrameReport> DebugMessageSink::GetPerformanceReport() const
+{
+    std::lock_guard<std::mutex> lock(_reportMutex);
+    return std::vector<FrameReport>(_reports.begin(), _reports.end());
+}
+
+void DebugMessageSink::PrintPerformanceReport(std::ostream& out) const
+{
+    std::vector<FrameReport> reports = GetPerformanceReport();
+    out << "validation performance warnings, last " << kReportFrames << " frames:" << std::endl;
+    for (const auto& report : reports)
+    {
+        out << "  frame " << report.frame << ":";
+        for (const auto& entry : report.messages)
+        {
+            out << " " << (entry.messageIdName.empty() ? std::to_string(entry.messageId) : entry.messageIdName)
+                << " x" << entry.count;
+        }
+        out << std::endl;
+    }
+}
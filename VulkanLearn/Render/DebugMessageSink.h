@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+//receives validation messages without blocking the driver call that raised them. the callback
+//copies the message into a bounded lock-free ring, any thread may push. a flusher thread prints
+//the first occurrence of every message and only counts repeats, performance warnings can
+//additionally be grouped per frame into a report. messages are told apart by id and id name,
+//and by their text when the id is 0 as for many layer and loader messages
+class DebugMessageSink
+{
+public:
+    //slots in the ring, messages arriving while it is full are dropped and counted
+    static const uint32_t kRingSize = 512;
+    //longer messages are truncated
+    static const uint32_t kMaxMessageLength = 1024;
+    static const uint32_t kMaxIdNameLength = 96;
+    //frames the performance report keeps
+    static const uint32_t kReportFrames = 64;
+
+    struct PerformanceCount
+    {
+        int32_t messageId = 0;
+        std::string messageIdName;
+        uint32_t count = 0;
+    };
+
+    struct FrameReport
+    {
+        uint64_t frame = 0;
+        std::vector<PerformanceCount> messages;
+    };
+
+    void Create(bool performanceReport);
+    //flushes what is left and prints the repeat counts
+    void Destroy();
+
+    //messages are tagged with the frame being recorded when they arrive
+    void SetFrame(uint64_t frame) { _frame.store(frame, std::memory_order_relaxed); }
+    //called from the driver, never blocks and never allocates
+    void Push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type,
+        const VkDebugUtilsMessengerCallbackDataEXT* callbackData);
+
+    std::vector<FrameReport> GetPerformanceReport() const;
+    void PrintPerformanceReport(std::ostream& out) const;
+
+    static VKAPI_ATTR VkBool32 VKAPI_CALL Callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+        VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT* callbackData,
+        void* userData);
+
+private:
+    struct Message
+    {
+        //free for ring position p while equal to p, p + 1 once written, p + kRingSize once read
+        std::atomic<uint64_t> sequence{ 0 };
+        VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+        VkDebugUtilsMessageTypeFlagsEXT type;
+        int32_t messageId;
+        uint64_t frame;
+        char messageIdName[kMaxIdNameLength];
+        char text[kMaxMessageLength];
+    };
+
+    struct IdCount
+    {
+        int32_t messageId = 0;
+        std::string messageIdName;
+        uint64_t count = 0;
+        //repeats not reported yet
+        uint64_t unreported = 0;
+    };
+
+    void FlushLoop();
+    //single consumer, runs on the flusher thread or in Destroy once it was joined
+    void Drain();
+    void Consume(const Message& message);
+    //fills _key with what tells the message apart from others
+    void MakeKey(const Message& message);
+    void ReportRepeats();
+
+private:
+    std::unique_ptr<Message[]> _ring;
+    std::atomic<uint64_t> _writePos{ 0 };
+    uint64_t _readPos = 0;
+    std::atomic<uint64_t> _dropped{ 0 };
+    std::atomic<uint64_t> _frame{ 0 };
+    bool _performanceReport = false;
+
+    std::thread _flusher;
+    std::mutex _stopMutex;
+    std::condition_variable _stopSignal;
+    bool _stop = false;
+
+    //touched by the consumer only
+    std::unordered_map<std::string, IdCount> _ids;
+    std::string _key;
+    //guards the report, read from other threads
+    mutable std::mutex _reportMutex;
+    std::deque<FrameReport> _reports;
+};
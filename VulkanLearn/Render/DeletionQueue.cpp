@@ -0,0 +1,132 @@
+#include "DeletionQueue.h"
+
+#include <stdexcept>
+
+namespace
+{
+    //non dispatchable handles are pointers on 64 bit and uint64_t on 32 bit, a c style cast covers both
+    template<typename T>
+    T ToHandle(uint64_t handle)
+    {
+        return (T)handle;
+    }
+}
+
+void DeletionQueue::Create(VkDevice device, MemoryAllocator* allocator, const HostAllocator* hostAllocator)
+{
+    _device = device;
+    _allocator = allocator;
+    _hostAllocator = hostAllocator;
+    _frame = 0;
+}
+
+void DeletionQueue::PushBuffer(VkBuffer buffer, const MemoryAllocation& allocation)
+{
+    PushHandle(VK_OBJECT_TYPE_BUFFER, (uint64_t)buffer, allocation);
+}
+
+void DeletionQueue::PushImage(VkImage image, const MemoryAllocation& allocation)
+{
+    PushHandle(VK_OBJECT_TYPE_IMAGE, (uint64_t)image, allocation);
+}
+
+void DeletionQueue::PushMemory(const MemoryAllocation& allocation)
+{
+    if (allocation.memory != VK_NULL_HANDLE)
+        PushHandle(VK_OBJECT_TYPE_DEVICE_MEMORY, 0, allocation);
+}
+
+void DeletionQueue::PushHandle(VkObjectType type, uint64_t handle, const MemoryAllocation& allocation)
+{
+    Entry entry;
+    entry.frame = _frame;
+    entry.type = type;
+    entry.handle = handle;
+    entry.allocation = allocation;
+    _entries.push_back(entry);
+}
+
+void DeletionQueue::Collect(uint64_t completedFrame)
+{
+    while (!_entries.empty() && _entries.front().frame <= completedFrame)
+    {
+        DestroyEntry(_entries.front());
+        _entries.pop_front();
+    }
+}
+
+void DeletionQueue::Flush()
+{
+    for (auto& entry : _entries)
+    {
+        DestroyEntry(entry);
+    }
+    _entries.clear();
+}
+
+void DeletionQueue::DestroyEntry(Entry& entry)
+{
+    const VkAllocationCallbacks* callbacks = _hostAllocator->Get(entry.type);
+    switch (entry.type)
+    {
+    case VK_OBJECT_TYPE_BUFFER:
+    {
+        VkBuffer buffer = ToHandle<VkBuffer>(entry.handle);
+        _allocator->DestroyBuffer(buffer, entry.allocation);
+        break;
+    }
+    case VK_OBJECT_TYPE_IMAGE:
+    {
+        VkImage image = ToHandle<VkImage>(entry.handle);
+        _allocator->DestroyImage(image, entry.allocation);
+        break;
+    }
+    case VK_OBJECT_TYPE_DEVICE_MEMORY:
+        _allocator->Free(entry.allocation);
+        break;
+    case VK_OBJECT_TYPE_IMAGE_VIEW:
+        vkDestroyImageView(_device, ToHandle<VkImageView>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_FRAMEBUFFER:
+        vkDestroyFramebuffer(_device, ToHandle<VkFramebuffer>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_RENDER_PASS:
+        vkDestroyRenderPass(_device, ToHandle<VkRenderPass>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+        vkDestroySwapchainKHR(_device, ToHandle<VkSwapchainKHR>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_PIPELINE:
+        vkDestroyPipeline(_device, ToHandle<VkPipeline>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+        vkDestroyPipelineLayout(_device, ToHandle<VkPipelineLayout>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_SHADER_MODULE:
+        vkDestroyShaderModule(_device, ToHandle<VkShaderModule>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_SAMPLER:
+        vkDestroySampler(_device, ToHandle<VkSampler>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+        vkDestroyDescriptorPool(_device, ToHandle<VkDescriptorPool>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+        vkDestroyDescriptorSetLayout(_device, ToHandle<VkDescriptorSetLayout>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_QUERY_POOL:
+        vkDestroyQueryPool(_device, ToHandle<VkQueryPool>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_COMMAND_POOL:
+        vkDestroyCommandPool(_device, ToHandle<VkCommandPool>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_SEMAPHORE:
+        vkDestroySemaphore(_device, ToHandle<VkSemaphore>(entry.handle), callbacks);
+        break;
+    case VK_OBJECT_TYPE_FENCE:
+        vkDestroyFence(_device, ToHandle<VkFence>(entry.handle), callbacks);
+        break;
+    default:
+        throw std::runtime_error("deletion queue can't destroy this object type!!!");
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <deque>
+#include <cstdint>
+
+#include "MemoryAllocator.h"
+#include "HostAllocator.h"
+
+//destroys objects once the gpu can no longer reference them. every entry is tagged with
+//the frame number current when it was released, Collect receives the newest frame number
+//known to be complete, which could just as well be a timeline semaphore value
+class DeletionQueue
+{
+public:
+    void Create(VkDevice device, MemoryAllocator* allocator, const HostAllocator* hostAllocator);
+
+    //called once per frame, entries must be pushed with non decreasing frame numbers
+    void SetFrame(uint64_t frame) { _frame = frame; }
+
+    template<typename T>
+    void Push(VkObjectType type, T handle)
+    {
+        if (handle != VK_NULL_HANDLE)
+            PushHandle(type, (uint64_t)handle, MemoryAllocation());
+    }
+    void PushBuffer(VkBuffer buffer, const MemoryAllocation& allocation);
+    void PushImage(VkImage image, const MemoryAllocation& allocation);
+    void PushMemory(const MemoryAllocation& allocation);
+
+    //destroy everything released at or before completedFrame
+    void Collect(uint64_t completedFrame);
+    //destroy everything, the device must be idle
+    void Flush();
+
+    size_t GetPendingCount() const { return _entries.size(); }
+
+private:
+    struct Entry
+    {
+        uint64_t frame;
+        VkObjectType type;
+        uint64_t handle;
+        MemoryAllocation allocation;
+    };
+
+    void PushHandle(VkObjectType type, uint64_t handle, const MemoryAllocation& allocation);
+    void DestroyEntry(Entry& entry);
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    MemoryAllocator* _allocator = nullptr;
+    const HostAllocator* _hostAllocator = nullptr;
+    uint64_t _frame = 0;
+    //ordered by frame, so collecting only ever pops from the front
+    std::deque<Entry> _entries;
+};
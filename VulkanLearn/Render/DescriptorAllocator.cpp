@@ -0,0 +1,272 @@
+#include "DescriptorAllocator.h"
+#include "VulkanCheck.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+    const uint32_t kMaxSetsPerPool = 4096;
+
+    //descriptors per set reserved in every pool, tuned for a few textures and buffers per draw
+    const struct
+    {
+        VkDescriptorType type;
+        float ratio;
+    } kPoolRatios[] =
+    {
+        { VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 4.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, 1.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, 1.0f },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f },
+        { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 0.5f },
+    };
+
+    void HashCombine(size_t& seed, size_t value)
+    {
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+}
+
+bool DescriptorLayoutCache::LayoutKey::operator==(const LayoutKey& other) const
+{
+    if (flags != other.flags ||
+        bindings.size() != other.bindings.size() ||
+        bindingFlags != other.bindingFlags)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < bindings.size(); i++)
+    {
+        const VkDescriptorSetLayoutBinding& a = bindings[i];
+        const VkDescriptorSetLayoutBinding& b = other.bindings[i];
+        if (a.binding != b.binding ||
+            a.descriptorType != b.descriptorType ||
+            a.descriptorCount != b.descriptorCount ||
+            a.stageFlags != b.stageFlags ||
+            a.pImmutableSamplers != b.pImmutableSamplers)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t DescriptorLayoutCache::LayoutKeyHash::operator()(const LayoutKey& key) const
+{
+    size_t seed = std::hash<uint32_t>()(key.flags);
+    for (const auto& binding : key.bindings)
+    {
+        //binding, type, count and stages packed into one word
+        uint64_t packed = static_cast<uint64_t>(binding.binding) |
+            static_cast<uint64_t>(binding.descriptorType) << 16 |
+            static_cast<uint64_t>(binding.descriptorCount) << 24 |
+            static_cast<uint64_t>(binding.stageFlags) << 48;
+        HashCombine(seed, std::hash<uint64_t>()(packed));
+    }
+    for (auto bindingFlags : key.bindingFlags)
+    {
+        HashCombine(seed, bindingFlags);
+    }
+    return seed;
+}
+
+void DescriptorLayoutCache::Create(VkDevice device, const HostAllocator* hostAllocator)
+{
+    _device = device;
+    _hostAllocator = hostAllocator;
+}
+
+void DescriptorLayoutCache::Destroy()
+{
+    for (auto& layout : _layouts)
+    {
+        vkDestroyDescriptorSetLayout(_device, layout.second,
+            _hostAllocator->Get(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT));
+    }
+    _layouts.clear();
+}
+
+VkDescriptorSetLayout DescriptorLayoutCache::Get(const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+    VkDescriptorSetLayoutCreateFlags flags,
+    const std::vector<VkDescriptorBindingFlags>& bindingFlags)
+{
+    if (!bindingFlags.empty() && bindingFlags.size() != bindings.size())
+    {
+        throw std::runtime_error("binding flags must match the bindings!!!");
+    }
+
+    LayoutKey key;
+    key.flags = flags;
+    key.bindings = bindings;
+    key.bindingFlags = bindingFlags;
+    //sort bindings and their flags together
+    std::vector<uint32_t> order(bindings.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(),
+        [&](uint32_t a, uint32_t b) { return bindings[a].binding < bindings[b].binding; });
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        key.bindings[i] = bindings[order[i]];
+        if (!bindingFlags.empty())
+            key.bindingFlags[i] = bindingFlags[order[i]];
+    }
+
+    auto it = _layouts.find(key);
+    if (it != _layouts.end())
+        return it->second;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flagsInfo.bindingCount = static_cast<uint32_t>(key.bindingFlags.size());
+    flagsInfo.pBindingFlags = key.bindingFlags.data();
+
+    VkDescriptorSetLayoutCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    info.pNext = key.bindingFlags.empty() ? nullptr : &flagsInfo;
+    info.flags = flags;
+    info.bindingCount = static_cast<uint32_t>(key.bindings.size());
+    info.pBindings = key.bindings.data();
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    VkResult res = vkCreateDescriptorSetLayout(_device, &info,
+        _hostAllocator->Get(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT), &layout);
+    CHECK_SUCCESS(res, "failed to create descriptor set layout!!!")
+
+    _layouts.emplace(std::move(key), layout);
+    return layout;
+}
+
+void DescriptorAllocator::Create(VkDevice device, const HostAllocator* hostAllocator, uint32_t frameCount)
+{
+    _device = device;
+    _hostAllocator = hostAllocator;
+    _frames.assign(frameCount, FramePools());
+    _frameIndex = 0;
+    _currentPool = VK_NULL_HANDLE;
+    _statistics = Statistics();
+}
+
+void DescriptorAllocator::Destroy()
+{
+    if (_device == VK_NULL_HANDLE)
+        return;
+
+    std::cout << "descriptor allocator: peak " << _statistics.peakSetsPerFrame << " sets per frame, "
+        << _statistics.poolCount << " pools" << std::endl;
+    const VkAllocationCallbacks* callbacks = _hostAllocator->Get(VK_OBJECT_TYPE_DESCRIPTOR_POOL);
+    for (auto& frame : _frames)
+    {
+        for (auto& pool : frame.usedPools)
+        {
+            vkDestroyDescriptorPool(_device, pool, callbacks);
+        }
+    }
+    for (auto& pool : _freePools)
+    {
+        vkDestroyDescriptorPool(_device, pool, callbacks);
+    }
+    _frames.clear();
+    _freePools.clear();
+    _currentPool = VK_NULL_HANDLE;
+    _device = VK_NULL_HANDLE;
+}
+
+void DescriptorAllocator::BeginFrame(uint32_t frameIndex)
+{
+    FramePools& frame = _frames[frameIndex];
+    //one reset returns every set of the pool, far cheaper than vkFreeDescriptorSets per set
+    for (auto& pool : frame.usedPools)
+    {
+        vkResetDescriptorPool(_device, pool, 0);
+        _freePools.push_back(pool);
+        _statistics.poolResets++;
+    }
+    frame.usedPools.clear();
+
+    _frameIndex = frameIndex;
+    _currentPool = VK_NULL_HANDLE;
+    _statistics.setsThisFrame = 0;
+    _statistics.poolsThisFrame = 0;
+}
+
+bool DescriptorAllocator::Allocate(VkDescriptorSetLayout layout, VkDescriptorSet& set, uint32_t variableCount)
+{
+    VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{};
+    countInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+    countInfo.descriptorSetCount = 1;
+    countInfo.pDescriptorCounts = &variableCount;
+
+    VkDescriptorSetAllocateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    info.pNext = variableCount > 0 ? &countInfo : nullptr;
+    info.descriptorSetCount = 1;
+    info.pSetLayouts = &layout;
+
+    //a full pool is only detected by a failed allocation, retry once with a fresh pool
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (_currentPool == VK_NULL_HANDLE)
+        {
+            _currentPool = GrabPool();
+            _frames[_frameIndex].usedPools.push_back(_currentPool);
+            _statistics.poolsThisFrame++;
+        }
+        info.descriptorPool = _currentPool;
+        VkResult res = vkAllocateDescriptorSets(_device, &info, &set);
+        if (res == VK_SUCCESS)
+        {
+            _statistics.setsThisFrame++;
+            _statistics.peakSetsPerFrame = (std::max)(_statistics.peakSetsPerFrame, _statistics.setsThisFrame);
+            return true;
+        }
+        if (res != VK_ERROR_OUT_OF_POOL_MEMORY && res != VK_ERROR_FRAGMENTED_POOL)
+            return false;
+        //the frame outgrew its pools, later pools are created larger
+        _currentPool = VK_NULL_HANDLE;
+        _setsPerPool = (std::min)(_setsPerPool * 2, kMaxSetsPerPool);
+    }
+    return false;
+}
+
+VkDescriptorPool DescriptorAllocator::GrabPool()
+{
+    if (!_freePools.empty())
+    {
+        VkDescriptorPool pool = _freePools.back();
+        _freePools.pop_back();
+        return pool;
+    }
+    return CreatePool(_setsPerPool);
+}
+
+VkDescriptorPool DescriptorAllocator::CreatePool(uint32_t setCount)
+{
+    std::vector<VkDescriptorPoolSize> sizes;
+    for (const auto& ratio : kPoolRatios)
+    {
+        VkDescriptorPoolSize size;
+        size.type = ratio.type;
+        size.descriptorCount = (std::max)(1u, static_cast<uint32_t>(ratio.ratio * setCount));
+        sizes.push_back(size);
+    }
+
+    //no FREE_DESCRIPTOR_SET_BIT, sets are only ever released by resetting the pool
+    VkDescriptorPoolCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    info.maxSets = setCount;
+    info.poolSizeCount = static_cast<uint32_t>(sizes.size());
+    info.pPoolSizes = sizes.data();
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    VkResult res = vkCreateDescriptorPool(_device, &info,
+        _hostAllocator->Get(VK_OBJECT_TYPE_DESCRIPTOR_POOL), &pool);
+    CHECK_SUCCESS(res, "failed to create descriptor pool!!!")
+    _statistics.poolCount++;
+    return pool;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "HostAllocator.h"
+
+//deduplicates descriptor set layouts, equal binding lists always return the same handle
+class DescriptorLayoutCache
+{
+public:
+    void Create(VkDevice device, const HostAllocator* hostAllocator);
+    void Destroy();
+
+    //pNext chains are not part of the key, binding flags are passed explicitly instead
+    VkDescriptorSetLayout Get(const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+        VkDescriptorSetLayoutCreateFlags flags = 0,
+        const std::vector<VkDescriptorBindingFlags>& bindingFlags = {});
+
+    size_t GetLayoutCount() const { return _layouts.size(); }
+
+private:
+    struct LayoutKey
+    {
+        VkDescriptorSetLayoutCreateFlags flags = 0;
+        //sorted by binding so the declaration order does not matter
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        std::vector<VkDescriptorBindingFlags> bindingFlags;
+
+        bool operator==(const LayoutKey& other) const;
+    };
+
+    struct LayoutKeyHash
+    {
+        size_t operator()(const LayoutKey& key) const;
+    };
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    std::unordered_map<LayoutKey, VkDescriptorSetLayout, LayoutKeyHash> _layouts;
+};
+
+//hands out descriptor sets that live for a single frame. sets are never freed one by one,
+//every pool a frame used is reset as a whole once its fence has been waited
+class DescriptorAllocator
+{
+public:
+    struct Statistics
+    {
+        uint32_t setsThisFrame = 0;
+        uint32_t peakSetsPerFrame = 0;
+        uint32_t poolsThisFrame = 0;
+        uint32_t poolCount = 0;
+        uint64_t poolResets = 0;
+    };
+
+    void Create(VkDevice device, const HostAllocator* hostAllocator, uint32_t frameCount);
+    void Destroy();
+
+    //call once the fence of frameIndex has been waited
+    void BeginFrame(uint32_t frameIndex);
+    //variableCount is only used for layouts whose last binding has a variable descriptor count
+    bool Allocate(VkDescriptorSetLayout layout, VkDescriptorSet& set, uint32_t variableCount = 0);
+
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    struct FramePools
+    {
+        std::vector<VkDescriptorPool> usedPools;
+    };
+
+    VkDescriptorPool GrabPool();
+    VkDescriptorPool CreatePool(uint32_t setCount);
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    std::vector<FramePools> _frames;
+    uint32_t _frameIndex = 0;
+    VkDescriptorPool _currentPool = VK_NULL_HANDLE;
+    //reset pools ready for reuse by any frame
+    std::vector<VkDescriptorPool> _freePools;
+    //sets per new pool, doubled every time a frame runs out
+    uint32_t _setsPerPool = 64;
+    Statistics _statistics;
+};
@@ -0,0 +1,258 @@
+#include "DrawQueue.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+
+void DrawQueue::Create(PipelineManager* pipelineManager)
+{
+    _pipelineManager = pipelineManager;
+    Clear();
+}
+
+void DrawQueue::Destroy()
+{
+    _draws = std::vector<Draw>();
+    _keys = std::vector<uint64_t>();
+    _indices = std::vector<uint32_t>();
+    _scratchKeys = std::vector<uint64_t>();
+    _scratchIndices = std::vector<uint32_t>();
+    _chunkHistograms = std::vector<Histogram>();
+    _pipelineManager = nullptr;
+}
+
+void DrawQueue::Clear()
+{
+    _draws.clear();
+    _keys.clear();
+    _indices.clear();
+    _sorted = false;
+    _pipelineBinds.store(0, std::memory_order_relaxed);
+    _descriptorBinds.store(0, std::memory_order_relaxed);
+    _vertexBufferBinds.store(0, std::memory_order_relaxed);
+    _indexBufferBinds.store(0, std::memory_order_relaxed);
+    _skippedDraws.store(0, std::memory_order_relaxed);
+    _sortPasses = 0;
+}
+
+void DrawQueue::Submit(const Draw& draw, uint32_t pass, float depth, bool backToFront)
+{
+    Submit(draw, MakeKey(pass, draw.pipeline, draw.material, draw.mesh, QuantizeDepth(depth, backToFront)));
+}
+
+void DrawQueue::Submit(const Draw& draw, uint64_t key)
+{
+    _indices.push_back(static_cast<uint32_t>(_draws.size()));
+    _keys.push_back(key);
+    _draws.push_back(draw);
+    _sorted = false;
+}
+
+uint64_t DrawQueue::MakeKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t depthBucket)
+{
+    //fields wider than their bits wrap, which only costs sorting quality, never correctness
+    uint64_t key = pass & ((1u << kPassBits) - 1);
+    key = (key << kPipelineBits) | (pipeline & ((1u << kPipelineBits) - 1));
+    key = (key << kMaterialBits) | (material & ((1u << kMaterialBits) - 1));
+    key = (key << kMeshBits) | (mesh & ((1u << kMeshBits) - 1));
+    key = (key << kDepthBits) | (depthBucket & ((1u << kDepthBits) - 1));
+    return key;
+}
+
+uint32_t DrawQueue::QuantizeDepth(float depth, bool backToFront)
+{
+    const uint32_t maxBucket = (1u << kDepthBits) - 1;
+    float clamped = (std::min)((std::max)(depth, 0.0f), 1.0f);
+    uint32_t bucket = static_cast<uint32_t>(clamped * maxBucket);
+    return backToFront ? maxBucket - bucket : bucket;
+}
+
+void DrawQueue::Sort(ThreadPool* threadPool)
+{
+    PROFILE_FUNCTION();
+    uint32_t count = GetCount();
+    _sortPasses = 0;
+    if (_sorted || count < 2)
+    {
+        _sorted = true;
+        return;
+    }
+
+    //the digit counts over all keys do not depend on their order, so one sweep tells which
+    //bytes every key shares. passes over those would not move anything and are skipped
+    Histogram totals[kRadixPasses] = {};
+    for (uint64_t key : _keys)
+    {
+        for (uint32_t pass = 0; pass < kRadixPasses; pass++)
+        {
+            totals[pass][(key >> (pass * kRadixBits)) & (kRadixSize - 1)]++;
+        }
+    }
+
+    uint32_t chunkCount = 1;
+    if (threadPool != nullptr)
+        chunkCount = (std::max)(1u, (std::min)(threadPool->GetThreadCount() * 4, count / kMinSortChunk));
+    _chunkHistograms.resize(chunkCount);
+    _scratchKeys.resize(count);
+    _scratchIndices.resize(count);
+
+    for (uint32_t pass = 0; pass < kRadixPasses; pass++)
+    {
+        uint32_t shift = pass * kRadixBits;
+        uint32_t digit = (_keys[0] >> shift) & (kRadixSize - 1);
+        if (totals[pass][digit] == count)
+            continue;
+        SortPass(chunkCount > 1 ? threadPool : nullptr, chunkCount, shift);
+        _keys.swap(_scratchKeys);
+        _indices.swap(_scratchIndices);
+        _sortPasses++;
+    }
+    _sorted = true;
+}
+
+void DrawQueue::SortPass(ThreadPool* threadPool, uint32_t chunkCount, uint32_t shift)
+{
+    uint32_t count = GetCount();
+    uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    auto forEachChunk = [&](const ThreadPool::RangeFunc& func)
+    {
+        if (threadPool != nullptr)
+            threadPool->ParallelFor(chunkCount, 1, func);
+        else
+            func(0, chunkCount, 0);
+    };
+
+    forEachChunk([&](uint32_t begin, uint32_t end, uint32_t)
+        {
+            for (uint32_t chunk = begin; chunk < end; chunk++)
+            {
+                Histogram& histogram = _chunkHistograms[chunk];
+                histogram.fill(0);
+                uint32_t last = (std::min)(count, (chunk + 1) * chunkSize);
+                for (uint32_t i = chunk * chunkSize; i < last; i++)
+                {
+                    histogram[(_keys[i] >> shift) & (kRadixSize - 1)]++;
+                }
+            }
+        });
+
+    //turns the counts into write offsets, lower digits first and within a digit lower chunks
+    //first, which keeps the sort stable as every pass relies on
+    uint32_t offset = 0;
+    for (uint32_t digit = 0; digit < kRadixSize; digit++)
+    {
+        for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+            uint32_t digitCount = _chunkHistograms[chunk][digit];
+            _chunkHistograms[chunk][digit] = offset;
+            offset += digitCount;
+        }
+    }
+
+    forEachChunk([&](uint32_t begin, uint32_t end, uint32_t)
+        {
+            for (uint32_t chunk = begin; chunk < end; chunk++)
+            {
+                Histogram& offsets = _chunkHistograms[chunk];
+                uint32_t last = (std::min)(count, (chunk + 1) * chunkSize);
+                for (uint32_t i = chunk * chunkSize; i < last; i++)
+                {
+                    uint32_t target = offsets[(_keys[i] >> shift) & (kRadixSize - 1)]++;
+                    _scratchKeys[target] = _keys[i];
+                    _scratchIndices[target] = _indices[i];
+                }
+            }
+        });
+}
+
+void DrawQueue::Record(VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end, BindlessHeap* bindlessHeap)
+{
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+    VkDescriptorSet boundSet = VK_NULL_HANDLE;
+    VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+    VkDeviceSize boundVertexOffset = 0;
+    VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+    VkDeviceSize boundIndexOffset = 0;
+    VkIndexType boundIndexType = VK_INDEX_TYPE_UINT32;
+    Statistics statistics;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        uint32_t drawIndex = _indices[i];
+        const Draw& draw = _draws[drawIndex];
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        VkPipeline pipeline = _pipelineManager->Get(draw.pipeline, layout);
+        if (pipeline == VK_NULL_HANDLE)
+        {
+            statistics.skippedDraws++;
+            continue;
+        }
+
+        if (pipeline != boundPipeline)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            boundPipeline = pipeline;
+            statistics.pipelineBinds++;
+        }
+        //a set bound with another layout may not be compatible, so a layout change binds again
+        if (draw.descriptorSet != VK_NULL_HANDLE && (draw.descriptorSet != boundSet || layout != boundLayout))
+        {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1,
+                &draw.descriptorSet, 0, nullptr);
+            boundSet = draw.descriptorSet;
+            boundLayout = layout;
+            statistics.descriptorBinds++;
+        }
+        if (draw.vertexBuffer != VK_NULL_HANDLE &&
+            (draw.vertexBuffer != boundVertexBuffer || draw.vertexBufferOffset != boundVertexOffset))
+        {
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &draw.vertexBuffer, &draw.vertexBufferOffset);
+            boundVertexBuffer = draw.vertexBuffer;
+            boundVertexOffset = draw.vertexBufferOffset;
+            statistics.vertexBufferBinds++;
+        }
+        if (draw.indexBuffer != VK_NULL_HANDLE &&
+            (draw.indexBuffer != boundIndexBuffer || draw.indexBufferOffset != boundIndexOffset ||
+                draw.indexType != boundIndexType))
+        {
+            vkCmdBindIndexBuffer(commandBuffer, draw.indexBuffer, draw.indexBufferOffset, draw.indexType);
+            boundIndexBuffer = draw.indexBuffer;
+            boundIndexOffset = draw.indexBufferOffset;
+            boundIndexType = draw.indexType;
+            statistics.indexBufferBinds++;
+        }
+        //push constants are per draw anyway, they carry the indices the shader looks up
+        if (bindlessHeap != nullptr)
+        {
+            BindlessHeap::PushConstants constants;
+            constants.textureIndex = draw.material;
+            constants.bufferIndex = draw.bufferIndex;
+            constants.drawIndex = drawIndex;
+            bindlessHeap->Push(commandBuffer, constants);
+        }
+
+        if (draw.indexBuffer != VK_NULL_HANDLE)
+            vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, 0);
+        else
+            vkCmdDraw(commandBuffer, draw.vertexCount, draw.instanceCount, 0, 0);
+    }
+
+    _pipelineBinds.fetch_add(statistics.pipelineBinds, std::memory_order_relaxed);
+    _descriptorBinds.fetch_add(statistics.descriptorBinds, std::memory_order_relaxed);
+    _vertexBufferBinds.fetch_add(statistics.vertexBufferBinds, std::memory_order_relaxed);
+    _indexBufferBinds.fetch_add(statistics.indexBufferBinds, std::memory_order_relaxed);
+    _skippedDraws.fetch_add(statistics.skippedDraws, std::memory_order_relaxed);
+}
+
+DrawQueue::Statistics DrawQueue::GetStatistics() const
+{
+    Statistics statistics;
+    statistics.draws = GetCount();
+    statistics.pipelineBinds = _pipelineBinds.load(std::memory_order_relaxed);
+    statistics.descriptorBinds = _descriptorBinds.load(std::memory_order_relaxed);
+    statistics.vertexBufferBinds = _vertexBufferBinds.load(std::memory_order_relaxed);
+    statistics.indexBufferBinds = _indexBufferBinds.load(std::memory_order_relaxed);
+    statistics.skippedDraws = _skippedDraws.load(std::memory_order_relaxed);
+    statistics.sortPasses = _sortPasses;
+    return statistics;
+}
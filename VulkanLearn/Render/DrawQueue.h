@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+#include "PipelineManager.h"
+#include "BindlessHeap.h"
+#include "ThreadPool.h"
+
+//draws of a frame, submitted in any order and recorded sorted by a 64 bit key so draws sharing
+//a pipeline, material and mesh end up next to each other. recording then skips every bind that
+//would set what is already bound
+class DrawQueue
+{
+public:
+    //key layout from the most significant bit: pass, pipeline, material, mesh, depth bucket
+    static const uint32_t kPassBits = 4;
+    static const uint32_t kPipelineBits = 12;
+    static const uint32_t kMaterialBits = 16;
+    static const uint32_t kMeshBits = 16;
+    static const uint32_t kDepthBits = 16;
+
+    struct Draw
+    {
+        PipelineManager::Handle pipeline = PipelineManager::kInvalidHandle;
+        //bound at set 0 with the layout of the pipeline drawn with, leave it null when the
+        //bindless heap is used
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        //bindless texture index, also sorts draws with the same textures together
+        uint32_t material = 0;
+        //identifies the vertex and index buffers for sorting
+        uint32_t mesh = 0;
+        //bindless buffer index pushed along with the material
+        uint32_t bufferIndex = BindlessHeap::kInvalidIndex;
+        VkBuffer vertexBuffer = VK_NULL_HANDLE;
+        VkDeviceSize vertexBufferOffset = 0;
+        //without an index buffer vertexCount vertices are drawn non indexed
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        VkDeviceSize indexBufferOffset = 0;
+        VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+        uint32_t indexCount = 0;
+        uint32_t firstIndex = 0;
+        int32_t vertexOffset = 0;
+        uint32_t vertexCount = 0;
+        uint32_t instanceCount = 1;
+    };
+
+    struct Statistics
+    {
+        uint32_t draws = 0;
+        uint32_t pipelineBinds = 0;
+        uint32_t descriptorBinds = 0;
+        uint32_t vertexBufferBinds = 0;
+        uint32_t indexBufferBinds = 0;
+        //draws whose pipeline and fallbacks were still compiling
+        uint32_t skippedDraws = 0;
+        //radix passes run by the last sort, passes over a byte all keys share are skipped
+        uint32_t sortPasses = 0;
+    };
+
+    void Create(PipelineManager* pipelineManager);
+    void Destroy();
+
+    //forgets the draws of the last frame, keeps the memory
+    void Clear();
+    //depth is normalized to [0, 1], opaque passes sort front to back, blended ones back to front
+    void Submit(const Draw& draw, uint32_t pass, float depth, bool backToFront = false);
+    void Submit(const Draw& draw, uint64_t key);
+    static uint64_t MakeKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t depthBucket);
+    static uint32_t QuantizeDepth(float depth, bool backToFront);
+
+    //radix sorts the keys, spread over the pool once there are enough draws. call it from the
+    //thread owning the pool, never from inside a ParallelFor
+    void Sort(ThreadPool* threadPool);
+    //records sorted draws [begin, end), may run on several threads for disjoint ranges. every
+    //call starts with nothing bound, so secondaries can be recorded from any range
+    void Record(VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end, BindlessHeap* bindlessHeap);
+
+    uint32_t GetCount() const { return static_cast<uint32_t>(_draws.size()); }
+    //counters since the last Clear
+    Statistics GetStatistics() const;
+
+private:
+    static const uint32_t kRadixBits = 8;
+    static const uint32_t kRadixSize = 1u << kRadixBits;
+    static const uint32_t kRadixPasses = 64 / kRadixBits;
+    //draws per sort chunk, smaller queues are sorted on the calling thread
+    static const uint32_t kMinSortChunk = 4096;
+
+    using Histogram = std::array<uint32_t, kRadixSize>;
+
+    void SortPass(ThreadPool* threadPool, uint32_t chunkCount, uint32_t shift);
+
+private:
+    PipelineManager* _pipelineManager = nullptr;
+
+    std::vector<Draw> _draws;
+    //sorted together, the index points into _draws
+    std::vector<uint64_t> _keys;
+    std::vector<uint32_t> _indices;
+    //ping pong buffers of the radix passes
+    std::vector<uint64_t> _scratchKeys;
+    std::vector<uint32_t> _scratchIndices;
+    std::vector<Histogram> _chunkHistograms;
+    bool _sorted = false;
+
+    //Record runs on several threads at once
+    std::atomic<uint32_t> _pipelineBinds{ 0 };
+    std::atomic<uint32_t> _descriptorBinds{ 0 };
+    std::atomic<uint32_t> _vertexBufferBinds{ 0 };
+    std::atomic<uint32_t> _indexBufferBinds{ 0 };
+    std::atomic<uint32_t> _skippedDraws{ 0 };
+    uint32_t _sortPasses = 0;
+};
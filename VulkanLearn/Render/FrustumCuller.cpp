@@ -0,0 +1,279 @@
+#include "FrustumCuller.h"
+#include "FrustumCullerAvx2.h"
+#include "CpuProfiler.h"
+
+#include <glm/simd/common.h>
+#include <algorithm>
+
+#if defined(FRUSTUM_CULLER_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    //arrays are padded to this many lanes, the widest vector any path loads
+    const uint32_t kPadding = 8;
+
+#ifdef FRUSTUM_CULLER_AVX2
+    //AVX2 and FMA in the cpu, and an os that saves the ymm registers
+    bool DetectAvx2()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool fma = (info[2] & (1 << 12)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    }
+
+    bool HasAvx2()
+    {
+        static const bool hasAvx2 = DetectAvx2();
+        return hasAvx2;
+    }
+#endif
+}
+
+uint32_t FrustumCuller::Add(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& sphere, uint32_t id)
+{
+    uint32_t index = _count++;
+    if (_count > _ids.size())
+    {
+        size_t size = _ids.size() + kPadding;
+        for (auto* array : { &_boxCenterX, &_boxCenterY, &_boxCenterZ, &_boxExtentX, &_boxExtentY, &_boxExtentZ,
+                             &_sphereX, &_sphereY, &_sphereZ, &_sphereRadius })
+        {
+            array->resize(size, 0.0f);
+        }
+        _ids.resize(size, 0);
+    }
+    Write(index, boxMin, boxMax, sphere);
+    _ids[index] = id;
+    return index;
+}
+
+void FrustumCuller::Update(uint32_t index, const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& sphere)
+{
+    Write(index, boxMin, boxMax, sphere);
+}
+
+void FrustumCuller::Remove(uint32_t index)
+{
+    uint32_t last = _count - 1;
+    if (index != last)
+        Move(last, index);
+    _count--;
+}
+
+void FrustumCuller::Clear()
+{
+    _count = 0;
+}
+
+void FrustumCuller::Write(uint32_t index, const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& sphere)
+{
+    glm::vec3 center = (boxMin + boxMax) * 0.5f;
+    glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+    _boxCenterX[index] = center.x;
+    _boxCenterY[index] = center.y;
+    _boxCenterZ[index] = center.z;
+    _boxExtentX[index] = extent.x;
+    _boxExtentY[index] = extent.y;
+    _boxExtentZ[index] = extent.z;
+    _sphereX[index] = sphere.x;
+    _sphereY[index] = sphere.y;
+    _sphereZ[index] = sphere.z;
+    _sphereRadius[index] = sphere.w;
+}
+
+void FrustumCuller::Move(uint32_t from, uint32_t to)
+{
+    for (auto* array : { &_boxCenterX, &_boxCenterY, &_boxCenterZ, &_boxExtentX, &_boxExtentY, &_boxExtentZ,
+                         &_sphereX, &_sphereY, &_sphereZ, &_sphereRadius })
+    {
+        (*array)[to] = (*array)[from];
+    }
+    _ids[to] = _ids[from];
+}
+
+void FrustumCuller::Cull(const glm::mat4& viewProjection, ThreadPool* threadPool, std::vector<uint32_t>& visible)
+{
+    PROFILE_FUNCTION();
+    visible.clear();
+    _statistics = Statistics();
+    _statistics.objects = _count;
+    if (_count == 0)
+        return;
+
+    Frustum frustum;
+    ExtractPlanes(viewProjection, frustum.planes);
+    for (int i = 0; i < 6; i++)
+    {
+        frustum.absNormals[i] = glm::abs(glm::vec3(frustum.planes[i]));
+    }
+
+    uint32_t chunkCount = (_count + kChunkSize - 1) / kChunkSize;
+    if (_chunkVisible.size() < chunkCount)
+        _chunkVisible.resize(chunkCount);
+    auto cullChunks = [&](uint32_t begin, uint32_t end, uint32_t)
+    {
+        for (uint32_t chunk = begin; chunk < end; chunk++)
+        {
+            _chunkVisible[chunk].clear();
+            CullRange(frustum, chunk * kChunkSize, (std::min)(_count, (chunk + 1) * kChunkSize), _chunkVisible[chunk]);
+        }
+    };
+    if (threadPool != nullptr && chunkCount > 1)
+        threadPool->ParallelFor(chunkCount, 1, cullChunks);
+    else
+        cullChunks(0, chunkCount, 0);
+
+    //compacted in chunk order, so the list stays sorted by index whatever thread ran a chunk
+    size_t total = 0;
+    for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+    {
+        total += _chunkVisible[chunk].size();
+    }
+    visible.reserve(total);
+    for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+    {
+        visible.insert(visible.end(), _chunkVisible[chunk].begin(), _chunkVisible[chunk].end());
+    }
+    _statistics.visible = static_cast<uint32_t>(total);
+    _statistics.chunks = chunkCount;
+}
+
+void FrustumCuller::CullRange(const Frustum& frustum, uint32_t begin, uint32_t end, std::vector<uint32_t>& visible) const
+{
+    //begin is a multiple of the vector width, lanes past end read padding and are dropped here
+    auto emit = [&](uint32_t insideMask, uint32_t first, uint32_t lanes)
+    {
+        for (uint32_t lane = 0; lane < lanes && first + lane < end; lane++)
+        {
+            if (insideMask & (1u << lane))
+                visible.push_back(_ids[first + lane]);
+        }
+    };
+
+#ifdef FRUSTUM_CULLER_AVX2
+    if (HasAvx2())
+    {
+        FrustumCullerAvx2Input input;
+        for (int p = 0; p < 6; p++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                input.planes[p][c] = frustum.planes[p][c];
+                input.absNormals[p][c] = frustum.absNormals[p][c];
+            }
+            input.planes[p][3] = frustum.planes[p].w;
+        }
+        input.boxCenter[0] = _boxCenterX.data();
+        input.boxCenter[1] = _boxCenterY.data();
+        input.boxCenter[2] = _boxCenterZ.data();
+        input.boxExtent[0] = _boxExtentX.data();
+        input.boxExtent[1] = _boxExtentY.data();
+        input.boxExtent[2] = _boxExtentZ.data();
+        input.sphereCenter[0] = _sphereX.data();
+        input.sphereCenter[1] = _sphereY.data();
+        input.sphereCenter[2] = _sphereZ.data();
+        input.sphereRadius = _sphereRadius.data();
+        //a range never spans more than one chunk
+        uint8_t masks[kChunkSize / 8];
+        CullFrustumAvx2(input, begin, end, masks);
+        for (uint32_t i = begin; i < end; i += 8)
+        {
+            emit(masks[(i - begin) / 8], i, 8);
+        }
+        return;
+    }
+#endif
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    glm_vec4 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+    for (int p = 0; p < 6; p++)
+    {
+        planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+        absX[p] = _mm_set1_ps(frustum.absNormals[p].x);
+        absY[p] = _mm_set1_ps(frustum.absNormals[p].y);
+        absZ[p] = _mm_set1_ps(frustum.absNormals[p].z);
+    }
+    const glm_vec4 zero = _mm_setzero_ps();
+    for (uint32_t i = begin; i < end; i += 4)
+    {
+        glm_vec4 boxX = _mm_loadu_ps(&_boxCenterX[i]);
+        glm_vec4 boxY = _mm_loadu_ps(&_boxCenterY[i]);
+        glm_vec4 boxZ = _mm_loadu_ps(&_boxCenterZ[i]);
+        glm_vec4 extentX = _mm_loadu_ps(&_boxExtentX[i]);
+        glm_vec4 extentY = _mm_loadu_ps(&_boxExtentY[i]);
+        glm_vec4 extentZ = _mm_loadu_ps(&_boxExtentZ[i]);
+        glm_vec4 sphereX = _mm_loadu_ps(&_sphereX[i]);
+        glm_vec4 sphereY = _mm_loadu_ps(&_sphereY[i]);
+        glm_vec4 sphereZ = _mm_loadu_ps(&_sphereZ[i]);
+        glm_vec4 radius = _mm_loadu_ps(&_sphereRadius[i]);
+        glm_vec4 outside = zero;
+        for (int p = 0; p < 6; p++)
+        {
+            glm_vec4 boxDistance = glm_vec4_fma(planeX[p], boxX,
+                glm_vec4_fma(planeY[p], boxY, glm_vec4_fma(planeZ[p], boxZ, planeW[p])));
+            glm_vec4 boxRadius = glm_vec4_fma(absX[p], extentX,
+                glm_vec4_fma(absY[p], extentY, glm_vec4_mul(absZ[p], extentZ)));
+            glm_vec4 sphereDistance = glm_vec4_fma(planeX[p], sphereX,
+                glm_vec4_fma(planeY[p], sphereY, glm_vec4_fma(planeZ[p], sphereZ, planeW[p])));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(glm_vec4_add(boxDistance, boxRadius), zero));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(glm_vec4_add(sphereDistance, radius), zero));
+        }
+        emit(~static_cast<uint32_t>(_mm_movemask_ps(outside)) & 0xf, i, 4);
+    }
+#else
+    for (uint32_t i = begin; i < end; i++)
+    {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            const glm::vec3& absNormal = frustum.absNormals[p];
+            float boxDistance = plane.x * _boxCenterX[i] + plane.y * _boxCenterY[i] + plane.z * _boxCenterZ[i] + plane.w;
+            float boxRadius = absNormal.x * _boxExtentX[i] + absNormal.y * _boxExtentY[i] + absNormal.z * _boxExtentZ[i];
+            float sphereDistance = plane.x * _sphereX[i] + plane.y * _sphereY[i] + plane.z * _sphereZ[i] + plane.w;
+            inside = boxDistance + boxRadius >= 0.0f && sphereDistance + _sphereRadius[i] >= 0.0f;
+        }
+        emit(inside ? 1u : 0u, i, 1);
+    }
+#endif
+}
+
+void FrustumCuller::ExtractPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+    //glm is column major, row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    //clip space depth starts at 0 in vulkan, not at -w
+    planes[4] = rows[2];
+    planes[5] = rows[3] - rows[2];
+    for (int i = 0; i < 6; i++)
+    {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
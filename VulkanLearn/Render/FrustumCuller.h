@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+#include "ThreadPool.h"
+
+//cpu frustum culling over bounding volumes kept as structure of arrays. every plane is tested
+//against 4 objects per instruction with SSE, or 8 with AVX2 on cpus that have it, instead of
+//one glm::vec4 dot product per object and plane. an object is culled when its box or its
+//sphere is completely outside one of the planes
+//
+//the AVX2 path lives in FrustumCullerAvx2.cpp, the only file built for AVX2, and is picked at
+//run time. SSE needs GLM_FORCE_INTRINSICS so glm enables its simd helpers, without it and
+//without AVX2 the scalar loop runs
+class FrustumCuller
+{
+public:
+    struct Statistics
+    {
+        uint32_t objects = 0;
+        uint32_t visible = 0;
+        uint32_t chunks = 0;
+    };
+
+    //id is what the visible list reports, e.g. an index into the scene's objects
+    uint32_t Add(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& sphere, uint32_t id);
+    void Update(uint32_t index, const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& sphere);
+    //the last object is moved into the freed index
+    void Remove(uint32_t index);
+    void Clear();
+
+    //fills visible with the ids of every object inside the frustum, in index order. chunks are
+    //spread over the pool, call it from the thread owning the pool
+    void Cull(const glm::mat4& viewProjection, ThreadPool* threadPool, std::vector<uint32_t>& visible);
+
+    uint32_t GetCount() const { return _count; }
+    const Statistics& GetStatistics() const { return _statistics; }
+
+    //normalized planes left, right, bottom, top, near, far of a matrix with vulkan's [0, 1] depth
+    //range, a point is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them
+    static void ExtractPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
+private:
+    //multiple of every simd width, so a chunk never splits a vector
+    static const uint32_t kChunkSize = 4096;
+
+    //the planes broadcast once per Cull, abs of the normals gives the box's projected extent
+    struct Frustum
+    {
+        glm::vec4 planes[6];
+        glm::vec3 absNormals[6];
+    };
+
+    void Write(uint32_t index, const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& sphere);
+    void Move(uint32_t from, uint32_t to);
+    //appends the ids of visible objects in [begin, end) to visible
+    void CullRange(const Frustum& frustum, uint32_t begin, uint32_t end, std::vector<uint32_t>& visible) const;
+
+private:
+    uint32_t _count = 0;
+    //box center and half extents, sphere center and radius, padded to whole vectors
+    std::vector<float> _boxCenterX, _boxCenterY, _boxCenterZ;
+    std::vector<float> _boxExtentX, _boxExtentY, _boxExtentZ;
+    std::vector<float> _sphereX, _sphereY, _sphereZ, _sphereRadius;
+    std::vector<uint32_t> _ids;
+
+    //visible ids per chunk, concatenated in chunk order once every chunk ran
+    std::vector<std::vector<uint32_t>> _chunkVisible;
+    Statistics _statistics;
+};
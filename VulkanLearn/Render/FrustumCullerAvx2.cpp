@@ -0,0 +1,54 @@
+#include "FrustumCullerAvx2.h"
+
+#ifdef FRUSTUM_CULLER_AVX2
+#include <immintrin.h>
+
+//msvc builds this file with /arch:AVX2 through the project, gcc and clang through the attribute
+#if defined(__GNUC__)
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#else
+#define AVX2_TARGET
+#endif
+
+AVX2_TARGET void CullFrustumAvx2(const FrustumCullerAvx2Input& input, uint32_t begin, uint32_t end, uint8_t* masks)
+{
+    __m256 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+    for (int p = 0; p < 6; p++)
+    {
+        planeX[p] = _mm256_set1_ps(input.planes[p][0]);
+        planeY[p] = _mm256_set1_ps(input.planes[p][1]);
+        planeZ[p] = _mm256_set1_ps(input.planes[p][2]);
+        planeW[p] = _mm256_set1_ps(input.planes[p][3]);
+        absX[p] = _mm256_set1_ps(input.absNormals[p][0]);
+        absY[p] = _mm256_set1_ps(input.absNormals[p][1]);
+        absZ[p] = _mm256_set1_ps(input.absNormals[p][2]);
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    for (uint32_t i = begin; i < end; i += 8)
+    {
+        __m256 boxX = _mm256_loadu_ps(input.boxCenter[0] + i);
+        __m256 boxY = _mm256_loadu_ps(input.boxCenter[1] + i);
+        __m256 boxZ = _mm256_loadu_ps(input.boxCenter[2] + i);
+        __m256 extentX = _mm256_loadu_ps(input.boxExtent[0] + i);
+        __m256 extentY = _mm256_loadu_ps(input.boxExtent[1] + i);
+        __m256 extentZ = _mm256_loadu_ps(input.boxExtent[2] + i);
+        __m256 sphereX = _mm256_loadu_ps(input.sphereCenter[0] + i);
+        __m256 sphereY = _mm256_loadu_ps(input.sphereCenter[1] + i);
+        __m256 sphereZ = _mm256_loadu_ps(input.sphereCenter[2] + i);
+        __m256 radius = _mm256_loadu_ps(input.sphereRadius + i);
+        __m256 outside = zero;
+        for (int p = 0; p < 6; p++)
+        {
+            __m256 boxDistance = _mm256_fmadd_ps(planeX[p], boxX,
+                _mm256_fmadd_ps(planeY[p], boxY, _mm256_fmadd_ps(planeZ[p], boxZ, planeW[p])));
+            __m256 boxRadius = _mm256_fmadd_ps(absX[p], extentX,
+                _mm256_fmadd_ps(absY[p], extentY, _mm256_mul_ps(absZ[p], extentZ)));
+            __m256 sphereDistance = _mm256_fmadd_ps(planeX[p], sphereX,
+                _mm256_fmadd_ps(planeY[p], sphereY, _mm256_fmadd_ps(planeZ[p], sphereZ, planeW[p])));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(boxDistance, boxRadius), zero, _CMP_LT_OQ));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(sphereDistance, radius), zero, _CMP_LT_OQ));
+        }
+        masks[(i - begin) / 8] = static_cast<uint8_t>(~_mm256_movemask_ps(outside));
+    }
+}
+#endif
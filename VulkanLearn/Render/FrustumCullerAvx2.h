@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+//the AVX2 kernel of FrustumCuller, built on x86 targets and only called once the cpu was checked
+//for AVX2 and FMA. its file is the only one compiled for AVX2, so the interface is plain data and
+//it includes nothing with inline functions that another file could end up linking to
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FRUSTUM_CULLER_AVX2 1
+#endif
+
+struct FrustumCullerAvx2Input
+{
+    //plane xyzw and the abs of its normal
+    float planes[6][4];
+    float absNormals[6][3];
+    //structure of arrays padded to a multiple of 8
+    const float* boxCenter[3];
+    const float* boxExtent[3];
+    const float* sphereCenter[3];
+    const float* sphereRadius;
+};
+
+//bit i of masks[j] is set when object begin + 8 * j + i is inside, begin is a multiple of 8
+void CullFrustumAvx2(const FrustumCullerAvx2Input& input, uint32_t begin, uint32_t end, uint8_t* masks);
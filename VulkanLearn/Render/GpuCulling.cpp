@@ -0,0 +1,404 @@
+#include "GpuCulling.h"
+#include "VulkanCheck.h"
+#include "CpuProfiler.h"
+#include "FrustumCuller.h"
+
+#include <algorithm>
+
+namespace
+{
+    const uint32_t kWorkgroupSize = 64;
+    //the largest minUniformBufferOffsetAlignment the spec allows, so no device limit is needed
+    const VkDeviceSize kUniformAlignment = 256;
+
+    enum Binding : uint32_t
+    {
+        kUniformBinding = 0,
+        kInstanceBinding,
+        kMeshBinding,
+        kBatchBinding,
+        kCommandBinding,
+        kCountBinding,
+        kPyramidBinding,
+        kBindingCount,
+    };
+}
+
+void GpuCulling::Create(VkDevice device, const HostAllocator* hostAllocator, MemoryAllocator* memoryAllocator,
+    DescriptorLayoutCache* layoutCache, ShaderCache* shaderCache, PipelineCache* pipelineCache,
+    PipelineManager* pipelineManager, ThreadPool* threadPool, const std::string& shaderDirectory,
+    uint32_t instanceCapacity, uint32_t meshCapacity, uint32_t commandCapacity)
+{
+    static_assert(sizeof(Instance) == 32, "Instance must match the shader layout");
+    static_assert(sizeof(CullUniforms) == 176, "CullUniforms must match the shader layout");
+    static_assert(sizeof(VkDrawIndexedIndirectCommand) == 20, "commands are written by the shader");
+
+    _device = device;
+    _hostAllocator = hostAllocator;
+    _memoryAllocator = memoryAllocator;
+    _pipelineCache = pipelineCache;
+    _pipelineManager = pipelineManager;
+    _instanceCapacity = instanceCapacity;
+    _meshCapacity = meshCapacity;
+    _commandCapacity = commandCapacity;
+
+    //the pyramid binding is only written while occlusion culling is on, the frustum only
+    //pipeline never touches it
+    std::vector<VkDescriptorSetLayoutBinding> bindings(kBindingCount);
+    for (uint32_t i = 0; i < kBindingCount; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    bindings[kUniformBinding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    bindings[kPyramidBinding].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    _setLayout = layoutCache->Get(bindings);
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_setLayout;
+    VkResult res = vkCreatePipelineLayout(_device, &layoutInfo,
+        _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE_LAYOUT), &_pipelineLayout);
+    CHECK_SUCCESS(res, "failed to create culling pipeline layout!!!")
+
+    //two small pipelines outside the pipeline manager, loaded and compiled on the workers while
+    //the rest of the renderer is set up. the shader cache and the pipeline cache are thread safe
+    std::string frustumPath = shaderDirectory + "cull.comp.spv";
+    std::string occlusionPath = shaderDirectory + "cull_occlusion.comp.spv";
+    _frustumPipelineReady = threadPool->Submit([this, shaderCache, frustumPath]
+        {
+            return CreatePipeline(shaderCache->Load(frustumPath));
+        });
+    _occlusionPipelineReady = threadPool->Submit([this, shaderCache, occlusionPath]
+        {
+            return CreatePipeline(shaderCache->Load(occlusionPath));
+        });
+
+    CreateBuffer(sizeof(Instance) * static_cast<VkDeviceSize>(_instanceCapacity),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, _instanceBuffer, _instanceMemory);
+    CreateBuffer(sizeof(Mesh) * static_cast<VkDeviceSize>(_meshCapacity),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, _meshBuffer, _meshMemory);
+    CreateBuffer(sizeof(BatchData) * static_cast<VkDeviceSize>(kMaxBatches),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, _batchBuffer, _batchMemory);
+    CreateBuffer(sizeof(VkDrawIndexedIndirectCommand) * static_cast<VkDeviceSize>(_commandCapacity),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, _commandBuffer, _commandMemory);
+    CreateBuffer(sizeof(uint32_t) * static_cast<VkDeviceSize>(kMaxBatches),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        _countBuffer, _countMemory);
+
+    _instances.reserve(_instanceCapacity);
+    _meshes.reserve(_meshCapacity);
+    _batchData.reserve(kMaxBatches);
+    _batches.reserve(kMaxBatches);
+}
+
+void GpuCulling::Destroy()
+{
+    if (_device == VK_NULL_HANDLE)
+        return;
+    //the compiles may still be running when Prepare never ran
+    WaitForPipelines();
+    _memoryAllocator->DestroyBuffer(_instanceBuffer, _instanceMemory);
+    _memoryAllocator->DestroyBuffer(_meshBuffer, _meshMemory);
+    _memoryAllocator->DestroyBuffer(_batchBuffer, _batchMemory);
+    _memoryAllocator->DestroyBuffer(_commandBuffer, _commandMemory);
+    _memoryAllocator->DestroyBuffer(_countBuffer, _countMemory);
+    vkDestroyPipeline(_device, _frustumPipeline, _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE));
+    vkDestroyPipeline(_device, _occlusionPipeline, _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE));
+    vkDestroyPipelineLayout(_device, _pipelineLayout, _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE_LAYOUT));
+    //the set layout belongs to the layout cache
+    _setLayout = VK_NULL_HANDLE;
+    _frustumPipeline = VK_NULL_HANDLE;
+    _occlusionPipeline = VK_NULL_HANDLE;
+    _pipelineLayout = VK_NULL_HANDLE;
+    _instances.clear();
+    _meshes.clear();
+    _batchData.clear();
+    _batches.clear();
+    _commandsUsed = 0;
+    _uploadedCount = 0;
+    _dirtyBegin = _dirtyEnd = 0;
+    _frameSet = VK_NULL_HANDLE;
+    _device = VK_NULL_HANDLE;
+}
+
+void GpuCulling::PrintStatistics(std::ostream& out) const
+{
+    out << "gpu culling: " << _instances.size() << " instances, " << _meshes.size() << " meshes, "
+        << _batches.size() << " batches, " << _commandsUsed << "/" << _commandCapacity << " commands" << std::endl;
+}
+
+uint32_t GpuCulling::AddMesh(uint32_t indexCount, uint32_t firstIndex, int32_t vertexOffset)
+{
+    if (_meshes.size() >= _meshCapacity)
+        return kInvalidIndex;
+    _meshes.push_back({ indexCount, firstIndex, vertexOffset, 0 });
+    _meshesDirty = true;
+    return static_cast<uint32_t>(_meshes.size() - 1);
+}
+
+uint32_t GpuCulling::AddBatch(PipelineManager::Handle pipeline, VkBuffer vertexBuffer, VkBuffer indexBuffer,
+    VkIndexType indexType, uint32_t capacity, uint32_t material, uint32_t bufferIndex)
+{
+    if (_batches.size() >= kMaxBatches || capacity == 0 || capacity > _commandCapacity - _commandsUsed)
+        return kInvalidIndex;
+    _batchData.push_back({ _commandsUsed, capacity, 0, 0 });
+    _batches.push_back({ pipeline, vertexBuffer, indexBuffer, indexType, material, bufferIndex });
+    _commandsUsed += capacity;
+    _batchesDirty = true;
+    return static_cast<uint32_t>(_batches.size() - 1);
+}
+
+uint32_t GpuCulling::AddInstance(const glm::vec4& sphere, uint32_t batch, uint32_t mesh, uint32_t object)
+{
+    //the shader trusts both indices, so they are checked here once
+    if (_instances.size() >= _instanceCapacity || batch >= _batches.size() || mesh >= _meshes.size())
+        return kInvalidIndex;
+    _instances.push_back({ sphere, batch, mesh, object, 0 });
+    uint32_t index = static_cast<uint32_t>(_instances.size() - 1);
+    MarkInstanceDirty(index);
+    return index;
+}
+
+void GpuCulling::UpdateInstance(uint32_t index, const glm::vec4& sphere)
+{
+    _instances[index].sphere = sphere;
+    MarkInstanceDirty(index);
+}
+
+void GpuCulling::RemoveInstance(uint32_t index)
+{
+    uint32_t last = static_cast<uint32_t>(_instances.size() - 1);
+    if (index != last)
+    {
+        _instances[index] = _instances[last];
+        MarkInstanceDirty(index);
+    }
+    _instances.pop_back();
+    _uploadedCount = (std::min)(_uploadedCount, last);
+    _dirtyEnd = (std::min)(_dirtyEnd, last);
+    _dirtyBegin = (std::min)(_dirtyBegin, _dirtyEnd);
+}
+
+void GpuCulling::MarkInstanceDirty(uint32_t index)
+{
+    if (_dirtyBegin == _dirtyEnd)
+    {
+        _dirtyBegin = index;
+        _dirtyEnd = index + 1;
+        return;
+    }
+    _dirtyBegin = (std::min)(_dirtyBegin, index);
+    _dirtyEnd = (std::max)(_dirtyEnd, index + 1);
+}
+
+void GpuCulling::SetOcclusionPyramid(VkImageView view, VkSampler sampler, uint32_t width, uint32_t height,
+    uint32_t mipLevels, const glm::mat4& viewProjection)
+{
+    _pyramidView = view;
+    _pyramidSampler = sampler;
+    _pyramidSize = glm::vec2(static_cast<float>(width), static_cast<float>(height));
+    _pyramidMips = mipLevels;
+    _pyramidViewProjection = viewProjection;
+}
+
+void GpuCulling::Prepare(StagingRing& stagingRing, DescriptorAllocator& descriptorAllocator,
+    const glm::mat4& viewProjection)
+{
+    PROFILE_FUNCTION();
+    WaitForPipelines();
+    _frameSet = VK_NULL_HANDLE;
+
+    //instances may only reach the gpu after the meshes and batches they point at, so a full ring
+    //holds back everything behind the first upload that did not fit
+    bool uploaded = true;
+    if (_meshesDirty)
+    {
+        uploaded = stagingRing.UploadBuffer(_meshBuffer, 0, _meshes.data(), sizeof(Mesh) * _meshes.size());
+        _meshesDirty = !uploaded;
+    }
+    if (uploaded && _batchesDirty)
+    {
+        uploaded = stagingRing.UploadBuffer(_batchBuffer, 0, _batchData.data(), sizeof(BatchData) * _batchData.size());
+        _batchesDirty = !uploaded;
+    }
+    if (uploaded && _dirtyBegin < _dirtyEnd)
+    {
+        uploaded = stagingRing.UploadBuffer(_instanceBuffer, sizeof(Instance) * static_cast<VkDeviceSize>(_dirtyBegin),
+            &_instances[_dirtyBegin], sizeof(Instance) * static_cast<VkDeviceSize>(_dirtyEnd - _dirtyBegin));
+        if (uploaded)
+            _dirtyBegin = _dirtyEnd = 0;
+    }
+    //instances that were moved or updated keep culling with their old data until the retry
+    if (uploaded)
+        _uploadedCount = static_cast<uint32_t>(_instances.size());
+    if (_uploadedCount == 0)
+        return;
+
+    VkDeviceSize uniformOffset = 0;
+    void* mapped = nullptr;
+    if (!stagingRing.Allocate(sizeof(CullUniforms), kUniformAlignment, uniformOffset, mapped))
+        return;
+    _frameOcclusion = _pyramidView != VK_NULL_HANDLE && _pyramidMips > 0;
+    CullUniforms* uniforms = static_cast<CullUniforms*>(mapped);
+    FrustumCuller::ExtractPlanes(viewProjection, uniforms->planes);
+    uniforms->pyramidViewProjection = _pyramidViewProjection;
+    uniforms->pyramidSize = _pyramidSize;
+    uniforms->pyramidMips = _pyramidMips;
+    uniforms->instanceCount = _uploadedCount;
+
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    if (!descriptorAllocator.Allocate(_setLayout, set))
+        return;
+
+    VkDescriptorBufferInfo bufferInfos[kPyramidBinding] = {};
+    bufferInfos[kUniformBinding] = { stagingRing.GetBuffer(), uniformOffset, sizeof(CullUniforms) };
+    bufferInfos[kInstanceBinding] = { _instanceBuffer, 0, VK_WHOLE_SIZE };
+    bufferInfos[kMeshBinding] = { _meshBuffer, 0, VK_WHOLE_SIZE };
+    bufferInfos[kBatchBinding] = { _batchBuffer, 0, VK_WHOLE_SIZE };
+    bufferInfos[kCommandBinding] = { _commandBuffer, 0, VK_WHOLE_SIZE };
+    bufferInfos[kCountBinding] = { _countBuffer, 0, VK_WHOLE_SIZE };
+    VkDescriptorImageInfo imageInfo{ _pyramidSampler, _pyramidView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+    VkWriteDescriptorSet writes[kBindingCount] = {};
+    for (uint32_t i = 0; i < kBindingCount; i++)
+    {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        if (i < kPyramidBinding)
+            writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    writes[kUniformBinding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writes[kPyramidBinding].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[kPyramidBinding].pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(_device, _frameOcclusion ? kBindingCount : kPyramidBinding, writes, 0, nullptr);
+    _frameSet = set;
+}
+
+void GpuCulling::AddPasses(RenderGraph& graph)
+{
+    //only the gpu writes these, what the previous frame's draws read is all that has to finish
+    RenderGraph::Handle commands = graph.ImportBuffer("cull commands", VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0);
+    RenderGraph::Handle counts = graph.ImportBuffer("cull counts", VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0);
+    graph.SetBuffer(commands, _commandBuffer);
+    graph.SetBuffer(counts, _countBuffer);
+    _commandResource = commands;
+    _countResource = counts;
+
+    graph.AddPass("cull reset",
+        [counts](RenderGraph::PassBuilder& builder)
+        {
+            builder.Write(counts, RenderGraph::Access::TransferWrite);
+        },
+        [this](VkCommandBuffer commandBuffer)
+        {
+            vkCmdFillBuffer(commandBuffer, _countBuffer, 0, VK_WHOLE_SIZE, 0);
+        });
+    //commands past a batch's draw count are never read, so they are not cleared
+    graph.AddPass("cull",
+        [commands, counts](RenderGraph::PassBuilder& builder)
+        {
+            builder.Read(counts, RenderGraph::Access::ComputeShaderRead);
+            builder.Write(counts, RenderGraph::Access::ComputeShaderWrite);
+            builder.Write(commands, RenderGraph::Access::ComputeShaderWrite);
+        },
+        [this](VkCommandBuffer commandBuffer)
+        {
+            Cull(commandBuffer);
+        });
+}
+
+void GpuCulling::DeclareDraws(RenderGraph::PassBuilder& builder)
+{
+    builder.Read(_commandResource, RenderGraph::Access::IndirectBufferRead);
+    builder.Read(_countResource, RenderGraph::Access::IndirectBufferRead);
+}
+
+void GpuCulling::Cull(VkCommandBuffer commandBuffer)
+{
+    //without a set the counts stay zero and nothing is drawn this frame
+    if (_frameSet == VK_NULL_HANDLE)
+        return;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        _frameOcclusion ? _occlusionPipeline : _frustumPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1,
+        &_frameSet, 0, nullptr);
+    vkCmdDispatch(commandBuffer, (_uploadedCount + kWorkgroupSize - 1) / kWorkgroupSize, 1, 1);
+}
+
+void GpuCulling::Draw(VkCommandBuffer commandBuffer, BindlessHeap* bindlessHeap)
+{
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    const VkDeviceSize zero = 0;
+    for (size_t i = 0; i < _batches.size(); i++)
+    {
+        const Batch& batch = _batches[i];
+        const BatchData& data = _batchData[i];
+        VkPipeline pipeline = _pipelineManager->Get(batch.pipeline);
+        if (pipeline == VK_NULL_HANDLE)
+            continue;
+        if (pipeline != boundPipeline)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            boundPipeline = pipeline;
+        }
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &batch.vertexBuffer, &zero);
+        vkCmdBindIndexBuffer(commandBuffer, batch.indexBuffer, 0, batch.indexType);
+        //otherwise the batch would see whatever the last sorted draw pushed
+        if (bindlessHeap != nullptr)
+        {
+            BindlessHeap::PushConstants constants;
+            constants.textureIndex = batch.material;
+            constants.bufferIndex = batch.bufferIndex;
+            constants.drawIndex = static_cast<uint32_t>(i);
+            bindlessHeap->Push(commandBuffer, constants);
+        }
+        vkCmdDrawIndexedIndirectCount(commandBuffer,
+            _commandBuffer, sizeof(VkDrawIndexedIndirectCommand) * static_cast<VkDeviceSize>(data.commandOffset),
+            _countBuffer, sizeof(uint32_t) * static_cast<VkDeviceSize>(i),
+            data.capacity, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
+
+VkPipeline GpuCulling::CreatePipeline(VkShaderModule module)
+{
+    VkComputePipelineCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    info.stage.module = module;
+    info.stage.pName = "main";
+    info.layout = _pipelineLayout;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult res = vkCreateComputePipelines(_device, _pipelineCache->Get(), 1, &info,
+        _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE), &pipeline);
+    CHECK_SUCCESS(res, "failed to create culling pipeline!!!")
+    return pipeline;
+}
+
+void GpuCulling::WaitForPipelines()
+{
+    if (_frustumPipelineReady.valid())
+        _frustumPipeline = _frustumPipelineReady.get();
+    if (_occlusionPipelineReady.valid())
+        _occlusionPipeline = _occlusionPipelineReady.get();
+}
+
+void GpuCulling::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, MemoryAllocation& allocation)
+{
+    VkBufferCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    //zero sized buffers are not allowed
+    info.size = (std::max)(size, static_cast<VkDeviceSize>(16));
+    info.usage = usage;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    _memoryAllocator->CreateBuffer(info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, buffer, allocation);
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <future>
+#include <ostream>
+#include <cstdint>
+
+#include "HostAllocator.h"
+#include "MemoryAllocator.h"
+#include "StagingRing.h"
+#include "DescriptorAllocator.h"
+#include "PipelineCache.h"
+#include "PipelineManager.h"
+#include "ShaderCache.h"
+#include "RenderGraph.h"
+#include "ThreadPool.h"
+#include "BindlessHeap.h"
+
+//gpu driven drawing for scenes too large to walk on the cpu. instances live in a storage buffer,
+//a compute pass tests every one of them against the frustum and optionally against a depth
+//pyramid, and appends the survivors to the indirect commands of their batch. each batch is then
+//drawn with a single vkCmdDrawIndexedIndirectCount, so the cpu cost of a frame no longer grows
+//with the number of instances
+//
+//needs the multiDrawIndirect, drawIndirectFirstInstance and drawIndirectCount features, the latter
+//is core in vulkan 1.2
+class GpuCulling
+{
+public:
+    static const uint32_t kInvalidIndex = 0xffffffff;
+    //draw counts live in one small buffer, one per batch
+    static const uint32_t kMaxBatches = 1024;
+
+    //the cull shaders are loaded and compiled on threadPool, the first Prepare waits for them
+    void Create(VkDevice device, const HostAllocator* hostAllocator, MemoryAllocator* memoryAllocator,
+        DescriptorLayoutCache* layoutCache, ShaderCache* shaderCache, PipelineCache* pipelineCache,
+        PipelineManager* pipelineManager, ThreadPool* threadPool, const std::string& shaderDirectory,
+        uint32_t instanceCapacity, uint32_t meshCapacity, uint32_t commandCapacity);
+    //the gpu must be idle, the buffers are destroyed right away
+    void Destroy();
+
+    //an index range of the batch's index buffer, returns kInvalidIndex when full
+    uint32_t AddMesh(uint32_t indexCount, uint32_t firstIndex, int32_t vertexOffset);
+    //every instance of a batch is drawn with the same pipeline and buffers, at most capacity of
+    //them per frame. material and bufferIndex are the bindless indices pushed for the batch.
+    //returns kInvalidIndex when no batch or command space is left
+    uint32_t AddBatch(PipelineManager::Handle pipeline, VkBuffer vertexBuffer, VkBuffer indexBuffer,
+        VkIndexType indexType, uint32_t capacity, uint32_t material = BindlessHeap::kInvalidIndex,
+        uint32_t bufferIndex = BindlessHeap::kInvalidIndex);
+    //sphere is the world space bounding sphere, xyz center and w radius. object is handed to the
+    //vertex shader as gl_InstanceIndex to find the per object data
+    uint32_t AddInstance(const glm::vec4& sphere, uint32_t batch, uint32_t mesh, uint32_t object);
+    void UpdateInstance(uint32_t index, const glm::vec4& sphere);
+    //the last instance is moved into the freed index
+    void RemoveInstance(uint32_t index);
+
+    //depth pyramid of an earlier frame and the matrix it was rendered with. the image has to be in
+    //SHADER_READ_ONLY_OPTIMAL and visible to compute shaders, each mip holding the farthest depth
+    //of the mip below, and the sampler must use nearest filtering. a null view disables the test
+    void SetOcclusionPyramid(VkImageView view, VkSampler sampler, uint32_t width, uint32_t height,
+        uint32_t mipLevels, const glm::mat4& viewProjection);
+
+    //queues changed instances into the ring and writes the descriptors of this frame, call it
+    //before the staging ring is flushed
+    void Prepare(StagingRing& stagingRing, DescriptorAllocator& descriptorAllocator,
+        const glm::mat4& viewProjection);
+    //adds the culling passes, call it before the pass that draws
+    void AddPasses(RenderGraph& graph);
+    //declares the indirect reads of the pass calling Draw
+    void DeclareDraws(RenderGraph::PassBuilder& builder);
+    //records one indirect draw per batch, the caller sets viewport, scissor and descriptors. with
+    //the bindless heap every batch pushes its indices like DrawQueue::Record, drawIndex is the batch
+    void Draw(VkCommandBuffer commandBuffer, BindlessHeap* bindlessHeap);
+
+    uint32_t GetInstanceCount() const { return static_cast<uint32_t>(_instances.size()); }
+    uint32_t GetBatchCount() const { return static_cast<uint32_t>(_batches.size()); }
+    void PrintStatistics(std::ostream& out) const;
+
+private:
+    //the structs below mirror Shaders/cull_common.glsl
+    struct Instance
+    {
+        glm::vec4 sphere;
+        uint32_t batch;
+        uint32_t mesh;
+        uint32_t object;
+        uint32_t pad;
+    };
+
+    struct Mesh
+    {
+        uint32_t indexCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t pad;
+    };
+
+    struct BatchData
+    {
+        uint32_t commandOffset;
+        uint32_t capacity;
+        uint32_t pad0;
+        uint32_t pad1;
+    };
+
+    //std140, vec2 and the two uints pack into the last 16 bytes
+    struct CullUniforms
+    {
+        glm::vec4 planes[6];
+        glm::mat4 pyramidViewProjection;
+        glm::vec2 pyramidSize;
+        uint32_t pyramidMips;
+        uint32_t instanceCount;
+    };
+
+    //what Draw binds, kept apart from the gpu copy
+    struct Batch
+    {
+        PipelineManager::Handle pipeline;
+        VkBuffer vertexBuffer;
+        VkBuffer indexBuffer;
+        VkIndexType indexType;
+        uint32_t material;
+        uint32_t bufferIndex;
+    };
+
+    VkPipeline CreatePipeline(VkShaderModule module);
+    //takes the pipelines compiled on the thread pool, rethrows when their compile failed
+    void WaitForPipelines();
+    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, MemoryAllocation& allocation);
+    void MarkInstanceDirty(uint32_t index);
+    void Cull(VkCommandBuffer commandBuffer);
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    MemoryAllocator* _memoryAllocator = nullptr;
+    PipelineCache* _pipelineCache = nullptr;
+    PipelineManager* _pipelineManager = nullptr;
+
+    VkDescriptorSetLayout _setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout _pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline _frustumPipeline = VK_NULL_HANDLE;
+    VkPipeline _occlusionPipeline = VK_NULL_HANDLE;
+    //valid until WaitForPipelines took them
+    std::future<VkPipeline> _frustumPipelineReady;
+    std::future<VkPipeline> _occlusionPipelineReady;
+
+    uint32_t _instanceCapacity = 0;
+    uint32_t _meshCapacity = 0;
+    uint32_t _commandCapacity = 0;
+    VkBuffer _instanceBuffer = VK_NULL_HANDLE;
+    VkBuffer _meshBuffer = VK_NULL_HANDLE;
+    VkBuffer _batchBuffer = VK_NULL_HANDLE;
+    VkBuffer _commandBuffer = VK_NULL_HANDLE;
+    VkBuffer _countBuffer = VK_NULL_HANDLE;
+    MemoryAllocation _instanceMemory;
+    MemoryAllocation _meshMemory;
+    MemoryAllocation _batchMemory;
+    MemoryAllocation _commandMemory;
+    MemoryAllocation _countMemory;
+
+    //cpu copies, changes are uploaded by the next Prepare
+    std::vector<Instance> _instances;
+    std::vector<Mesh> _meshes;
+    std::vector<BatchData> _batchData;
+    std::vector<Batch> _batches;
+    uint32_t _commandsUsed = 0;
+    //instances [begin, end) changed since the last upload
+    uint32_t _dirtyBegin = 0;
+    uint32_t _dirtyEnd = 0;
+    bool _meshesDirty = false;
+    bool _batchesDirty = false;
+    //instances the gpu copy holds valid data for, new ones only count once their upload made it
+    uint32_t _uploadedCount = 0;
+
+    VkImageView _pyramidView = VK_NULL_HANDLE;
+    VkSampler _pyramidSampler = VK_NULL_HANDLE;
+    glm::vec2 _pyramidSize = glm::vec2(0.0f);
+    uint32_t _pyramidMips = 0;
+    glm::mat4 _pyramidViewProjection = glm::mat4(1.0f);
+
+    //written by Prepare, consumed by the cull pass of the same frame
+    VkDescriptorSet _frameSet = VK_NULL_HANDLE;
+    bool _frameOcclusion = false;
+
+    RenderGraph::Handle _commandResource = RenderGraph::kInvalidHandle;
+    RenderGraph::Handle _countResource = RenderGraph::kInvalidHandle;
+};
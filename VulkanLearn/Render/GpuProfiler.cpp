@@ -0,0 +1,277 @@
+#include "GpuProfiler.h"
+#include "VulkanCheck.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+    const VkQueryPipelineStatisticFlags kStatisticFlags =
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+    //one value per flag above, written in bit order
+    const uint32_t kStatisticCount = 6;
+}
+
+void GpuProfiler::Create(VkPhysicalDevice physicalDevice, VkDevice device, const HostAllocator* hostAllocator,
+    uint32_t queueFamily, uint32_t frameCount, bool pipelineStatistics, uint32_t maxScopes)
+{
+    _device = device;
+    _hostAllocator = hostAllocator;
+    _maxScopes = maxScopes;
+    _pipelineStatistics = pipelineStatistics;
+    _frameIndex = 0;
+    _frameNumber = 0;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+    uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+    //a queue without valid bits cannot write timestamps at all
+    _enabled = validBits > 0;
+    if (!_enabled)
+    {
+        std::cout << "gpu profiler: queue family " << queueFamily << " has no timestamp support" << std::endl;
+        return;
+    }
+    _timestampPeriod = properties.limits.timestampPeriod;
+    _timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+    _frames.resize(frameCount);
+    for (auto& frame : _frames)
+    {
+        VkQueryPoolCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        info.queryCount = _maxScopes * 2;
+        VkResult res = vkCreateQueryPool(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_QUERY_POOL),
+            &frame.timestamps);
+        CHECK_SUCCESS(res, "failed to create timestamp query pool!!!")
+
+        if (_pipelineStatistics)
+        {
+            info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            info.queryCount = _maxScopes;
+            info.pipelineStatistics = kStatisticFlags;
+            res = vkCreateQueryPool(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_QUERY_POOL),
+                &frame.statistics);
+            CHECK_SUCCESS(res, "failed to create pipeline statistics query pool!!!")
+        }
+        frame.names.resize(_maxScopes);
+        frame.depths.resize(_maxScopes);
+        frame.hasStatistics.resize(_maxScopes);
+    }
+}
+
+void GpuProfiler::Destroy()
+{
+    if (_device == VK_NULL_HANDLE)
+        return;
+    if (_enabled)
+        PrintStatistics(std::cout);
+    for (auto& frame : _frames)
+    {
+        vkDestroyQueryPool(_device, frame.timestamps, _hostAllocator->Get(VK_OBJECT_TYPE_QUERY_POOL));
+        if (frame.statistics != VK_NULL_HANDLE)
+            vkDestroyQueryPool(_device, frame.statistics, _hostAllocator->Get(VK_OBJECT_TYPE_QUERY_POOL));
+    }
+    _frames.clear();
+    _history.clear();
+    _lastFrame.clear();
+    _device = VK_NULL_HANDLE;
+}
+
+void GpuProfiler::BeginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+    if (!_enabled)
+        return;
+
+    FrameQueries& frame = _frames[frameIndex];
+    if (frame.recorded)
+        Collect(frame);
+    else
+        _lastFrame.clear();
+
+    //resets have to be recorded outside of a render pass
+    vkCmdResetQueryPool(commandBuffer, frame.timestamps, 0, _maxScopes * 2);
+    if (frame.statistics != VK_NULL_HANDLE)
+        vkCmdResetQueryPool(commandBuffer, frame.statistics, 0, _maxScopes);
+    frame.scopeCount = 0;
+    frame.frameNumber = _frameNumber++;
+    frame.recorded = true;
+
+    _frameIndex = frameIndex;
+    _depth = 0;
+    _statisticsScope = kInvalidScope;
+}
+
+uint32_t GpuProfiler::BeginScope(VkCommandBuffer commandBuffer, const char* name, bool pipelineStatistics)
+{
+    if (!_enabled)
+        return kInvalidScope;
+    FrameQueries& frame = _frames[_frameIndex];
+    if (frame.scopeCount == _maxScopes)
+        return kInvalidScope;
+
+    uint32_t scope = frame.scopeCount++;
+    frame.names[scope] = name;
+    frame.depths[scope] = _depth++;
+    frame.hasStatistics[scope] = pipelineStatistics && frame.statistics != VK_NULL_HANDLE &&
+        _statisticsScope == kInvalidScope;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestamps, scope * 2);
+    if (frame.hasStatistics[scope])
+    {
+        vkCmdBeginQuery(commandBuffer, frame.statistics, scope, 0);
+        _statisticsScope = scope;
+    }
+    return scope;
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+    if (scope == kInvalidScope)
+        return;
+    FrameQueries& frame = _frames[_frameIndex];
+    if (_statisticsScope == scope)
+    {
+        vkCmdEndQuery(commandBuffer, frame.statistics, scope);
+        _statisticsScope = kInvalidScope;
+    }
+    //bottom of pipe only completes once all earlier work of the scope has
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestamps, scope * 2 + 1);
+    _depth--;
+}
+
+void GpuProfiler::Collect(FrameQueries& frame)
+{
+    _lastFrame.clear();
+    _lastFrameNumber = frame.frameNumber;
+    if (frame.scopeCount == 0)
+        return;
+
+    //every value is followed by its availability, no WAIT_BIT since the fence was already waited
+    _timestampData.resize(frame.scopeCount * 2 * 2);
+    vkGetQueryPoolResults(_device, frame.timestamps, 0, frame.scopeCount * 2,
+        _timestampData.size() * sizeof(uint64_t), _timestampData.data(), 2 * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (frame.statistics != VK_NULL_HANDLE)
+    {
+        _statisticsData.resize(frame.scopeCount * (kStatisticCount + 1));
+        vkGetQueryPoolResults(_device, frame.statistics, 0, frame.scopeCount,
+            _statisticsData.size() * sizeof(uint64_t), _statisticsData.data(), (kStatisticCount + 1) * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    }
+
+    uint64_t base = ~0ull;
+    for (uint32_t i = 0; i < frame.scopeCount; i++)
+    {
+        if (_timestampData[i * 4 + 1] != 0)
+            base = (std::min)(base, _timestampData[i * 4] & _timestampMask);
+    }
+
+    //a name used by several scopes of one frame adds up to one sample
+    std::unordered_map<std::string, double> frameTotals;
+    const double msPerTick = _timestampPeriod / 1000000.0;
+    for (uint32_t i = 0; i < frame.scopeCount; i++)
+    {
+        const uint64_t* values = &_timestampData[i * 4];
+        if (values[1] == 0 || values[3] == 0)
+            continue;
+        uint64_t begin = values[0] & _timestampMask;
+        uint64_t end = values[2] & _timestampMask;
+
+        ScopeResult result;
+        result.name = frame.names[i];
+        result.depth = frame.depths[i];
+        result.beginMs = static_cast<double>((begin - base) & _timestampMask) * msPerTick;
+        result.endMs = static_cast<double>((end - base) & _timestampMask) * msPerTick;
+        if (frame.hasStatistics[i])
+        {
+            const uint64_t* counters = &_statisticsData[i * (kStatisticCount + 1)];
+            result.hasPipelineStatistics = counters[kStatisticCount] != 0;
+            result.pipelineStatistics.inputVertices = counters[0];
+            result.pipelineStatistics.inputPrimitives = counters[1];
+            result.pipelineStatistics.vertexInvocations = counters[2];
+            result.pipelineStatistics.clippingPrimitives = counters[3];
+            result.pipelineStatistics.fragmentInvocations = counters[4];
+            result.pipelineStatistics.computeInvocations = counters[5];
+        }
+        frameTotals[result.name] += result.endMs - result.beginMs;
+        _lastFrame.push_back(std::move(result));
+    }
+
+    for (auto& total : frameTotals)
+    {
+        History& history = _history[total.first];
+        history.samples[history.next] = total.second;
+        history.next = (history.next + 1) % kHistorySize;
+        history.count++;
+    }
+}
+
+VkQueryPipelineStatisticFlags GpuProfiler::GetPipelineStatisticFlags() const
+{
+    return _enabled && _pipelineStatistics ? kStatisticFlags : 0;
+}
+
+std::vector<GpuProfiler::ScopeStatistics> GpuProfiler::GetStatistics() const
+{
+    std::vector<ScopeStatistics> statistics;
+    std::vector<double> sorted;
+    for (auto& entry : _history)
+    {
+        const History& history = entry.second;
+        uint32_t count = static_cast<uint32_t>((std::min)(history.count, static_cast<uint64_t>(kHistorySize)));
+        sorted.assign(history.samples, history.samples + count);
+        std::sort(sorted.begin(), sorted.end());
+
+        ScopeStatistics scope;
+        scope.name = entry.first;
+        scope.samples = history.count;
+        scope.lastMs = history.samples[(history.next + kHistorySize - 1) % kHistorySize];
+        scope.minMs = sorted.front();
+        double sum = 0.0;
+        for (double sample : sorted)
+        {
+            sum += sample;
+        }
+        scope.avgMs = sum / count;
+        uint32_t p99 = static_cast<uint32_t>(std::ceil(count * 0.99)) - 1;
+        scope.p99Ms = sorted[p99];
+        statistics.push_back(scope);
+    }
+    std::sort(statistics.begin(), statistics.end(),
+        [](const ScopeStatistics& a, const ScopeStatistics& b) { return a.name < b.name; });
+    return statistics;
+}
+
+void GpuProfiler::PrintStatistics(std::ostream& out) const
+{
+    out << "gpu profiler, last " << kHistorySize << " frames:" << std::endl;
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+    for (const auto& scope : GetStatistics())
+    {
+        out << "  " << scope.name << ": last " << scope.lastMs << " ms, min " << scope.minMs
+            << " ms, avg " << scope.avgMs << " ms, p99 " << scope.p99Ms << " ms" << std::endl;
+    }
+    for (const auto& scope : _lastFrame)
+    {
+        if (!scope.hasPipelineStatistics)
+            continue;
+        const PipelineStatistics& stats = scope.pipelineStatistics;
+        out << "  " << scope.name << ": " << stats.inputVertices << " vertices, " << stats.inputPrimitives
+            << " primitives, " << stats.vertexInvocations << " vs, " << stats.clippingPrimitives << " clipped, "
+            << stats.fragmentInvocations << " fs, " << stats.computeInvocations << " cs invocations" << std::endl;
+    }
+    out.flags(flags);
+}
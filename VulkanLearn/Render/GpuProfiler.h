@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <ostream>
+#include <cstdint>
+
+#include "HostAllocator.h"
+
+//gpu time per scope from timestamp queries. every frame in flight owns its query pools, so the
+//results of a frame are read right after its fence wait without ever stalling on the gpu
+class GpuProfiler
+{
+public:
+    //rolling window every min/avg/p99 is computed over
+    static const uint32_t kHistorySize = 256;
+
+    struct PipelineStatistics
+    {
+        uint64_t inputVertices = 0;
+        uint64_t inputPrimitives = 0;
+        uint64_t vertexInvocations = 0;
+        uint64_t clippingPrimitives = 0;
+        uint64_t fragmentInvocations = 0;
+        uint64_t computeInvocations = 0;
+    };
+
+    //one scope of the last completed frame, times are relative to the first timestamp of that frame
+    struct ScopeResult
+    {
+        std::string name;
+        uint32_t depth = 0;
+        double beginMs = 0.0;
+        double endMs = 0.0;
+        bool hasPipelineStatistics = false;
+        PipelineStatistics pipelineStatistics;
+    };
+
+    struct ScopeStatistics
+    {
+        std::string name;
+        double lastMs = 0.0;
+        double minMs = 0.0;
+        double avgMs = 0.0;
+        double p99Ms = 0.0;
+        uint64_t samples = 0;
+    };
+
+    //closes the scope when it goes out of scope
+    class Scope
+    {
+    public:
+        Scope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const char* name, bool pipelineStatistics = false)
+            : _profiler(profiler), _commandBuffer(commandBuffer)
+        {
+            _index = _profiler.BeginScope(_commandBuffer, name, pipelineStatistics);
+        }
+        ~Scope() { _profiler.EndScope(_commandBuffer, _index); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        GpuProfiler& _profiler;
+        VkCommandBuffer _commandBuffer;
+        uint32_t _index;
+    };
+
+    //pipeline statistics need the pipelineStatisticsQuery device feature
+    void Create(VkPhysicalDevice physicalDevice, VkDevice device, const HostAllocator* hostAllocator,
+        uint32_t queueFamily, uint32_t frameCount, bool pipelineStatistics, uint32_t maxScopes = 128);
+    void Destroy();
+
+    //call at the start of the command buffer once the fence of frameIndex has been waited.
+    //collects what that frame recorded last time, then resets its queries
+    void BeginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    //scopes may nest but must not straddle a render pass begin or end. statistics queries cannot
+    //nest, so only innermost scopes like single passes should ask for them, a scope opened while
+    //another one counts gets none
+    uint32_t BeginScope(VkCommandBuffer commandBuffer, const char* name, bool pipelineStatistics = false);
+    void EndScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+    bool IsEnabled() const { return _enabled; }
+    //what secondaries executed inside a counting scope must inherit, 0 without statistics
+    VkQueryPipelineStatisticFlags GetPipelineStatisticFlags() const;
+    const std::vector<ScopeResult>& GetLastFrame() const { return _lastFrame; }
+    uint64_t GetLastFrameNumber() const { return _lastFrameNumber; }
+    std::vector<ScopeStatistics> GetStatistics() const;
+    void PrintStatistics(std::ostream& out) const;
+
+private:
+    static const uint32_t kInvalidScope = 0xffffffff;
+
+    struct FrameQueries
+    {
+        VkQueryPool timestamps = VK_NULL_HANDLE;
+        VkQueryPool statistics = VK_NULL_HANDLE;
+        std::vector<std::string> names;
+        std::vector<uint32_t> depths;
+        //scopes that asked for pipeline statistics while no other scope was counting
+        std::vector<bool> hasStatistics;
+        uint32_t scopeCount = 0;
+        uint64_t frameNumber = 0;
+        bool recorded = false;
+    };
+
+    struct History
+    {
+        double samples[kHistorySize];
+        uint32_t next = 0;
+        uint64_t count = 0;
+    };
+
+    void Collect(FrameQueries& frame);
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    bool _enabled = false;
+    bool _pipelineStatistics = false;
+    //nanoseconds per tick and the bits the queue actually writes
+    double _timestampPeriod = 1.0;
+    uint64_t _timestampMask = ~0ull;
+    uint32_t _maxScopes = 0;
+
+    std::vector<FrameQueries> _frames;
+    uint32_t _frameIndex = 0;
+    uint64_t _frameNumber = 0;
+    uint32_t _depth = 0;
+    uint32_t _statisticsScope = kInvalidScope;
+
+    std::vector<ScopeResult> _lastFrame;
+    uint64_t _lastFrameNumber = 0;
+    std::unordered_map<std::string, History> _history;
+    //scratch arrays reused by Collect
+    std::vector<uint64_t> _timestampData;
+    std::vector<uint64_t> _statisticsData;
+};
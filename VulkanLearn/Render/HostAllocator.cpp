@@ -0,0 +1,407 @@
+#include "HostAllocator.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    //core object types are numbered contiguously, the extension types we create follow them
+    const uint32_t kCoreTypeCount = VK_OBJECT_TYPE_COMMAND_POOL + 1;
+    const VkObjectType kExtensionTypes[] =
+    {
+        VK_OBJECT_TYPE_SURFACE_KHR,
+        VK_OBJECT_TYPE_SWAPCHAIN_KHR,
+        VK_OBJECT_TYPE_DEBUG_UTILS_MESSENGER_EXT,
+    };
+    const uint32_t kTypeCount = kCoreTypeCount + sizeof(kExtensionTypes) / sizeof(kExtensionTypes[0]);
+
+    //slot sizes of the pools, anything larger goes to the system heap
+    const size_t kSizeClasses[] = { 64, 128, 256, 512, 1024, 2048, 4096 };
+    const uint32_t kSizeClassCount = sizeof(kSizeClasses) / sizeof(kSizeClasses[0]);
+    const size_t kChunkSize = 64 * 1024;
+    //command scope allocations only live for the duration of a single vulkan call
+    const size_t kArenaSize = 64 * 1024;
+
+    enum AllocationSource : uint8_t
+    {
+        SourceArena,
+        SourcePool,
+        SourceSystem,
+    };
+
+    //stored right in front of every pointer handed to the driver
+    struct AllocationHeader
+    {
+        void* raw;
+        uint64_t size;
+        void* type;
+        uint8_t scope;
+        uint8_t source;
+        uint8_t sizeClass;
+        uint8_t padding[5];
+    };
+    static_assert(sizeof(AllocationHeader) % 16 == 0, "allocation header must keep 16 byte alignment");
+
+    struct CommandArena
+    {
+        char* buffer = nullptr;
+        size_t used = 0;
+        //the driver frees command scope memory before the call returns, usually on the same thread
+        std::atomic<uint32_t> live{ 0 };
+
+        ~CommandArena()
+        {
+            std::free(buffer);
+        }
+    };
+    thread_local CommandArena t_commandArena;
+
+    uint32_t GetTypeIndex(VkObjectType objectType)
+    {
+        if (static_cast<uint32_t>(objectType) < kCoreTypeCount)
+            return static_cast<uint32_t>(objectType);
+        for (uint32_t i = 0; i < sizeof(kExtensionTypes) / sizeof(kExtensionTypes[0]); i++)
+        {
+            if (kExtensionTypes[i] == objectType)
+                return kCoreTypeCount + i;
+        }
+        return VK_OBJECT_TYPE_UNKNOWN;
+    }
+
+    VkObjectType GetObjectType(uint32_t typeIndex)
+    {
+        if (typeIndex < kCoreTypeCount)
+            return static_cast<VkObjectType>(typeIndex);
+        return kExtensionTypes[typeIndex - kCoreTypeCount];
+    }
+
+    const char* GetObjectTypeName(VkObjectType objectType)
+    {
+        switch (objectType)
+        {
+        case VK_OBJECT_TYPE_INSTANCE: return "instance";
+        case VK_OBJECT_TYPE_PHYSICAL_DEVICE: return "physical device";
+        case VK_OBJECT_TYPE_DEVICE: return "device";
+        case VK_OBJECT_TYPE_QUEUE: return "queue";
+        case VK_OBJECT_TYPE_SEMAPHORE: return "semaphore";
+        case VK_OBJECT_TYPE_COMMAND_BUFFER: return "command buffer";
+        case VK_OBJECT_TYPE_FENCE: return "fence";
+        case VK_OBJECT_TYPE_DEVICE_MEMORY: return "device memory";
+        case VK_OBJECT_TYPE_BUFFER: return "buffer";
+        case VK_OBJECT_TYPE_IMAGE: return "image";
+        case VK_OBJECT_TYPE_EVENT: return "event";
+        case VK_OBJECT_TYPE_QUERY_POOL: return "query pool";
+        case VK_OBJECT_TYPE_BUFFER_VIEW: return "buffer view";
+        case VK_OBJECT_TYPE_IMAGE_VIEW: return "image view";
+        case VK_OBJECT_TYPE_SHADER_MODULE: return "shader module";
+        case VK_OBJECT_TYPE_PIPELINE_CACHE: return "pipeline cache";
+        case VK_OBJECT_TYPE_PIPELINE_LAYOUT: return "pipeline layout";
+        case VK_OBJECT_TYPE_RENDER_PASS: return "render pass";
+        case VK_OBJECT_TYPE_PIPELINE: return "pipeline";
+        case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT: return "descriptor set layout";
+        case VK_OBJECT_TYPE_SAMPLER: return "sampler";
+        case VK_OBJECT_TYPE_DESCRIPTOR_POOL: return "descriptor pool";
+        case VK_OBJECT_TYPE_DESCRIPTOR_SET: return "descriptor set";
+        case VK_OBJECT_TYPE_FRAMEBUFFER: return "framebuffer";
+        case VK_OBJECT_TYPE_COMMAND_POOL: return "command pool";
+        case VK_OBJECT_TYPE_SURFACE_KHR: return "surface";
+        case VK_OBJECT_TYPE_SWAPCHAIN_KHR: return "swap chain";
+        case VK_OBJECT_TYPE_DEBUG_UTILS_MESSENGER_EXT: return "debug messenger";
+        default: return "other";
+        }
+    }
+
+    const char* GetScopeName(uint32_t scope)
+    {
+        switch (scope)
+        {
+        case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND: return "command";
+        case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT: return "object";
+        case VK_SYSTEM_ALLOCATION_SCOPE_CACHE: return "cache";
+        case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE: return "device";
+        case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE: return "instance";
+        default: return "unknown";
+        }
+    }
+
+    char* AlignPointer(char* pointer, size_t alignment)
+    {
+        uintptr_t value = reinterpret_cast<uintptr_t>(pointer);
+        value = (value + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+        return reinterpret_cast<char*>(value);
+    }
+}
+
+HostAllocator::HostAllocator()
+{
+    _types.reset(new TypeData[kTypeCount]);
+    for (uint32_t i = 0; i < kTypeCount; i++)
+    {
+        TypeData& type = _types[i];
+        type.allocator = this;
+        type.typeIndex = i;
+        type.callbacks.pUserData = &type;
+        type.callbacks.pfnAllocation = &HostAllocator::Allocation;
+        type.callbacks.pfnReallocation = &HostAllocator::Reallocation;
+        type.callbacks.pfnFree = &HostAllocator::Free;
+        type.callbacks.pfnInternalAllocation = &HostAllocator::InternalAllocation;
+        type.callbacks.pfnInternalFree = &HostAllocator::InternalFree;
+    }
+
+    _sizeClasses.reset(new SizeClass[kSizeClassCount]);
+    for (uint32_t i = 0; i < kSizeClassCount; i++)
+    {
+        _sizeClasses[i].slotSize = kSizeClasses[i];
+    }
+}
+
+HostAllocator::~HostAllocator()
+{
+    Destroy();
+}
+
+void HostAllocator::Create(bool enabled)
+{
+    _enabled = enabled;
+}
+
+void HostAllocator::Destroy()
+{
+    for (uint32_t i = 0; i < kSizeClassCount; i++)
+    {
+        SizeClass& sizeClass = _sizeClasses[i];
+        std::lock_guard<std::mutex> lock(sizeClass.mutex);
+        for (void* chunk : sizeClass.chunks)
+        {
+            std::free(chunk);
+        }
+        sizeClass.chunks.clear();
+        sizeClass.freeList = nullptr;
+    }
+    _enabled = false;
+}
+
+const VkAllocationCallbacks* HostAllocator::Get(VkObjectType objectType) const
+{
+    if (!_enabled)
+        return nullptr;
+    return &_types[GetTypeIndex(objectType)].callbacks;
+}
+
+void* VKAPI_PTR HostAllocator::Allocation(void* userData, size_t size, size_t alignment,
+    VkSystemAllocationScope scope)
+{
+    TypeData* type = static_cast<TypeData*>(userData);
+    return type->allocator->Allocate(*type, size, alignment, scope);
+}
+
+void* VKAPI_PTR HostAllocator::Reallocation(void* userData, void* original, size_t size, size_t alignment,
+    VkSystemAllocationScope scope)
+{
+    TypeData* type = static_cast<TypeData*>(userData);
+    if (original == nullptr)
+        return type->allocator->Allocate(*type, size, alignment, scope);
+    if (size == 0)
+    {
+        type->allocator->Release(original);
+        return nullptr;
+    }
+
+    void* memory = type->allocator->Allocate(*type, size, alignment, scope);
+    if (memory == nullptr)
+        return nullptr;
+    const AllocationHeader* header = static_cast<const AllocationHeader*>(original) - 1;
+    std::memcpy(memory, original, (std::min)(static_cast<size_t>(header->size), size));
+    type->allocator->Release(original);
+    return memory;
+}
+
+void VKAPI_PTR HostAllocator::Free(void* userData, void* memory)
+{
+    if (memory == nullptr)
+        return;
+    TypeData* type = static_cast<TypeData*>(userData);
+    type->allocator->Release(memory);
+}
+
+void VKAPI_PTR HostAllocator::InternalAllocation(void* userData, size_t size,
+    VkInternalAllocationType allocationType, VkSystemAllocationScope scope)
+{
+    TypeData* type = static_cast<TypeData*>(userData);
+    type->scopes[scope].internalBytes += static_cast<int64_t>(size);
+}
+
+void VKAPI_PTR HostAllocator::InternalFree(void* userData, size_t size,
+    VkInternalAllocationType allocationType, VkSystemAllocationScope scope)
+{
+    TypeData* type = static_cast<TypeData*>(userData);
+    type->scopes[scope].internalBytes -= static_cast<int64_t>(size);
+}
+
+void* HostAllocator::Allocate(TypeData& type, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if (size == 0)
+        return nullptr;
+    alignment = (std::max)(alignment, static_cast<size_t>(16));
+    //worst case padding, the header must fit in front of the aligned pointer
+    size_t needed = sizeof(AllocationHeader) + alignment - 1 + size;
+
+    char* raw = nullptr;
+    uint8_t source = SourceSystem;
+    uint8_t sizeClassIndex = 0;
+
+    if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND && needed <= kArenaSize)
+    {
+        CommandArena& arena = t_commandArena;
+        if (arena.buffer == nullptr)
+            arena.buffer = static_cast<char*>(std::malloc(kArenaSize));
+        //everything handed out before has been freed, rewind
+        if (arena.live.load(std::memory_order_acquire) == 0)
+            arena.used = 0;
+        if (arena.buffer != nullptr && arena.used + needed <= kArenaSize)
+        {
+            raw = arena.buffer + arena.used;
+            arena.used += needed;
+            arena.live.fetch_add(1, std::memory_order_relaxed);
+            source = SourceArena;
+            _arenaAllocations++;
+        }
+    }
+
+    if (raw == nullptr)
+    {
+        for (uint32_t i = 0; i < kSizeClassCount; i++)
+        {
+            if (needed <= kSizeClasses[i])
+            {
+                raw = static_cast<char*>(AllocateFromClass(i));
+                source = SourcePool;
+                sizeClassIndex = static_cast<uint8_t>(i);
+                _poolAllocations++;
+                break;
+            }
+        }
+    }
+
+    if (raw == nullptr)
+    {
+        raw = static_cast<char*>(std::malloc(needed));
+        if (raw == nullptr)
+            return nullptr;
+        source = SourceSystem;
+        _systemAllocations++;
+    }
+
+    char* memory = AlignPointer(raw + sizeof(AllocationHeader), alignment);
+    AllocationHeader* header = reinterpret_cast<AllocationHeader*>(memory) - 1;
+    header->raw = source == SourceArena ? static_cast<void*>(&t_commandArena) : raw;
+    header->size = size;
+    header->type = &type;
+    header->scope = static_cast<uint8_t>(scope);
+    header->source = source;
+    header->sizeClass = sizeClassIndex;
+
+    Counters& counters = type.scopes[scope];
+    counters.liveBytes += static_cast<int64_t>(size);
+    counters.liveCount++;
+    counters.totalCount++;
+    return memory;
+}
+
+void HostAllocator::Release(void* memory)
+{
+    AllocationHeader* header = static_cast<AllocationHeader*>(memory) - 1;
+    //the scope of the allocation, not of the free call, owns the bytes
+    Counters& counters = static_cast<TypeData*>(header->type)->scopes[header->scope];
+    counters.liveBytes -= static_cast<int64_t>(header->size);
+    counters.liveCount--;
+
+    switch (header->source)
+    {
+    case SourceArena:
+        static_cast<CommandArena*>(header->raw)->live.fetch_sub(1, std::memory_order_release);
+        break;
+    case SourcePool:
+        FreeToClass(header->sizeClass, header->raw);
+        break;
+    default:
+        std::free(header->raw);
+        break;
+    }
+}
+
+void* HostAllocator::AllocateFromClass(uint32_t sizeClassIndex)
+{
+    SizeClass& sizeClass = _sizeClasses[sizeClassIndex];
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+    if (sizeClass.freeList == nullptr)
+    {
+        char* chunk = static_cast<char*>(std::malloc(kChunkSize));
+        if (chunk == nullptr)
+            return nullptr;
+        sizeClass.chunks.push_back(chunk);
+        //thread the new slots onto the free list, the first word of a free slot is the next pointer
+        size_t slotCount = kChunkSize / sizeClass.slotSize;
+        for (size_t i = slotCount; i > 0; i--)
+        {
+            void* slot = chunk + (i - 1) * sizeClass.slotSize;
+            *static_cast<void**>(slot) = sizeClass.freeList;
+            sizeClass.freeList = slot;
+        }
+    }
+    void* slot = sizeClass.freeList;
+    sizeClass.freeList = *static_cast<void**>(slot);
+    return slot;
+}
+
+void HostAllocator::FreeToClass(uint32_t sizeClassIndex, void* slot)
+{
+    SizeClass& sizeClass = _sizeClasses[sizeClassIndex];
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+    *static_cast<void**>(slot) = sizeClass.freeList;
+    sizeClass.freeList = slot;
+}
+
+std::vector<HostAllocator::Statistics> HostAllocator::GetStatistics() const
+{
+    std::vector<Statistics> statistics;
+    for (uint32_t i = 0; i < kTypeCount; i++)
+    {
+        for (uint32_t scope = 0; scope < kScopeCount; scope++)
+        {
+            const Counters& counters = _types[i].scopes[scope];
+            if (counters.totalCount == 0 && counters.internalBytes == 0)
+                continue;
+            Statistics stats;
+            stats.objectType = GetObjectType(i);
+            stats.scope = static_cast<VkSystemAllocationScope>(scope);
+            stats.liveBytes = counters.liveBytes;
+            stats.liveCount = counters.liveCount;
+            stats.totalCount = counters.totalCount;
+            stats.internalBytes = counters.internalBytes;
+            statistics.push_back(stats);
+        }
+    }
+    return statistics;
+}
+
+void HostAllocator::PrintStatistics(std::ostream& out) const
+{
+    if (!_enabled)
+        return;
+
+    out << "host allocations: " << _arenaAllocations << " arena, " << _poolAllocations << " pool, "
+        << _systemAllocations << " system" << std::endl;
+    for (const auto& stats : GetStatistics())
+    {
+        out << "  " << std::left << std::setw(22) << GetObjectTypeName(stats.objectType)
+            << std::setw(9) << GetScopeName(stats.scope) << std::right
+            << " live " << std::setw(9) << stats.liveBytes << " bytes in " << std::setw(5) << stats.liveCount
+            << ", total " << std::setw(7) << stats.totalCount;
+        if (stats.internalBytes != 0)
+            out << ", internal " << stats.internalBytes << " bytes";
+        out << std::endl;
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <cstdint>
+
+//VkAllocationCallbacks for every driver host allocation. small blocks come from size class pools,
+//command scope allocations from a per thread bump arena, and live bytes and counts are tracked
+//per object type and allocation scope. every object type gets its own callbacks so the driver
+//allocations can be attributed without any lookup
+class HostAllocator
+{
+public:
+    static const uint32_t kScopeCount = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+    struct Statistics
+    {
+        VkObjectType objectType = VK_OBJECT_TYPE_UNKNOWN;
+        VkSystemAllocationScope scope = VK_SYSTEM_ALLOCATION_SCOPE_COMMAND;
+        int64_t liveBytes = 0;
+        int64_t liveCount = 0;
+        uint64_t totalCount = 0;
+        //reported by the driver through the internal allocation notification
+        int64_t internalBytes = 0;
+    };
+
+    HostAllocator();
+    ~HostAllocator();
+
+    //a disabled allocator hands out null callbacks and the driver falls back to its own heap
+    void Create(bool enabled);
+    //every object created with these callbacks must be destroyed before
+    void Destroy();
+
+    const VkAllocationCallbacks* Get(VkObjectType objectType) const;
+
+    //snapshot of every non empty type and scope pair, safe to call while the driver allocates
+    std::vector<Statistics> GetStatistics() const;
+    void PrintStatistics(std::ostream& out) const;
+
+private:
+    struct Counters
+    {
+        std::atomic<int64_t> liveBytes{ 0 };
+        std::atomic<int64_t> liveCount{ 0 };
+        std::atomic<uint64_t> totalCount{ 0 };
+        std::atomic<int64_t> internalBytes{ 0 };
+    };
+
+    struct TypeData
+    {
+        HostAllocator* allocator = nullptr;
+        uint32_t typeIndex = 0;
+        VkAllocationCallbacks callbacks{};
+        Counters scopes[kScopeCount];
+    };
+
+    struct SizeClass
+    {
+        std::mutex mutex;
+        void* freeList = nullptr;
+        size_t slotSize = 0;
+        std::vector<void*> chunks;
+    };
+
+    static void* VKAPI_PTR Allocation(void* userData, size_t size, size_t alignment,
+        VkSystemAllocationScope scope);
+    static void* VKAPI_PTR Reallocation(void* userData, void* original, size_t size, size_t alignment,
+        VkSystemAllocationScope scope);
+    static void VKAPI_PTR Free(void* userData, void* memory);
+    static void VKAPI_PTR InternalAllocation(void* userData, size_t size,
+        VkInternalAllocationType allocationType, VkSystemAllocationScope scope);
+    static void VKAPI_PTR InternalFree(void* userData, size_t size,
+        VkInternalAllocationType allocationType, VkSystemAllocationScope scope);
+
+    void* Allocate(TypeData& type, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void Release(void* memory);
+    void* AllocateFromClass(uint32_t sizeClass);
+    void FreeToClass(uint32_t sizeClass, void* slot);
+
+private:
+    bool _enabled = false;
+    //atomics and mutexes can't live in a vector
+    std::unique_ptr<TypeData[]> _types;
+    std::unique_ptr<SizeClass[]> _sizeClasses;
+    std::atomic<uint64_t> _arenaAllocations{ 0 };
+    std::atomic<uint64_t> _poolAllocations{ 0 };
+    std::atomic<uint64_t> _systemAllocations{ 0 };
+};
@@ -0,0 +1,519 @@
+#include "MemoryAllocator.h"
+#include "VulkanCheck.h"
+
+#include <set>
+#include <algorithm>
+#include <iomanip>
+
+namespace
+{
+    //smallest buddy, order 0
+    const VkDeviceSize kMinAllocationSize = 256;
+    const VkDeviceSize kDefaultBlockSize = 64ull << 20;
+    const VkDeviceSize kMinBlockSize = 1ull << 20;
+
+    VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+        return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+    }
+
+    uint32_t GetOrder(VkDeviceSize size)
+    {
+        uint32_t order = 0;
+        while ((kMinAllocationSize << order) < size)
+            order++;
+        return order;
+    }
+}
+
+//one vkAllocateMemory, split with a binary buddy allocator. buddies are naturally aligned
+//to their own size, so any power of two alignment up to the block size comes for free
+struct MemoryBlock
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;
+    uint32_t memoryType = 0;
+    uint32_t pool = 0;
+    uint32_t maxOrder = 0;
+    uint32_t allocationCount = 0;
+    //free offsets per order
+    std::vector<std::set<VkDeviceSize>> freeLists;
+
+    void Init(VkDeviceSize blockSize)
+    {
+        size = blockSize;
+        maxOrder = GetOrder(blockSize);
+        freeLists.assign(maxOrder + 1, std::set<VkDeviceSize>());
+        freeLists[maxOrder].insert(0);
+    }
+
+    bool Allocate(uint32_t order, VkDeviceSize& offset)
+    {
+        if (order > maxOrder)
+            return false;
+
+        uint32_t current = order;
+        while (current <= maxOrder && freeLists[current].empty())
+            current++;
+        if (current > maxOrder)
+            return false;
+
+        offset = *freeLists[current].begin();
+        freeLists[current].erase(freeLists[current].begin());
+        //split down, the upper halves become free buddies
+        while (current > order)
+        {
+            current--;
+            freeLists[current].insert(offset + (kMinAllocationSize << current));
+        }
+        allocationCount++;
+        return true;
+    }
+
+    void Free(VkDeviceSize offset, uint32_t order)
+    {
+        while (order < maxOrder)
+        {
+            VkDeviceSize buddy = offset ^ (kMinAllocationSize << order);
+            auto it = freeLists[order].find(buddy);
+            if (it == freeLists[order].end())
+                break;
+            freeLists[order].erase(it);
+            offset = (std::min)(offset, buddy);
+            order++;
+        }
+        freeLists[order].insert(offset);
+        allocationCount--;
+    }
+};
+
+void RingAllocator::Create(VkDeviceSize size, uint32_t frameCount)
+{
+    _size = size;
+    _head = 0;
+    _tail = 0;
+    _used = 0;
+    _pending = 0;
+    _frameEnds.assign(frameCount, 0);
+    _frameSizes.assign(frameCount, 0);
+}
+
+bool RingAllocator::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+    if (size > _size)
+        return false;
+    if (_used == 0)
+    {
+        _head = 0;
+        _tail = 0;
+    }
+
+    //free space is [head, size) + [0, tail) unless the head already wrapped behind the tail
+    bool wrapped = _head < _tail || (_head == _tail && _used > 0);
+    VkDeviceSize aligned = AlignUp(_head, alignment);
+    VkDeviceSize consumed = 0;
+    if (!wrapped && aligned + size <= _size)
+    {
+        consumed = aligned - _head + size;
+    }
+    else if (!wrapped && size <= _tail)
+    {
+        //the unused end of the ring is charged to this frame and reclaimed with it
+        aligned = 0;
+        consumed = _size - _head + size;
+    }
+    else if (wrapped && aligned + size <= _tail)
+    {
+        consumed = aligned - _head + size;
+    }
+    else
+    {
+        return false;
+    }
+
+    offset = aligned;
+    _head = aligned + size;
+    _used += consumed;
+    _pending += consumed;
+    return true;
+}
+
+void RingAllocator::EndFrame(uint32_t frameIndex)
+{
+    _frameEnds[frameIndex] = _head;
+    _frameSizes[frameIndex] += _pending;
+    _pending = 0;
+}
+
+void RingAllocator::ReleaseFrame(uint32_t frameIndex)
+{
+    //frames complete in the order they ended, so the end of the released frame is the new tail.
+    //an empty frame would move the tail to a stale position, it has nothing to free anyway
+    if (_frameSizes[frameIndex] > 0)
+    {
+        _tail = _frameEnds[frameIndex];
+        _used -= _frameSizes[frameIndex];
+        _frameSizes[frameIndex] = 0;
+    }
+}
+
+MemoryAllocator::MemoryAllocator() = default;
+
+MemoryAllocator::~MemoryAllocator() = default;
+
+void MemoryAllocator::Create(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t apiVersion,
+    const HostAllocator* hostAllocator)
+{
+    _physicalDevice = physicalDevice;
+    _device = device;
+    _hostAllocator = hostAllocator;
+    vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &_memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+    _bufferImageGranularity = properties.limits.bufferImageGranularity;
+    //vkGetImageMemoryRequirements2 is core since 1.1
+    _dedicatedAllocationSupported = apiVersion >= VK_API_VERSION_1_1 &&
+        properties.apiVersion >= VK_API_VERSION_1_1;
+
+    _pools.clear();
+    _pools.resize(_memoryProperties.memoryTypeCount * 2);
+    _heapStatistics.assign(_memoryProperties.memoryHeapCount, HeapStatistics());
+}
+
+void MemoryAllocator::Destroy()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto& pool : _pools)
+    {
+        for (auto& block : pool.blocks)
+        {
+            //mapped memory is implicitly unmapped when freed
+            vkFreeMemory(_device, block->memory, _hostAllocator->Get(VK_OBJECT_TYPE_DEVICE_MEMORY));
+        }
+        pool.blocks.clear();
+    }
+}
+
+MemoryAllocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    bool linear,
+    bool dedicated)
+{
+    return AllocateInternal(requirements, required, preferred, linear, dedicated, VK_NULL_HANDLE);
+}
+
+MemoryAllocation MemoryAllocator::AllocateInternal(const VkMemoryRequirements& requirements,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    bool linear,
+    bool dedicated,
+    VkImage dedicatedImage)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    MemoryAllocation allocation;
+
+    //try every type with the preferred flags first, then any type that only has the required ones.
+    //a full heap makes vkAllocateMemory fail, the next type may live on another heap
+    VkMemoryPropertyFlags passes[2] = { required | preferred, required };
+    uint32_t passCount = preferred != 0 ? 2 : 1;
+    for (uint32_t pass = 0; pass < passCount; pass++)
+    {
+        uint32_t typeBits = requirements.memoryTypeBits;
+        uint32_t memoryType = 0;
+        while (FindMemoryType(typeBits, passes[pass], memoryType))
+        {
+            if (AllocateFromType(requirements, memoryType, linear, dedicated, dedicatedImage, allocation))
+                return allocation;
+            typeBits &= ~(1u << memoryType);
+        }
+    }
+    throw std::runtime_error("failed to allocate device memory!!!");
+}
+
+void MemoryAllocator::Free(MemoryAllocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    HeapStatistics& stats = _heapStatistics[_memoryProperties.memoryTypes[allocation.memoryType].heapIndex];
+    if (allocation.block == nullptr)
+    {
+        vkFreeMemory(_device, allocation.memory, _hostAllocator->Get(VK_OBJECT_TYPE_DEVICE_MEMORY));
+        stats.dedicatedBytes -= allocation.size;
+        stats.dedicatedCount--;
+        allocation = MemoryAllocation();
+        return;
+    }
+
+    MemoryBlock* block = allocation.block;
+    block->Free(allocation.offset, allocation.order);
+    stats.usedBytes -= kMinAllocationSize << allocation.order;
+    stats.allocationCount--;
+
+    //keep a single empty block per pool around so alloc/free cycles do not hit the driver
+    if (block->allocationCount == 0)
+    {
+        Pool& pool = _pools[block->pool];
+        size_t emptyBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(),
+            [](const std::unique_ptr<MemoryBlock>& b) { return b->allocationCount == 0; });
+        if (emptyBlocks > 1)
+        {
+            auto it = std::find_if(pool.blocks.begin(), pool.blocks.end(),
+                [block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; });
+            vkFreeMemory(_device, block->memory, _hostAllocator->Get(VK_OBJECT_TYPE_DEVICE_MEMORY));
+            stats.blockBytes -= block->size;
+            stats.blockCount--;
+            pool.blocks.erase(it);
+        }
+    }
+    allocation = MemoryAllocation();
+}
+
+void MemoryAllocator::CreateBuffer(const VkBufferCreateInfo& info,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    VkBuffer& buffer,
+    MemoryAllocation& allocation)
+{
+    VkResult res = vkCreateBuffer(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_BUFFER), &buffer);
+    CHECK_SUCCESS(res, "failed to create buffer!!!")
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(_device, buffer, &requirements);
+    allocation = Allocate(requirements, required, preferred, true);
+    res = vkBindBufferMemory(_device, buffer, allocation.memory, allocation.offset);
+    CHECK_SUCCESS(res, "failed to bind buffer memory!!!")
+}
+
+void MemoryAllocator::DestroyBuffer(VkBuffer& buffer, MemoryAllocation& allocation)
+{
+    if (buffer != VK_NULL_HANDLE)
+        vkDestroyBuffer(_device, buffer, _hostAllocator->Get(VK_OBJECT_TYPE_BUFFER));
+    buffer = VK_NULL_HANDLE;
+    Free(allocation);
+}
+
+void MemoryAllocator::CreateImage(const VkImageCreateInfo& info,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    VkImage& image,
+    MemoryAllocation& allocation)
+{
+    VkResult res = vkCreateImage(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_IMAGE), &image);
+    CHECK_SUCCESS(res, "failed to create image!!!")
+
+    VkMemoryRequirements requirements;
+    bool dedicated = false;
+    if (_dedicatedAllocationSupported)
+    {
+        //the driver knows best which images benefit from their own allocation
+        VkMemoryDedicatedRequirements dedicatedRequirements{};
+        dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+        VkMemoryRequirements2 requirements2{};
+        requirements2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+        requirements2.pNext = &dedicatedRequirements;
+        VkImageMemoryRequirementsInfo2 requirementsInfo{};
+        requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+        requirementsInfo.image = image;
+
+        auto getRequirements2 = (PFN_vkGetImageMemoryRequirements2)vkGetDeviceProcAddr(
+            _device, "vkGetImageMemoryRequirements2");
+        getRequirements2(_device, &requirementsInfo, &requirements2);
+        requirements = requirements2.memoryRequirements;
+        dedicated = dedicatedRequirements.prefersDedicatedAllocation ||
+            dedicatedRequirements.requiresDedicatedAllocation;
+    }
+    else
+    {
+        vkGetImageMemoryRequirements(_device, image, &requirements);
+    }
+
+    bool linear = info.tiling == VK_IMAGE_TILING_LINEAR;
+    allocation = AllocateInternal(requirements, required, preferred, linear, dedicated,
+        dedicated ? image : VK_NULL_HANDLE);
+    res = vkBindImageMemory(_device, image, allocation.memory, allocation.offset);
+    CHECK_SUCCESS(res, "failed to bind image memory!!!")
+}
+
+void MemoryAllocator::DestroyImage(VkImage& image, MemoryAllocation& allocation)
+{
+    if (image != VK_NULL_HANDLE)
+        vkDestroyImage(_device, image, _hostAllocator->Get(VK_OBJECT_TYPE_IMAGE));
+    image = VK_NULL_HANDLE;
+    Free(allocation);
+}
+
+std::vector<MemoryAllocator::HeapStatistics> MemoryAllocator::GetHeapStatistics()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<HeapStatistics> stats = _heapStatistics;
+    for (uint32_t i = 0; i < stats.size(); i++)
+    {
+        stats[i].heapSize = _memoryProperties.memoryHeaps[i].size;
+    }
+    return stats;
+}
+
+void MemoryAllocator::PrintStatistics(std::ostream& out)
+{
+    std::vector<HeapStatistics> stats = GetHeapStatistics();
+    for (uint32_t i = 0; i < stats.size(); i++)
+    {
+        const HeapStatistics& heap = stats[i];
+        out << "heap " << i << " (" << (heap.heapSize >> 20) << " MiB"
+            << ((_memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? ", device local" : "")
+            << "): " << heap.blockCount << " blocks " << (heap.blockBytes >> 10) << " KiB, "
+            << heap.allocationCount << " allocations " << (heap.usedBytes >> 10) << " KiB used, "
+            << heap.dedicatedCount << " dedicated " << (heap.dedicatedBytes >> 10) << " KiB" << std::endl;
+    }
+}
+
+bool MemoryAllocator::FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags flags, uint32_t& memoryType)
+{
+    for (uint32_t i = 0; i < _memoryProperties.memoryTypeCount; i++)
+    {
+        if ((typeBits & (1u << i)) &&
+            (_memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+        {
+            memoryType = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MemoryAllocator::AllocateFromType(const VkMemoryRequirements& requirements, uint32_t memoryType,
+    bool linear, bool dedicated, VkImage dedicatedImage, MemoryAllocation& allocation)
+{
+    VkDeviceSize blockSize = GetBlockSize(memoryType);
+    uint32_t order = GetOrder((std::max)(requirements.size, requirements.alignment));
+    //big resources would waste most of a block to buddy rounding, large images
+    //additionally get their own allocation so the driver can place them optimally
+    bool large = (kMinAllocationSize << order) > blockSize / 2 ||
+        (!linear && requirements.size >= blockSize / 4);
+    if (dedicated || large)
+        return AllocateDedicated(requirements.size, memoryType, dedicatedImage, allocation);
+
+    uint32_t poolIndex = GetPoolIndex(memoryType, linear);
+    Pool& pool = _pools[poolIndex];
+    HeapStatistics& stats = _heapStatistics[_memoryProperties.memoryTypes[memoryType].heapIndex];
+
+    MemoryBlock* target = nullptr;
+    VkDeviceSize offset = 0;
+    for (auto& block : pool.blocks)
+    {
+        if (block->Allocate(order, offset))
+        {
+            target = block.get();
+            break;
+        }
+    }
+
+    if (target == nullptr)
+    {
+        VkMemoryAllocateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        info.allocationSize = blockSize;
+        info.memoryTypeIndex = memoryType;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        if (vkAllocateMemory(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_DEVICE_MEMORY), &memory) != VK_SUCCESS)
+            return false;
+
+        auto block = std::make_unique<MemoryBlock>();
+        block->memory = memory;
+        block->memoryType = memoryType;
+        block->pool = poolIndex;
+        block->Init(blockSize);
+        //host visible blocks stay mapped for their whole lifetime
+        if (_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        {
+            if (vkMapMemory(_device, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped) != VK_SUCCESS)
+            {
+                vkFreeMemory(_device, memory, _hostAllocator->Get(VK_OBJECT_TYPE_DEVICE_MEMORY));
+                return false;
+            }
+        }
+        block->Allocate(order, offset);
+        target = block.get();
+        pool.blocks.push_back(std::move(block));
+        stats.blockBytes += blockSize;
+        stats.blockCount++;
+    }
+
+    allocation.memory = target->memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.mapped = target->mapped ? static_cast<char*>(target->mapped) + offset : nullptr;
+    allocation.memoryType = memoryType;
+    allocation.block = target;
+    allocation.order = order;
+    stats.usedBytes += kMinAllocationSize << order;
+    stats.allocationCount++;
+    return true;
+}
+
+bool MemoryAllocator::AllocateDedicated(VkDeviceSize size, uint32_t memoryType, VkImage dedicatedImage,
+    MemoryAllocation& allocation)
+{
+    VkMemoryAllocateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    info.allocationSize = size;
+    info.memoryTypeIndex = memoryType;
+
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+    if (dedicatedImage != VK_NULL_HANDLE && _dedicatedAllocationSupported)
+    {
+        dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+        dedicatedInfo.image = dedicatedImage;
+        info.pNext = &dedicatedInfo;
+    }
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (vkAllocateMemory(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_DEVICE_MEMORY), &memory) != VK_SUCCESS)
+        return false;
+
+    void* mapped = nullptr;
+    if (_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        if (vkMapMemory(_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+        {
+            vkFreeMemory(_device, memory, _hostAllocator->Get(VK_OBJECT_TYPE_DEVICE_MEMORY));
+            return false;
+        }
+    }
+
+    allocation.memory = memory;
+    allocation.offset = 0;
+    allocation.size = size;
+    allocation.mapped = mapped;
+    allocation.memoryType = memoryType;
+    allocation.block = nullptr;
+    allocation.order = 0;
+
+    HeapStatistics& stats = _heapStatistics[_memoryProperties.memoryTypes[memoryType].heapIndex];
+    stats.dedicatedBytes += size;
+    stats.dedicatedCount++;
+    return true;
+}
+
+VkDeviceSize MemoryAllocator::GetBlockSize(uint32_t memoryType)
+{
+    //small heaps, e.g. the 256 MiB host visible device local heap, get proportionally smaller blocks
+    VkDeviceSize heapSize = _memoryProperties.memoryHeaps[_memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize blockSize = kDefaultBlockSize;
+    while (blockSize > heapSize / 8 && blockSize > kMinBlockSize)
+        blockSize >>= 1;
+    return blockSize;
+}
+
+uint32_t MemoryAllocator::GetPoolIndex(uint32_t memoryType, bool linear)
+{
+    //buddies smaller than the granularity could put a buffer and an optimal image on the same page
+    if (_bufferImageGranularity <= kMinAllocationSize)
+        return memoryType * 2;
+    return memoryType * 2 + (linear ? 0 : 1);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <cstdint>
+
+#include "HostAllocator.h"
+
+struct MemoryBlock;
+
+//a range of device memory handed out by MemoryAllocator
+struct MemoryAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    //persistently mapped pointer for host visible memory, null otherwise
+    void* mapped = nullptr;
+    uint32_t memoryType = 0;
+
+    //owning block, null for dedicated allocations
+    MemoryBlock* block = nullptr;
+    uint32_t order = 0;
+};
+
+//offset only ring, space is handed out in submission order and reclaimed a whole frame at a time
+class RingAllocator
+{
+public:
+    void Create(VkDeviceSize size, uint32_t frameCount);
+    //returns false when the ring has no room left until older frames complete
+    bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    //everything allocated since the previous call is owned by frameIndex from now on
+    void EndFrame(uint32_t frameIndex);
+    //call once the fence of frameIndex has been waited, frees what EndFrame assigned to it
+    void ReleaseFrame(uint32_t frameIndex);
+
+    VkDeviceSize GetSize() const { return _size; }
+    VkDeviceSize GetUsed() const { return _used; }
+
+private:
+    VkDeviceSize _size = 0;
+    VkDeviceSize _head = 0;
+    VkDeviceSize _tail = 0;
+    VkDeviceSize _used = 0;
+    //bytes allocated since the last EndFrame
+    VkDeviceSize _pending = 0;
+    std::vector<VkDeviceSize> _frameEnds;
+    std::vector<VkDeviceSize> _frameSizes;
+};
+
+//sub-allocates large vkAllocateMemory blocks per memory type with a buddy allocator,
+//every buffer and image of the renderer should get its memory from here
+class MemoryAllocator
+{
+public:
+    struct HeapStatistics
+    {
+        VkDeviceSize heapSize = 0;
+        //memory allocated from the driver for blocks
+        VkDeviceSize blockBytes = 0;
+        //bytes handed out from blocks, including buddy rounding
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize dedicatedBytes = 0;
+        uint32_t blockCount = 0;
+        uint32_t allocationCount = 0;
+        uint32_t dedicatedCount = 0;
+    };
+
+    MemoryAllocator();
+    //defined out of line, MemoryBlock is only complete in the source file
+    ~MemoryAllocator();
+
+    void Create(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t apiVersion,
+        const HostAllocator* hostAllocator);
+    void Destroy();
+
+    //preferred flags are tried first, required flags must always be present,
+    //linear is false for optimal tiling images so they never share a granularity page with buffers
+    MemoryAllocation Allocate(const VkMemoryRequirements& requirements,
+        VkMemoryPropertyFlags required,
+        VkMemoryPropertyFlags preferred,
+        bool linear,
+        bool dedicated = false);
+    void Free(MemoryAllocation& allocation);
+
+    void CreateBuffer(const VkBufferCreateInfo& info,
+        VkMemoryPropertyFlags required,
+        VkMemoryPropertyFlags preferred,
+        VkBuffer& buffer,
+        MemoryAllocation& allocation);
+    void DestroyBuffer(VkBuffer& buffer, MemoryAllocation& allocation);
+
+    void CreateImage(const VkImageCreateInfo& info,
+        VkMemoryPropertyFlags required,
+        VkMemoryPropertyFlags preferred,
+        VkImage& image,
+        MemoryAllocation& allocation);
+    void DestroyImage(VkImage& image, MemoryAllocation& allocation);
+
+    std::vector<HeapStatistics> GetHeapStatistics();
+    void PrintStatistics(std::ostream& out);
+
+    const VkPhysicalDeviceMemoryProperties& GetMemoryProperties() const { return _memoryProperties; }
+
+private:
+    struct Pool
+    {
+        std::vector<std::unique_ptr<MemoryBlock>> blocks;
+    };
+
+    bool FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags flags, uint32_t& memoryType);
+    bool AllocateFromType(const VkMemoryRequirements& requirements, uint32_t memoryType,
+        bool linear, bool dedicated, VkImage dedicatedImage, MemoryAllocation& allocation);
+    bool AllocateDedicated(VkDeviceSize size, uint32_t memoryType, VkImage dedicatedImage,
+        MemoryAllocation& allocation);
+    MemoryAllocation AllocateInternal(const VkMemoryRequirements& requirements,
+        VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+        bool linear, bool dedicated, VkImage dedicatedImage);
+    VkDeviceSize GetBlockSize(uint32_t memoryType);
+    uint32_t GetPoolIndex(uint32_t memoryType, bool linear);
+
+private:
+    VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    VkPhysicalDeviceMemoryProperties _memoryProperties{};
+    VkDeviceSize _bufferImageGranularity = 1;
+    bool _dedicatedAllocationSupported = false;
+
+    //two pools per memory type when buffer image granularity forces linear and optimal resources apart
+    std::vector<Pool> _pools;
+    std::vector<HeapStatistics> _heapStatistics;
+    std::mutex _mutex;
+};
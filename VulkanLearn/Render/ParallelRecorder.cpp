@@ -0,0 +1,134 @@
+#include "ParallelRecorder.h"
+#include "VulkanCheck.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+
+void ParallelRecorder::Create(VkDevice device, const HostAllocator* hostAllocator, ThreadPool* threadPool,
+    uint32_t queueFamily, uint32_t frameCount)
+{
+    _device = device;
+    _hostAllocator = hostAllocator;
+    _threadPool = threadPool;
+    _frameIndex = 0;
+    _statistics = Statistics();
+
+    uint32_t threadCount = _threadPool->GetThreadCount();
+    _frames.resize(frameCount);
+    for (auto& frame : _frames)
+    {
+        frame.resize(threadCount);
+        for (auto& pools : frame)
+        {
+            //transient since every buffer is rerecorded each frame, reset through the pool only
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamily;
+            VkResult res = vkCreateCommandPool(_device, &poolInfo,
+                _hostAllocator->Get(VK_OBJECT_TYPE_COMMAND_POOL), &pools.pool);
+            CHECK_SUCCESS(res, "failed to create recording thread command pool!!!")
+        }
+    }
+}
+
+void ParallelRecorder::Destroy()
+{
+    if (_device == VK_NULL_HANDLE)
+        return;
+    for (auto& frame : _frames)
+    {
+        for (auto& pools : frame)
+        {
+            //secondaries are freed together with their pool
+            vkDestroyCommandPool(_device, pools.pool, _hostAllocator->Get(VK_OBJECT_TYPE_COMMAND_POOL));
+        }
+    }
+    _frames.clear();
+    _device = VK_NULL_HANDLE;
+}
+
+void ParallelRecorder::BeginFrame(uint32_t frameIndex)
+{
+    for (auto& pools : _frames[frameIndex])
+    {
+        if (pools.usedBuffers == 0)
+            continue;
+        vkResetCommandPool(_device, pools.pool, 0);
+        pools.usedBuffers = 0;
+    }
+    _frameIndex = frameIndex;
+}
+
+void ParallelRecorder::Record(VkCommandBuffer primary, const VkCommandBufferInheritanceInfo& inheritance,
+    uint32_t drawCount, const RecordFunc& record)
+{
+    std::vector<ThreadPools>& frame = _frames[_frameIndex];
+    for (auto& pools : frame)
+    {
+        pools.recorded.clear();
+    }
+
+    _threadPool->ParallelFor(drawCount, _minDrawsPerBuffer,
+        [&](uint32_t begin, uint32_t end, uint32_t threadIndex)
+        {
+            PROFILE_SCOPE("record secondary");
+            ThreadPools& pools = frame[threadIndex];
+            VkCommandBuffer commandBuffer = GrabBuffer(pools);
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo = &inheritance;
+            VkResult res = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            CHECK_SUCCESS(res, "failed to begin secondary command buffer!!!")
+
+            record(commandBuffer, begin, end);
+
+            res = vkEndCommandBuffer(commandBuffer);
+            CHECK_SUCCESS(res, "failed to record secondary command buffer!!!")
+            pools.recorded.emplace_back(begin, commandBuffer);
+        });
+
+    //threads took chunks in any order, execution has to follow the draw order
+    _ordered.clear();
+    uint32_t activeThreads = 0;
+    for (auto& pools : frame)
+    {
+        _ordered.insert(_ordered.end(), pools.recorded.begin(), pools.recorded.end());
+        activeThreads += pools.recorded.empty() ? 0 : 1;
+    }
+    std::sort(_ordered.begin(), _ordered.end(),
+        [](const std::pair<uint32_t, VkCommandBuffer>& a, const std::pair<uint32_t, VkCommandBuffer>& b)
+        {
+            return a.first < b.first;
+        });
+    _executeList.clear();
+    for (auto& entry : _ordered)
+    {
+        _executeList.push_back(entry.second);
+    }
+    if (!_executeList.empty())
+        vkCmdExecuteCommands(primary, static_cast<uint32_t>(_executeList.size()), _executeList.data());
+
+    _statistics.secondariesThisFrame = static_cast<uint32_t>(_executeList.size());
+    _statistics.threadsThisFrame = activeThreads;
+}
+
+VkCommandBuffer ParallelRecorder::GrabBuffer(ThreadPools& pools)
+{
+    if (pools.usedBuffers == pools.buffers.size())
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pools.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkResult res = vkAllocateCommandBuffers(_device, &allocInfo, &commandBuffer);
+        CHECK_SUCCESS(res, "failed to allocate secondary command buffer!!!")
+        pools.buffers.push_back(commandBuffer);
+    }
+    return pools.buffers[pools.usedBuffers++];
+}
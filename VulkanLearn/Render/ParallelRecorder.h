@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "HostAllocator.h"
+#include "ThreadPool.h"
+
+//records a draw range across the thread pool into secondary command buffers and executes
+//them from the primary in draw order. command pools are externally synchronized, so every
+//thread owns one pool per frame in flight and never touches another thread's pool
+class ParallelRecorder
+{
+public:
+    //secondary command buffer, begin, end
+    using RecordFunc = std::function<void(VkCommandBuffer, uint32_t, uint32_t)>;
+
+    struct Statistics
+    {
+        uint32_t secondariesThisFrame = 0;
+        uint32_t threadsThisFrame = 0;
+    };
+
+    void Create(VkDevice device, const HostAllocator* hostAllocator, ThreadPool* threadPool,
+        uint32_t queueFamily, uint32_t frameCount);
+    void Destroy();
+
+    //call once the fence of frameIndex has been waited, resets every pool of that frame
+    void BeginFrame(uint32_t frameIndex);
+
+    //the primary must be inside a render pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+    //record is called concurrently for disjoint ranges and must only touch its own command buffer
+    void Record(VkCommandBuffer primary, const VkCommandBufferInheritanceInfo& inheritance,
+        uint32_t drawCount, const RecordFunc& record);
+
+    void SetMinDrawsPerBuffer(uint32_t minDraws) { _minDrawsPerBuffer = minDraws; }
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    struct ThreadPools
+    {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        //allocated once and reused after every pool reset
+        std::vector<VkCommandBuffer> buffers;
+        uint32_t usedBuffers = 0;
+        //first draw of every buffer recorded this frame, used to restore draw order
+        std::vector<std::pair<uint32_t, VkCommandBuffer>> recorded;
+    };
+
+    VkCommandBuffer GrabBuffer(ThreadPools& pools);
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    ThreadPool* _threadPool = nullptr;
+    //[frame][thread]
+    std::vector<std::vector<ThreadPools>> _frames;
+    uint32_t _frameIndex = 0;
+    //below this a secondary costs more to begin and execute than it saves
+    uint32_t _minDrawsPerBuffer = 256;
+    std::vector<std::pair<uint32_t, VkCommandBuffer>> _ordered;
+    std::vector<VkCommandBuffer> _executeList;
+    Statistics _statistics;
+};
@@ -0,0 +1,235 @@
+#include "PipelineCache.h"
+#include "VulkanCheck.h"
+
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <cstring>
+
+namespace
+{
+    //"VKPC"
+    const uint32_t kFileMagic = 0x43504b56;
+    const uint32_t kFileVersion = 1;
+}
+
+void PipelineCache::Prefetch(const std::string& path, ThreadPool& threadPool)
+{
+    if (path.empty())
+        return;
+    _prefetchPath = path;
+    _prefetch = threadPool.Submit([path] { return ReadFile(path); });
+}
+
+void PipelineCache::Create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path,
+    const HostAllocator* hostAllocator)
+{
+    _device = device;
+    _hostAllocator = hostAllocator;
+    _path = path;
+    vkGetPhysicalDeviceProperties(physicalDevice, &_properties);
+
+    FileData file;
+    if (_prefetch.valid() && _prefetchPath == path)
+        file = _prefetch.get();
+    else if (!path.empty())
+        file = ReadFile(path);
+    bool loaded = ValidateData(file);
+    std::vector<char>& data = file.data;
+
+    VkPipelineCacheCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    info.initialDataSize = loaded ? data.size() : 0;
+    info.pInitialData = loaded ? data.data() : nullptr;
+    VkResult res = vkCreatePipelineCache(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE_CACHE), &_cache);
+    if (res != VK_SUCCESS && loaded)
+    {
+        //the driver may still reject a blob that passed our checks, start cold instead of failing
+        std::cout << "pipeline cache rejected by driver, starting empty" << std::endl;
+        loaded = false;
+        info.initialDataSize = 0;
+        info.pInitialData = nullptr;
+        res = vkCreatePipelineCache(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE_CACHE), &_cache);
+    }
+    CHECK_SUCCESS(res, "failed to create pipeline cache!!!")
+
+    if (loaded)
+    {
+        _loadedHash = HashData(data.data(), data.size());
+        _loadedSize = data.size();
+        std::cout << "pipeline cache loaded: " << data.size() << " bytes" << std::endl;
+    }
+}
+
+void PipelineCache::Save()
+{
+    if (_cache == VK_NULL_HANDLE || _path.empty())
+        return;
+
+    size_t size = 0;
+    VkResult res = vkGetPipelineCacheData(_device, _cache, &size, nullptr);
+    if (res != VK_SUCCESS || size == 0)
+        return;
+    std::vector<char> data(size);
+    res = vkGetPipelineCacheData(_device, _cache, &size, data.data());
+    if (res != VK_SUCCESS)
+        return;
+    data.resize(size);
+
+    FileHeader header;
+    FillFileHeader(header, data);
+    if (header.dataHash == _loadedHash && size == _loadedSize)
+        return;
+
+    //write to a temporary file first so a crash mid-write never leaves a torn cache behind
+    std::string tmpPath = _path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "failed to write pipeline cache: " << tmpPath << std::endl;
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), data.size());
+        if (!file)
+        {
+            std::cout << "failed to write pipeline cache: " << tmpPath << std::endl;
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, _path, error);
+    if (error)
+    {
+        std::cout << "failed to replace pipeline cache: " << error.message() << std::endl;
+        std::filesystem::remove(tmpPath, error);
+        return;
+    }
+    _loadedHash = header.dataHash;
+    _loadedSize = size;
+}
+
+void PipelineCache::Destroy()
+{
+    if (_cache != VK_NULL_HANDLE)
+    {
+        vkDestroyPipelineCache(_device, _cache, _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE_CACHE));
+        _cache = VK_NULL_HANDLE;
+    }
+}
+
+PipelineCache::FileData PipelineCache::ReadFile(const std::string& path)
+{
+    //runs on the prefetch thread, errors are only reported once Create validates the result
+    FileData result;
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return result;
+    result.found = true;
+
+    std::streamoff fileSize = file.tellg();
+    if (fileSize < static_cast<std::streamoff>(sizeof(FileHeader)))
+    {
+        result.error = "truncated file";
+        return result;
+    }
+    file.seekg(0);
+
+    FileHeader& header = result.header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != kFileMagic || header.version != kFileVersion)
+    {
+        result.error = "unknown file format";
+        return result;
+    }
+
+    if (header.dataSize != static_cast<uint64_t>(fileSize) - sizeof(FileHeader))
+    {
+        result.error = "size mismatch";
+        return result;
+    }
+
+    result.data.resize(static_cast<size_t>(header.dataSize));
+    file.read(result.data.data(), result.data.size());
+    if (!file || HashData(result.data.data(), result.data.size()) != header.dataHash)
+    {
+        result.error = "corrupt data";
+        result.data.clear();
+    }
+    return result;
+}
+
+bool PipelineCache::ValidateData(FileData& file)
+{
+    if (!file.found)
+        return false;
+    if (file.error != nullptr)
+    {
+        std::cout << "pipeline cache discarded: " << file.error << std::endl;
+        file.data.clear();
+        return false;
+    }
+
+    const FileHeader& header = file.header;
+    if (header.vendorID != _properties.vendorID ||
+        header.deviceID != _properties.deviceID ||
+        header.driverVersion != _properties.driverVersion ||
+        std::memcmp(header.pipelineCacheUUID, _properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+    {
+        std::cout << "pipeline cache discarded: created by another device or driver" << std::endl;
+        file.data.clear();
+        return false;
+    }
+
+    if (!IsDriverHeaderValid(file.data))
+    {
+        std::cout << "pipeline cache discarded: invalid driver header" << std::endl;
+        file.data.clear();
+        return false;
+    }
+    return true;
+}
+
+bool PipelineCache::IsDriverHeaderValid(const std::vector<char>& data)
+{
+    //the driver blob starts with VkPipelineCacheHeaderVersionOne, check it as well
+    //in case the file was produced by a driver that lied about its version
+    if (data.size() < sizeof(VkPipelineCacheHeaderVersionOne))
+        return false;
+
+    VkPipelineCacheHeaderVersionOne driverHeader;
+    std::memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+    return driverHeader.headerSize >= sizeof(VkPipelineCacheHeaderVersionOne) &&
+        driverHeader.headerSize <= data.size() &&
+        driverHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        driverHeader.vendorID == _properties.vendorID &&
+        driverHeader.deviceID == _properties.deviceID &&
+        std::memcmp(driverHeader.pipelineCacheUUID, _properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::FillFileHeader(FileHeader& header, const std::vector<char>& data)
+{
+    std::memset(&header, 0, sizeof(header));
+    header.magic = kFileMagic;
+    header.version = kFileVersion;
+    header.vendorID = _properties.vendorID;
+    header.deviceID = _properties.deviceID;
+    header.driverVersion = _properties.driverVersion;
+    std::memcpy(header.pipelineCacheUUID, _properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.dataHash = HashData(data.data(), data.size());
+}
+
+uint64_t PipelineCache::HashData(const char* data, size_t size)
+{
+    //FNV-1a, only used to detect corruption
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+#include <future>
+#include <cstdint>
+
+#include "HostAllocator.h"
+#include "ThreadPool.h"
+
+//VkPipelineCache that survives restarts, the blob is written to the given path, relative ones
+//resolve against the working directory, and only reused when it was produced by the same device
+//and driver
+class PipelineCache
+{
+public:
+    //starts reading the blob on a worker so the file io overlaps instance and device creation,
+    //Create picks the result up. only checks needing no device run early
+    void Prefetch(const std::string& path, ThreadPool& threadPool);
+    void Create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path,
+        const HostAllocator* hostAllocator);
+    //write the cache back to disk, skipped when nothing new was compiled
+    void Save();
+    void Destroy();
+
+    VkPipelineCache Get() const { return _cache; }
+
+private:
+    //prepended to the driver blob, the driver header alone carries no driver version
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+
+    //the file as read from disk, error is set when it cannot be used on any device
+    struct FileData
+    {
+        bool found = false;
+        const char* error = nullptr;
+        FileHeader header{};
+        std::vector<char> data;
+    };
+
+    static FileData ReadFile(const std::string& path);
+    bool ValidateData(FileData& file);
+    bool IsDriverHeaderValid(const std::vector<char>& data);
+    void FillFileHeader(FileHeader& header, const std::vector<char>& data);
+    static uint64_t HashData(const char* data, size_t size);
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    VkPhysicalDeviceProperties _properties{};
+    VkPipelineCache _cache = VK_NULL_HANDLE;
+    std::string _path;
+    std::future<FileData> _prefetch;
+    std::string _prefetchPath;
+
+    //hash of the blob on disk, used to skip redundant writes
+    uint64_t _loadedHash = 0;
+    size_t _loadedSize = 0;
+};
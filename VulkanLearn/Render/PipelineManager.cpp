@@ -0,0 +1,339 @@
+#include "PipelineManager.h"
+#include "VulkanCheck.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+namespace
+{
+    template<typename T>
+    void AppendBytes(std::string& key, const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be hashed bytewise");
+        key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template<typename T>
+    void AppendArray(std::string& key, const std::vector<T>& values)
+    {
+        AppendBytes(key, static_cast<uint32_t>(values.size()));
+        for (const T& value : values)
+        {
+            AppendBytes(key, value);
+        }
+    }
+
+    void AppendString(std::string& key, const std::string& value)
+    {
+        AppendBytes(key, static_cast<uint32_t>(value.size()));
+        key.append(value);
+    }
+}
+
+void PipelineManager::Create(VkDevice device, const HostAllocator* hostAllocator, PipelineCache* pipelineCache,
+    ShaderCache* shaderCache, uint32_t compileThreads)
+{
+    _device = device;
+    _hostAllocator = hostAllocator;
+    _pipelineCache = pipelineCache;
+    _shaderCache = shaderCache;
+    _statistics = Statistics();
+    _stop = false;
+    for (uint32_t i = 0; i < (std::max)(compileThreads, 1u); i++)
+    {
+        _compileThreads.emplace_back(&PipelineManager::CompileLoop, this);
+    }
+}
+
+void PipelineManager::Destroy()
+{
+    if (_device == VK_NULL_HANDLE)
+        return;
+    {
+        //queued compiles are dropped, only the ones already running are waited for
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        _stop = true;
+        _queue.clear();
+    }
+    _queueSignal.notify_all();
+    for (auto& thread : _compileThreads)
+    {
+        thread.join();
+    }
+    _compileThreads.clear();
+
+    for (auto& entry : _entries)
+    {
+        VkPipeline pipeline = entry->pipeline.load(std::memory_order_acquire);
+        if (pipeline != VK_NULL_HANDLE)
+            vkDestroyPipeline(_device, pipeline, _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE));
+    }
+    _entries.clear();
+    _lookup.clear();
+    _device = VK_NULL_HANDLE;
+}
+
+PipelineManager::Handle PipelineManager::Request(const GraphicsPipelineDesc& desc, Handle fallback, CompileMode mode)
+{
+    //the module handle stands in for the shader code, the shader cache deduplicates by content
+    std::vector<VkShaderModule> modules;
+    for (const auto& stage : desc.stages)
+    {
+        modules.push_back(_shaderCache->Load(stage.path));
+    }
+    std::string key = BuildKey(desc, modules);
+
+    {
+        std::lock_guard<std::mutex> lock(_statisticsMutex);
+        _statistics.requests++;
+    }
+    auto it = _lookup.find(key);
+    if (it != _lookup.end())
+    {
+        std::lock_guard<std::mutex> lock(_statisticsMutex);
+        _statistics.hits++;
+        return it->second;
+    }
+
+    Handle handle = static_cast<Handle>(_entries.size());
+    _entries.push_back(std::make_unique<Entry>());
+    Entry& entry = *_entries.back();
+    entry.desc = desc;
+    entry.modules = std::move(modules);
+    entry.fallback = fallback;
+    _lookup.emplace(std::move(key), handle);
+
+    if (mode == CompileMode::Blocking)
+    {
+        Compile(entry);
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            _queue.push_back(&entry);
+        }
+        _queueSignal.notify_one();
+    }
+    return handle;
+}
+
+VkPipeline PipelineManager::Get(Handle handle) const
+{
+    //fallbacks are always requested before the pipelines using them, so the chain cannot loop
+    while (handle != kInvalidHandle)
+    {
+        const Entry& entry = *_entries[handle];
+        VkPipeline pipeline = entry.pipeline.load(std::memory_order_acquire);
+        if (pipeline != VK_NULL_HANDLE)
+            return pipeline;
+        handle = entry.fallback;
+    }
+    return VK_NULL_HANDLE;
+}
+
+VkPipeline PipelineManager::Get(Handle handle, VkPipelineLayout& layout) const
+{
+    layout = VK_NULL_HANDLE;
+    while (handle != kInvalidHandle)
+    {
+        const Entry& entry = *_entries[handle];
+        VkPipeline pipeline = entry.pipeline.load(std::memory_order_acquire);
+        if (pipeline != VK_NULL_HANDLE)
+        {
+            layout = entry.desc.layout;
+            return pipeline;
+        }
+        handle = entry.fallback;
+    }
+    return VK_NULL_HANDLE;
+}
+
+bool PipelineManager::IsReady(Handle handle) const
+{
+    return _entries[handle]->pipeline.load(std::memory_order_acquire) != VK_NULL_HANDLE;
+}
+
+void PipelineManager::WaitIdle()
+{
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    _idleSignal.wait(lock, [this] { return _queue.empty() && _compiling == 0; });
+}
+
+size_t PipelineManager::KeyHash::operator()(const std::string& key) const
+{
+    //FNV-1a, keys are a few hundred bytes of mostly small integers
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : key)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return static_cast<size_t>(hash);
+}
+
+std::string PipelineManager::BuildKey(const GraphicsPipelineDesc& desc, const std::vector<VkShaderModule>& modules)
+{
+    //every field goes in with its size, so two different states never produce the same bytes
+    std::string key;
+    key.reserve(256);
+    AppendBytes(key, static_cast<uint32_t>(desc.stages.size()));
+    for (size_t i = 0; i < desc.stages.size(); i++)
+    {
+        AppendBytes(key, desc.stages[i].stage);
+        AppendBytes(key, modules[i]);
+        AppendString(key, desc.stages[i].entryPoint);
+    }
+    AppendArray(key, desc.vertexBindings);
+    AppendArray(key, desc.vertexAttributes);
+    AppendBytes(key, desc.topology);
+    AppendBytes(key, desc.polygonMode);
+    AppendBytes(key, desc.cullMode);
+    AppendBytes(key, desc.frontFace);
+    AppendBytes(key, desc.depthTest);
+    AppendBytes(key, desc.depthWrite);
+    AppendBytes(key, desc.depthCompareOp);
+    AppendArray(key, desc.blendAttachments);
+    AppendBytes(key, desc.samples);
+    AppendBytes(key, desc.layout);
+    AppendBytes(key, desc.renderPass);
+    AppendBytes(key, desc.subpass);
+    return key;
+}
+
+void PipelineManager::Compile(Entry& entry)
+{
+    PROFILE_FUNCTION();
+    auto start = std::chrono::steady_clock::now();
+    const GraphicsPipelineDesc& desc = entry.desc;
+
+    std::vector<VkPipelineShaderStageCreateInfo> stages(desc.stages.size());
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        stages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stages[i].stage = desc.stages[i].stage;
+        stages[i].module = entry.modules[i];
+        stages[i].pName = desc.stages[i].entryPoint.c_str();
+    }
+
+    VkPipelineVertexInputStateCreateInfo vertexInput{};
+    vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInput.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.vertexBindings.size());
+    vertexInput.pVertexBindingDescriptions = desc.vertexBindings.data();
+    vertexInput.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.vertexAttributes.size());
+    vertexInput.pVertexAttributeDescriptions = desc.vertexAttributes.data();
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = desc.topology;
+
+    VkPipelineViewportStateCreateInfo viewport{};
+    viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterization{};
+    rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterization.polygonMode = desc.polygonMode;
+    rasterization.cullMode = desc.cullMode;
+    rasterization.frontFace = desc.frontFace;
+    rasterization.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisample{};
+    multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample.rasterizationSamples = desc.samples;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+    depthStencil.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencil.depthCompareOp = desc.depthCompareOp;
+
+    VkPipelineColorBlendStateCreateInfo colorBlend{};
+    colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlend.attachmentCount = static_cast<uint32_t>(desc.blendAttachments.size());
+    colorBlend.pAttachments = desc.blendAttachments.data();
+
+    const VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamic{};
+    dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic.dynamicStateCount = 2;
+    dynamic.pDynamicStates = dynamicStates;
+
+    VkGraphicsPipelineCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    info.stageCount = static_cast<uint32_t>(stages.size());
+    info.pStages = stages.data();
+    info.pVertexInputState = &vertexInput;
+    info.pInputAssemblyState = &inputAssembly;
+    info.pViewportState = &viewport;
+    info.pRasterizationState = &rasterization;
+    info.pMultisampleState = &multisample;
+    info.pDepthStencilState = &depthStencil;
+    info.pColorBlendState = &colorBlend;
+    info.pDynamicState = &dynamic;
+    info.layout = desc.layout;
+    info.renderPass = desc.renderPass;
+    info.subpass = desc.subpass;
+
+    //the pipeline cache is internally synchronized, every compile thread can share it
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult res = vkCreateGraphicsPipelines(_device, _pipelineCache->Get(), 1, &info,
+        _hostAllocator->Get(VK_OBJECT_TYPE_PIPELINE), &pipeline);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(_statisticsMutex);
+    if (res != VK_SUCCESS)
+    {
+        //compile threads cannot throw, draws keep using the fallback instead
+        std::cout << "failed to create graphics pipeline, error " << res << std::endl;
+        _statistics.failed++;
+        return;
+    }
+    entry.pipeline.store(pipeline, std::memory_order_release);
+    _statistics.compiled++;
+    _statistics.totalCompileMs += ms;
+    _statistics.maxCompileMs = (std::max)(_statistics.maxCompileMs, ms);
+}
+
+void PipelineManager::CompileLoop()
+{
+    CpuProfiler::SetThreadName("pipeline compiler");
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    for (;;)
+    {
+        _queueSignal.wait(lock, [this] { return _stop || !_queue.empty(); });
+        if (_stop)
+            return;
+        Entry* entry = _queue.front();
+        _queue.pop_front();
+        _compiling++;
+        lock.unlock();
+
+        Compile(*entry);
+
+        lock.lock();
+        _compiling--;
+        if (_queue.empty() && _compiling == 0)
+            _idleSignal.notify_all();
+    }
+}
+
+PipelineManager::Statistics PipelineManager::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(_statisticsMutex);
+    return _statistics;
+}
+
+void PipelineManager::PrintStatistics(std::ostream& out) const
+{
+    Statistics statistics = GetStatistics();
+    out << "pipeline manager: " << statistics.requests << " requests, " << statistics.hits << " hits, "
+        << statistics.compiled << " compiled, " << statistics.failed << " failed, avg "
+        << (statistics.compiled > 0 ? statistics.totalCompileMs / statistics.compiled : 0.0)
+        << " ms, max " << statistics.maxCompileMs << " ms" << std::endl;
+}
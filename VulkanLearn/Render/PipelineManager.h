@@ -0,0 +1,140 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "HostAllocator.h"
+#include "PipelineCache.h"
+#include "ShaderCache.h"
+
+//graphics pipelines keyed by their complete state. a request for a state that was seen before
+//returns the same pipeline, new states are compiled on background threads and draws use the
+//fallback pipeline given with the request until the real one is ready, so no frame ever waits
+//on the driver compiler
+class PipelineManager
+{
+public:
+    using Handle = uint32_t;
+    static const Handle kInvalidHandle = 0xffffffff;
+
+    struct ShaderStage
+    {
+        VkShaderStageFlagBits stage = VK_SHADER_STAGE_VERTEX_BIT;
+        //SPIR-V file loaded through the shader cache
+        std::string path;
+        std::string entryPoint = "main";
+    };
+
+    //everything that ends up in VkGraphicsPipelineCreateInfo, viewport and scissor are dynamic
+    struct GraphicsPipelineDesc
+    {
+        std::vector<ShaderStage> stages;
+        std::vector<VkVertexInputBindingDescription> vertexBindings;
+        std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+        VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+        VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        bool depthTest = false;
+        bool depthWrite = false;
+        VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+        //one per color attachment of the subpass
+        std::vector<VkPipelineColorBlendAttachmentState> blendAttachments;
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        uint32_t subpass = 0;
+    };
+
+    enum class CompileMode
+    {
+        //returns at once, Get answers with the fallback until the compile finished
+        Async,
+        //compiles on the calling thread, meant for fallbacks and loading screens
+        Blocking,
+    };
+
+    struct Statistics
+    {
+        uint32_t requests = 0;
+        //requests answered by a pipeline that already existed or was being compiled
+        uint32_t hits = 0;
+        uint32_t compiled = 0;
+        uint32_t failed = 0;
+        //time the compiler took per pipeline
+        double totalCompileMs = 0.0;
+        double maxCompileMs = 0.0;
+    };
+
+    void Create(VkDevice device, const HostAllocator* hostAllocator, PipelineCache* pipelineCache,
+        ShaderCache* shaderCache, uint32_t compileThreads);
+    //waits for compiles still running, then destroys every pipeline
+    void Destroy();
+
+    //Request and Get are not synchronized against each other, call Request from the thread
+    //that owns the frame while no recording threads are running
+    Handle Request(const GraphicsPipelineDesc& desc, Handle fallback = kInvalidHandle,
+        CompileMode mode = CompileMode::Async);
+    //the pipeline of handle once compiled, otherwise the first ready one along its fallbacks,
+    //VK_NULL_HANDLE when nothing in the chain is ready
+    VkPipeline Get(Handle handle) const;
+    //same, layout is the one of the pipeline returned, which may be a fallback's
+    VkPipeline Get(Handle handle, VkPipelineLayout& layout) const;
+    bool IsReady(Handle handle) const;
+    //blocks until the compile queue is empty, e.g. before a benchmark starts
+    void WaitIdle();
+
+    Statistics GetStatistics() const;
+    void PrintStatistics(std::ostream& out) const;
+
+private:
+    struct Entry
+    {
+        GraphicsPipelineDesc desc;
+        //resolved through the shader cache when the request came in
+        std::vector<VkShaderModule> modules;
+        Handle fallback = kInvalidHandle;
+        //published by the compile thread, non null means ready
+        std::atomic<VkPipeline> pipeline{ VK_NULL_HANDLE };
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const std::string& key) const;
+    };
+
+    static std::string BuildKey(const GraphicsPipelineDesc& desc, const std::vector<VkShaderModule>& modules);
+    void Compile(Entry& entry);
+    void CompileLoop();
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+    PipelineCache* _pipelineCache = nullptr;
+    ShaderCache* _shaderCache = nullptr;
+
+    //entries never move, compile threads hold pointers to them
+    std::vector<std::unique_ptr<Entry>> _entries;
+    std::unordered_map<std::string, Handle, KeyHash> _lookup;
+
+    std::vector<std::thread> _compileThreads;
+    std::mutex _queueMutex;
+    std::condition_variable _queueSignal;
+    std::condition_variable _idleSignal;
+    std::deque<Entry*> _queue;
+    uint32_t _compiling = 0;
+    bool _stop = false;
+
+    mutable std::mutex _statisticsMutex;
+    Statistics _statistics;
+};
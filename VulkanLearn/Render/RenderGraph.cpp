@@ -0,0 +1,705 @@
+#include "RenderGraph.h"
+#include "VulkanCheck.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+
+namespace
+{
+    VkImageUsageFlags GetImageUsage(RenderGraph::Access access)
+    {
+        switch (access)
+        {
+        case RenderGraph::Access::ColorAttachment: return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        case RenderGraph::Access::DepthStencilAttachment: return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        case RenderGraph::Access::DepthStencilRead:
+            return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        case RenderGraph::Access::FragmentShaderRead: return VK_IMAGE_USAGE_SAMPLED_BIT;
+        case RenderGraph::Access::ComputeShaderRead: return VK_IMAGE_USAGE_SAMPLED_BIT;
+        case RenderGraph::Access::ComputeShaderWrite: return VK_IMAGE_USAGE_STORAGE_BIT;
+        case RenderGraph::Access::TransferRead: return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        case RenderGraph::Access::TransferWrite: return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        default: return 0;
+        }
+    }
+
+    VkBufferUsageFlags GetBufferUsage(RenderGraph::Access access)
+    {
+        switch (access)
+        {
+        case RenderGraph::Access::FragmentShaderRead:
+        case RenderGraph::Access::ComputeShaderRead:
+        case RenderGraph::Access::ComputeShaderWrite: return VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        case RenderGraph::Access::VertexBufferRead: return VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        case RenderGraph::Access::IndexBufferRead: return VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+        case RenderGraph::Access::IndirectBufferRead: return VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        case RenderGraph::Access::UniformRead: return VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        case RenderGraph::Access::TransferRead: return VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        case RenderGraph::Access::TransferWrite: return VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        default: return 0;
+        }
+    }
+}
+
+void RenderGraph::PassBuilder::Read(Handle resource, Access access)
+{
+    _graph._passes[_pass].accesses.push_back({ resource, access, false });
+}
+
+void RenderGraph::PassBuilder::Write(Handle resource, Access access)
+{
+    _graph._passes[_pass].accesses.push_back({ resource, access, true });
+}
+
+void RenderGraph::PassBuilder::SetSideEffect()
+{
+    _graph._passes[_pass].sideEffect = true;
+}
+
+RenderGraph::AccessInfo RenderGraph::GetAccessInfo(Access access)
+{
+    switch (access)
+    {
+    case Access::ColorAttachment:
+        return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true };
+    case Access::DepthStencilAttachment:
+        return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true };
+    case Access::DepthStencilRead:
+        return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false };
+    case Access::FragmentShaderRead:
+        return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+    case Access::ComputeShaderRead:
+        return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+    case Access::ComputeShaderWrite:
+        return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_GENERAL, true };
+    case Access::VertexBufferRead:
+        return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, false };
+    case Access::IndexBufferRead:
+        return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, false };
+    case Access::IndirectBufferRead:
+        return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, false };
+    case Access::UniformRead:
+        return { VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_UNIFORM_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, false };
+    case Access::TransferRead:
+        return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false };
+    case Access::TransferWrite:
+        return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true };
+    }
+    return { 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, false };
+}
+
+void RenderGraph::Create(VkDevice device, MemoryAllocator* allocator, DeletionQueue* deletionQueue,
+    const HostAllocator* hostAllocator)
+{
+    _device = device;
+    _allocator = allocator;
+    _deletionQueue = deletionQueue;
+    _hostAllocator = hostAllocator;
+}
+
+void RenderGraph::Destroy()
+{
+    if (_device == VK_NULL_HANDLE)
+        return;
+    Reset();
+    _device = VK_NULL_HANDLE;
+}
+
+void RenderGraph::Reset()
+{
+    //frames in flight may still use the transients
+    for (auto& resource : _resources)
+    {
+        if (resource.imported)
+            continue;
+        if (resource.isImage)
+        {
+            _deletionQueue->Push(VK_OBJECT_TYPE_IMAGE_VIEW, resource.imageView);
+            _deletionQueue->PushImage(resource.image, MemoryAllocation());
+        }
+        else if (resource.buffer != VK_NULL_HANDLE)
+        {
+            _deletionQueue->PushBuffer(resource.buffer, MemoryAllocation());
+        }
+    }
+    for (auto& group : _aliasGroups)
+    {
+        _deletionQueue->PushMemory(group.allocation);
+    }
+    _resources.clear();
+    _passes.clear();
+    _aliasGroups.clear();
+    _order.clear();
+    _barriers.clear();
+    _finalBarriers = BarrierBatch();
+    _statistics = Statistics();
+    _compiled = false;
+}
+
+RenderGraph::Handle RenderGraph::AddResource(Resource&& resource)
+{
+    if (_compiled)
+        throw std::runtime_error("render graph is already compiled, reset it first!!!");
+    _resources.push_back(std::move(resource));
+    return static_cast<Handle>(_resources.size() - 1);
+}
+
+RenderGraph::Handle RenderGraph::CreateImage(const std::string& name, const ImageDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.isImage = true;
+    resource.imageDesc = desc;
+    return AddResource(std::move(resource));
+}
+
+RenderGraph::Handle RenderGraph::CreateBuffer(const std::string& name, const BufferDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.bufferDesc = desc;
+    return AddResource(std::move(resource));
+}
+
+RenderGraph::Handle RenderGraph::ImportImage(const std::string& name, VkImageAspectFlags aspect,
+    VkImageLayout initialLayout, VkPipelineStageFlags initialStage,
+    VkImageLayout finalLayout, VkPipelineStageFlags finalStage, VkAccessFlags finalAccess)
+{
+    Resource resource;
+    resource.name = name;
+    resource.isImage = true;
+    resource.imported = true;
+    resource.imageDesc.aspect = aspect;
+    //the size of an imported image is unknown, barriers cover every subresource
+    resource.imageDesc.mipLevels = VK_REMAINING_MIP_LEVELS;
+    resource.imageDesc.arrayLayers = VK_REMAINING_ARRAY_LAYERS;
+    resource.initialLayout = initialLayout;
+    resource.initialStage = initialStage;
+    resource.finalLayout = finalLayout;
+    resource.finalStage = finalStage;
+    resource.finalAccess = finalAccess;
+    return AddResource(std::move(resource));
+}
+
+RenderGraph::Handle RenderGraph::ImportBuffer(const std::string& name, VkPipelineStageFlags initialStage,
+    VkPipelineStageFlags finalStage, VkAccessFlags finalAccess)
+{
+    Resource resource;
+    resource.name = name;
+    resource.imported = true;
+    resource.initialStage = initialStage;
+    resource.finalStage = finalStage;
+    resource.finalAccess = finalAccess;
+    return AddResource(std::move(resource));
+}
+
+void RenderGraph::SetImage(Handle resource, VkImage image, VkImageView imageView)
+{
+    _resources[resource].image = image;
+    _resources[resource].imageView = imageView;
+}
+
+void RenderGraph::SetBuffer(Handle resource, VkBuffer buffer)
+{
+    _resources[resource].buffer = buffer;
+}
+
+void RenderGraph::AddPass(const std::string& name, const SetupFunc& setup, const ExecuteFunc& execute)
+{
+    if (_compiled)
+        throw std::runtime_error("render graph is already compiled, reset it first!!!");
+    Pass pass;
+    pass.name = name;
+    pass.execute = execute;
+    _passes.push_back(std::move(pass));
+
+    PassBuilder builder(*this, static_cast<uint32_t>(_passes.size() - 1));
+    setup(builder);
+}
+
+void RenderGraph::Compile()
+{
+    PROFILE_FUNCTION();
+    if (_compiled)
+        throw std::runtime_error("render graph is already compiled, reset it first!!!");
+
+    CullPasses();
+    ComputeLifetimes();
+    CreateTransients();
+    AssignAliasGroups();
+    BuildBarriers();
+    _compiled = true;
+
+    _statistics.passCount = static_cast<uint32_t>(_order.size());
+}
+
+void RenderGraph::PrintStatistics(std::ostream& out) const
+{
+    out << "render graph: " << _statistics.passCount << " passes, " << _statistics.culledPasses << " culled, "
+        << _statistics.barrierCalls << " barrier calls, " << _statistics.imageBarriers << " image barriers, transients "
+        << (_statistics.transientBytes >> 10) << " KiB aliased into " << (_statistics.allocatedBytes >> 10) << " KiB"
+        << std::endl;
+}
+
+void RenderGraph::CullPasses()
+{
+    //walk backwards, a pass survives if it has side effects or writes something a surviving
+    //pass reads later. imported resources are read by whoever uses them after the frame
+    std::vector<bool> needed(_resources.size());
+    for (size_t i = 0; i < _resources.size(); i++)
+    {
+        needed[i] = _resources[i].imported;
+    }
+
+    _statistics.culledPasses = 0;
+    for (size_t i = _passes.size(); i-- > 0;)
+    {
+        Pass& pass = _passes[i];
+        bool keep = pass.sideEffect;
+        for (const auto& access : pass.accesses)
+        {
+            if (access.write && needed[access.resource])
+                keep = true;
+        }
+        pass.culled = !keep;
+        if (!keep)
+        {
+            _statistics.culledPasses++;
+            continue;
+        }
+        //earlier writes are overwritten here unless this pass also reads them
+        for (const auto& access : pass.accesses)
+        {
+            if (access.write)
+                needed[access.resource] = false;
+        }
+        for (const auto& access : pass.accesses)
+        {
+            if (!access.write)
+                needed[access.resource] = true;
+        }
+    }
+
+    _order.clear();
+    for (uint32_t i = 0; i < _passes.size(); i++)
+    {
+        if (!_passes[i].culled)
+            _order.push_back(i);
+    }
+}
+
+void RenderGraph::ComputeLifetimes()
+{
+    for (uint32_t i = 0; i < _order.size(); i++)
+    {
+        for (const auto& access : _passes[_order[i]].accesses)
+        {
+            Resource& resource = _resources[access.resource];
+            AccessInfo info = GetAccessInfo(access.access);
+            if (!resource.used)
+                resource.firstUse = i;
+            resource.used = true;
+            resource.lastUse = i;
+            resource.usedStages |= info.stages;
+            if (access.write || info.write)
+                resource.writeAccess |= info.access;
+            if (resource.isImage)
+                resource.imageUsage |= GetImageUsage(access.access);
+            else
+                resource.bufferUsage |= GetBufferUsage(access.access);
+        }
+    }
+}
+
+void RenderGraph::CreateTransients()
+{
+    for (auto& resource : _resources)
+    {
+        if (resource.imported || !resource.used)
+            continue;
+
+        if (resource.isImage)
+        {
+            const ImageDesc& desc = resource.imageDesc;
+            VkImageCreateInfo info{};
+            info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            info.imageType = VK_IMAGE_TYPE_2D;
+            info.format = desc.format;
+            info.extent = { desc.extent.width, desc.extent.height, 1 };
+            info.mipLevels = desc.mipLevels;
+            info.arrayLayers = desc.arrayLayers;
+            info.samples = desc.samples;
+            info.tiling = VK_IMAGE_TILING_OPTIMAL;
+            info.usage = resource.imageUsage;
+            info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkResult res = vkCreateImage(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_IMAGE), &resource.image);
+            CHECK_SUCCESS(res, "failed to create render graph image!!!")
+            vkGetImageMemoryRequirements(_device, resource.image, &resource.requirements);
+        }
+        else
+        {
+            VkBufferCreateInfo info{};
+            info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            info.size = resource.bufferDesc.size;
+            info.usage = resource.bufferUsage;
+            info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            VkResult res = vkCreateBuffer(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_BUFFER), &resource.buffer);
+            CHECK_SUCCESS(res, "failed to create render graph buffer!!!")
+            vkGetBufferMemoryRequirements(_device, resource.buffer, &resource.requirements);
+        }
+        _statistics.transientBytes += resource.requirements.size;
+    }
+}
+
+void RenderGraph::AssignAliasGroups()
+{
+    std::vector<Handle> transients;
+    for (Handle i = 0; i < _resources.size(); i++)
+    {
+        if (!_resources[i].imported && _resources[i].used)
+            transients.push_back(i);
+    }
+    //largest first, so smaller resources fill memory that is already there
+    std::stable_sort(transients.begin(), transients.end(), [this](Handle a, Handle b)
+        {
+            return _resources[a].requirements.size > _resources[b].requirements.size;
+        });
+
+    for (Handle handle : transients)
+    {
+        const Resource& resource = _resources[handle];
+        AliasGroup* target = nullptr;
+        for (auto& group : _aliasGroups)
+        {
+            //images and buffers never share memory, linear and optimal resources would need
+            //bufferImageGranularity padding between them
+            if (group.isImage != resource.isImage ||
+                (group.requirements.memoryTypeBits & resource.requirements.memoryTypeBits) == 0)
+            {
+                continue;
+            }
+            bool overlaps = false;
+            for (Handle other : group.resources)
+            {
+                const Resource& member = _resources[other];
+                if (resource.firstUse <= member.lastUse && member.firstUse <= resource.lastUse)
+                {
+                    overlaps = true;
+                    break;
+                }
+            }
+            if (!overlaps)
+            {
+                target = &group;
+                break;
+            }
+        }
+
+        if (target == nullptr)
+        {
+            _aliasGroups.emplace_back();
+            target = &_aliasGroups.back();
+            target->isImage = resource.isImage;
+            target->requirements = resource.requirements;
+        }
+        else
+        {
+            target->requirements.size = (std::max)(target->requirements.size, resource.requirements.size);
+            target->requirements.alignment = (std::max)(target->requirements.alignment, resource.requirements.alignment);
+            target->requirements.memoryTypeBits &= resource.requirements.memoryTypeBits;
+        }
+        target->resources.push_back(handle);
+    }
+
+    for (auto& group : _aliasGroups)
+    {
+        group.allocation = _allocator->Allocate(group.requirements,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, !group.isImage);
+        _statistics.allocatedBytes += group.requirements.size;
+
+        std::sort(group.resources.begin(), group.resources.end(), [this](Handle a, Handle b)
+            {
+                return _resources[a].firstUse < _resources[b].firstUse;
+            });
+        //the first user waits for the whole group in the previous frame, the others for the
+        //user right before them
+        VkPipelineStageFlags groupStages = 0;
+        VkAccessFlags groupWrites = 0;
+        for (Handle handle : group.resources)
+        {
+            groupStages |= _resources[handle].usedStages;
+            groupWrites |= _resources[handle].writeAccess;
+        }
+        for (size_t i = 0; i < group.resources.size(); i++)
+        {
+            Resource& resource = _resources[group.resources[i]];
+            if (i == 0)
+            {
+                resource.priorStages = groupStages;
+                resource.priorWrites = groupWrites;
+            }
+            else
+            {
+                const Resource& previous = _resources[group.resources[i - 1]];
+                resource.priorStages = previous.usedStages;
+                resource.priorWrites = previous.writeAccess;
+            }
+
+            VkResult res;
+            if (resource.isImage)
+            {
+                res = vkBindImageMemory(_device, resource.image, group.allocation.memory, group.allocation.offset);
+                CHECK_SUCCESS(res, "failed to bind render graph image memory!!!")
+
+                const ImageDesc& desc = resource.imageDesc;
+                VkImageViewCreateInfo viewInfo{};
+                viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                viewInfo.image = resource.image;
+                viewInfo.viewType = desc.arrayLayers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+                viewInfo.format = desc.format;
+                viewInfo.subresourceRange.aspectMask = desc.aspect;
+                viewInfo.subresourceRange.baseMipLevel = 0;
+                viewInfo.subresourceRange.levelCount = desc.mipLevels;
+                viewInfo.subresourceRange.baseArrayLayer = 0;
+                viewInfo.subresourceRange.layerCount = desc.arrayLayers;
+                res = vkCreateImageView(_device, &viewInfo, _hostAllocator->Get(VK_OBJECT_TYPE_IMAGE_VIEW),
+                    &resource.imageView);
+                CHECK_SUCCESS(res, "failed to create render graph image view!!!")
+            }
+            else
+            {
+                res = vkBindBufferMemory(_device, resource.buffer, group.allocation.memory, group.allocation.offset);
+                CHECK_SUCCESS(res, "failed to bind render graph buffer memory!!!")
+            }
+        }
+    }
+}
+
+void RenderGraph::BuildBarriers()
+{
+    std::vector<ResourceState> states(_resources.size());
+    for (size_t i = 0; i < _resources.size(); i++)
+    {
+        const Resource& resource = _resources[i];
+        ResourceState& state = states[i];
+        //transient contents never survive into the next frame, every frame starts from UNDEFINED
+        state.layout = resource.imported ? resource.initialLayout : VK_IMAGE_LAYOUT_UNDEFINED;
+        state.writeStages = resource.imported ? resource.initialStage : resource.priorStages;
+        state.writeAccess = resource.imported ? 0 : resource.priorWrites;
+    }
+
+    struct Usage
+    {
+        Handle resource;
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout layout;
+        bool write;
+    };
+    std::vector<Usage> usages;
+
+    _barriers.assign(_order.size(), BarrierBatch());
+    for (size_t i = 0; i < _order.size(); i++)
+    {
+        //a resource accessed several ways by one pass gets a single combined transition
+        usages.clear();
+        for (const auto& access : _passes[_order[i]].accesses)
+        {
+            AccessInfo info = GetAccessInfo(access.access);
+            bool write = access.write || info.write;
+            auto it = std::find_if(usages.begin(), usages.end(),
+                [&](const Usage& usage) { return usage.resource == access.resource; });
+            if (it == usages.end())
+            {
+                usages.push_back({ access.resource, info.stages, info.access, info.layout, write });
+                continue;
+            }
+            it->stages |= info.stages;
+            it->access |= info.access;
+            if (it->layout != info.layout)
+            {
+                //the layout of the write wins, two different read layouts fall back to GENERAL
+                if (write && !it->write)
+                    it->layout = info.layout;
+                else if (write == it->write)
+                    it->layout = VK_IMAGE_LAYOUT_GENERAL;
+            }
+            it->write |= write;
+        }
+
+        BarrierBatch& batch = _barriers[i];
+        for (const auto& usage : usages)
+        {
+            const Resource& resource = _resources[usage.resource];
+            ResourceState& state = states[usage.resource];
+
+            if (resource.isImage && state.layout != usage.layout)
+            {
+                //the transition waits for every earlier access and is itself a write
+                batch.srcStages |= state.writeStages | state.readStages;
+                batch.dstStages |= usage.stages;
+                batch.images.push_back({ usage.resource, state.layout, usage.layout, state.writeAccess, usage.access });
+                state.layout = usage.layout;
+                state.writeStages = usage.stages;
+                state.writeAccess = usage.write ? usage.access : 0;
+                state.readStages = usage.write ? 0 : usage.stages;
+                state.visibleStages = usage.stages;
+                state.visibleAccess = usage.access;
+                continue;
+            }
+
+            if (usage.write)
+            {
+                //write after write needs the old write made available, write after read only
+                //has to wait for the reads to finish
+                VkPipelineStageFlags src = state.writeStages | state.readStages;
+                if (src != 0)
+                {
+                    batch.srcStages |= src;
+                    batch.dstStages |= usage.stages;
+                    if (state.writeAccess != 0)
+                    {
+                        batch.srcAccess |= state.writeAccess;
+                        batch.dstAccess |= usage.access;
+                    }
+                }
+                state.writeStages = usage.stages;
+                state.writeAccess = usage.access;
+                state.readStages = 0;
+                state.visibleStages = usage.stages;
+                state.visibleAccess = usage.access;
+                continue;
+            }
+
+            //readers that already see the last write need nothing
+            bool visible = (usage.stages & ~state.visibleStages) == 0 && (usage.access & ~state.visibleAccess) == 0;
+            if (state.writeStages != 0 && !visible)
+            {
+                batch.srcStages |= state.writeStages;
+                batch.dstStages |= usage.stages;
+                if (state.writeAccess != 0)
+                {
+                    batch.srcAccess |= state.writeAccess;
+                    batch.dstAccess |= usage.access;
+                }
+                state.visibleStages |= usage.stages;
+                state.visibleAccess |= usage.access;
+            }
+            state.readStages |= usage.stages;
+        }
+    }
+
+    //hand imported resources over in the layout and stage the rest of the frame expects
+    _finalBarriers = BarrierBatch();
+    for (Handle i = 0; i < _resources.size(); i++)
+    {
+        const Resource& resource = _resources[i];
+        if (!resource.imported)
+            continue;
+        ResourceState& state = states[i];
+        VkPipelineStageFlags src = state.writeStages | state.readStages;
+        if (resource.isImage && resource.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED && state.layout != resource.finalLayout)
+        {
+            _finalBarriers.srcStages |= src;
+            _finalBarriers.dstStages |= resource.finalStage;
+            _finalBarriers.images.push_back({ i, state.layout, resource.finalLayout, state.writeAccess, resource.finalAccess });
+        }
+        else if (resource.finalStage != 0 && src != 0)
+        {
+            _finalBarriers.srcStages |= src;
+            _finalBarriers.dstStages |= resource.finalStage;
+            _finalBarriers.srcAccess |= state.writeAccess;
+            _finalBarriers.dstAccess |= resource.finalAccess;
+        }
+    }
+
+    _statistics.barrierCalls = _finalBarriers.IsEmpty() ? 0 : 1;
+    _statistics.imageBarriers = static_cast<uint32_t>(_finalBarriers.images.size());
+    for (const auto& batch : _barriers)
+    {
+        _statistics.barrierCalls += batch.IsEmpty() ? 0 : 1;
+        _statistics.imageBarriers += static_cast<uint32_t>(batch.images.size());
+    }
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer, GpuProfiler* profiler)
+{
+    PROFILE_FUNCTION();
+    if (!_compiled)
+        throw std::runtime_error("render graph must be compiled before executing!!!");
+
+    for (size_t i = 0; i < _order.size(); i++)
+    {
+        RecordBarriers(commandBuffer, _barriers[i]);
+        const Pass& pass = _passes[_order[i]];
+        if (profiler)
+        {
+            GpuProfiler::Scope scope(*profiler, commandBuffer, pass.name.c_str(), true);
+            pass.execute(commandBuffer);
+        }
+        else
+        {
+            pass.execute(commandBuffer);
+        }
+    }
+    RecordBarriers(commandBuffer, _finalBarriers);
+}
+
+void RenderGraph::RecordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch)
+{
+    if (batch.IsEmpty())
+        return;
+
+    _imageBarriers.clear();
+    for (const auto& transition : batch.images)
+    {
+        const Resource& resource = _resources[transition.resource];
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = transition.srcAccess;
+        barrier.dstAccessMask = transition.dstAccess;
+        barrier.oldLayout = transition.oldLayout;
+        barrier.newLayout = transition.newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource.image;
+        barrier.subresourceRange.aspectMask = resource.imageDesc.aspect;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = resource.imageDesc.mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = resource.imageDesc.arrayLayers;
+        _imageBarriers.push_back(barrier);
+    }
+
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = batch.srcAccess;
+    memoryBarrier.dstAccessMask = batch.dstAccess;
+    bool hasMemoryBarrier = batch.srcAccess != 0 || batch.dstAccess != 0;
+
+    //nothing to wait for still has to name a stage
+    VkPipelineStageFlags srcStages = batch.srcStages != 0 ? batch.srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkPipelineStageFlags dstStages = batch.dstStages != 0 ? batch.dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0,
+        hasMemoryBarrier ? 1 : 0, hasMemoryBarrier ? &memoryBarrier : nullptr,
+        0, nullptr,
+        static_cast<uint32_t>(_imageBarriers.size()), _imageBarriers.data());
+}
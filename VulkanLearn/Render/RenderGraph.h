@@ -0,0 +1,255 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <functional>
+#include <ostream>
+#include <cstdint>
+
+#include "HostAllocator.h"
+#include "MemoryAllocator.h"
+#include "DeletionQueue.h"
+#include "GpuProfiler.h"
+
+//frame graph compiled once and executed every frame. passes declare how they access images
+//and buffers, Compile then culls passes nothing depends on, places transient resources whose
+//lifetimes do not overlap in the same memory, and precomputes one merged vkCmdPipelineBarrier
+//per pass. passes never write barriers themselves, render passes used inside the graph must
+//keep their attachments in the layout the graph transitioned them to
+class RenderGraph
+{
+public:
+    using Handle = uint32_t;
+    static const Handle kInvalidHandle = 0xffffffff;
+
+    //every access implies its pipeline stages, access mask and, for images, layout
+    enum class Access
+    {
+        ColorAttachment,
+        DepthStencilAttachment,
+        DepthStencilRead,
+        //sampled images and read only buffers
+        FragmentShaderRead,
+        ComputeShaderRead,
+        //storage images are kept in GENERAL
+        ComputeShaderWrite,
+        VertexBufferRead,
+        IndexBufferRead,
+        IndirectBufferRead,
+        UniformRead,
+        TransferRead,
+        TransferWrite,
+    };
+
+    struct ImageDesc
+    {
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent2D extent = { 0, 0 };
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        uint32_t mipLevels = 1;
+        uint32_t arrayLayers = 1;
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    };
+
+    struct BufferDesc
+    {
+        VkDeviceSize size = 0;
+    };
+
+    class PassBuilder
+    {
+    public:
+        void Read(Handle resource, Access access);
+        //a pass that reads what it writes, blending or LOAD_OP_LOAD, must declare the read as well
+        void Write(Handle resource, Access access);
+        //keeps the pass even when nothing reads its outputs
+        void SetSideEffect();
+
+    private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, uint32_t pass) : _graph(graph), _pass(pass) {}
+
+        RenderGraph& _graph;
+        uint32_t _pass;
+    };
+
+    using SetupFunc = std::function<void(PassBuilder&)>;
+    using ExecuteFunc = std::function<void(VkCommandBuffer)>;
+
+    struct Statistics
+    {
+        uint32_t passCount = 0;
+        uint32_t culledPasses = 0;
+        uint32_t barrierCalls = 0;
+        uint32_t imageBarriers = 0;
+        //transient memory needed without aliasing and what was actually allocated
+        VkDeviceSize transientBytes = 0;
+        VkDeviceSize allocatedBytes = 0;
+    };
+
+    void Create(VkDevice device, MemoryAllocator* allocator, DeletionQueue* deletionQueue,
+        const HostAllocator* hostAllocator);
+    //transient resources are released through the deletion queue, flush it afterwards
+    void Destroy();
+    //drops every pass and resource so the graph can be declared again, e.g. after a resize
+    void Reset();
+
+    //transient resources are created by Compile and only live while the graph does
+    Handle CreateImage(const std::string& name, const ImageDesc& desc);
+    Handle CreateBuffer(const std::string& name, const BufferDesc& desc);
+    //imported resources enter the frame in initialLayout after initialStage and are left in
+    //finalLayout for finalStage, their handles are set every frame with SetImage and SetBuffer
+    Handle ImportImage(const std::string& name, VkImageAspectFlags aspect,
+        VkImageLayout initialLayout, VkPipelineStageFlags initialStage,
+        VkImageLayout finalLayout, VkPipelineStageFlags finalStage, VkAccessFlags finalAccess);
+    Handle ImportBuffer(const std::string& name, VkPipelineStageFlags initialStage,
+        VkPipelineStageFlags finalStage, VkAccessFlags finalAccess);
+    void SetImage(Handle resource, VkImage image, VkImageView imageView);
+    void SetBuffer(Handle resource, VkBuffer buffer);
+
+    //passes run in declaration order, a pass may only read what an earlier pass wrote
+    void AddPass(const std::string& name, const SetupFunc& setup, const ExecuteFunc& execute);
+
+    void Compile();
+    //every pass gets a gpu scope named after it when a profiler is given, with pipeline statistics
+    //when the profiler collects them
+    void Execute(VkCommandBuffer commandBuffer, GpuProfiler* profiler = nullptr);
+
+    VkImage GetImage(Handle resource) const { return _resources[resource].image; }
+    VkImageView GetImageView(Handle resource) const { return _resources[resource].imageView; }
+    VkBuffer GetBuffer(Handle resource) const { return _resources[resource].buffer; }
+    //of the last Compile
+    const Statistics& GetStatistics() const { return _statistics; }
+    void PrintStatistics(std::ostream& out) const;
+
+private:
+    struct AccessInfo
+    {
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout layout;
+        bool write;
+    };
+
+    struct Resource
+    {
+        std::string name;
+        bool isImage = false;
+        bool imported = false;
+        ImageDesc imageDesc;
+        BufferDesc bufferDesc;
+
+        VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags initialStage = 0;
+        VkPipelineStageFlags finalStage = 0;
+        VkAccessFlags finalAccess = 0;
+
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView imageView = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+
+        //filled by Compile
+        VkImageUsageFlags imageUsage = 0;
+        VkBufferUsageFlags bufferUsage = 0;
+        uint32_t firstUse = 0;
+        uint32_t lastUse = 0;
+        bool used = false;
+        VkPipelineStageFlags usedStages = 0;
+        VkAccessFlags writeAccess = 0;
+        VkMemoryRequirements requirements{};
+        //what has to finish before the first access of a frame, the previous frame or the
+        //resource that used the memory before
+        VkPipelineStageFlags priorStages = 0;
+        VkAccessFlags priorWrites = 0;
+    };
+
+    struct PassAccess
+    {
+        Handle resource;
+        Access access;
+        bool write;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        std::vector<PassAccess> accesses;
+        bool sideEffect = false;
+        bool culled = false;
+        ExecuteFunc execute;
+    };
+
+    struct ImageTransition
+    {
+        Handle resource;
+        VkImageLayout oldLayout;
+        VkImageLayout newLayout;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+    };
+
+    //everything a pass waits for, recorded as a single vkCmdPipelineBarrier
+    struct BarrierBatch
+    {
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        //buffers and images without a layout change share one global memory barrier
+        VkAccessFlags srcAccess = 0;
+        VkAccessFlags dstAccess = 0;
+        std::vector<ImageTransition> images;
+
+        bool IsEmpty() const { return srcStages == 0 && dstStages == 0 && images.empty(); }
+    };
+
+    //transient resources sharing one allocation, their lifetimes never overlap
+    struct AliasGroup
+    {
+        bool isImage = false;
+        VkMemoryRequirements requirements{};
+        std::vector<Handle> resources;
+        MemoryAllocation allocation;
+    };
+
+    //barrier tracking state of a resource while walking the passes
+    struct ResourceState
+    {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags writeStages = 0;
+        VkAccessFlags writeAccess = 0;
+        VkPipelineStageFlags readStages = 0;
+        //stages and accesses the last write has already been made visible to
+        VkPipelineStageFlags visibleStages = 0;
+        VkAccessFlags visibleAccess = 0;
+    };
+
+    static AccessInfo GetAccessInfo(Access access);
+    Handle AddResource(Resource&& resource);
+    void CullPasses();
+    void ComputeLifetimes();
+    void CreateTransients();
+    void AssignAliasGroups();
+    void BuildBarriers();
+    void RecordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch);
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    MemoryAllocator* _allocator = nullptr;
+    DeletionQueue* _deletionQueue = nullptr;
+    const HostAllocator* _hostAllocator = nullptr;
+
+    std::vector<Resource> _resources;
+    std::vector<Pass> _passes;
+    std::vector<AliasGroup> _aliasGroups;
+    bool _compiled = false;
+
+    //surviving passes in execution order and the barriers recorded before each of them
+    std::vector<uint32_t> _order;
+    std::vector<BarrierBatch> _barriers;
+    //transitions imported resources into their final layout
+    BarrierBatch _finalBarriers;
+    //scratch array reused by RecordBarriers
+    std::vector<VkImageMemoryBarrier> _imageBarriers;
+    Statistics _statistics;
+};
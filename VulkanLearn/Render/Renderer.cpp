@@ -1,27 +1,116 @@
 #include "Renderer.h"
+#include "VulkanCheck.h"
 
 #include <set>
 #include <limits>
 #include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <cctype>
+#include <thread>
 
-#define CHECK_SUCCESS(res, errorInfo) \
-if(res != VK_SUCCESS) \
-{\
-    throw std::runtime_error(errorInfo);\
+namespace
+{
+    std::string GetEnvironmentValue(const char* name)
+    {
+#ifdef _WIN32
+        char* value = nullptr;
+        size_t length = 0;
+        if (_dupenv_s(&value, &length, name) != 0 || value == nullptr)
+            return std::string();
+        std::string res(value);
+        free(value);
+        return res;
+#else
+        const char* value = std::getenv(name);
+        return value ? std::string(value) : std::string();
+#endif
+    }
+
+    std::string ToLower(std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return text;
+    }
+
+    const char* GetDeviceTypeName(VkPhysicalDeviceType type)
+    {
+        switch (type)
+        {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+        default: return "other";
+        }
+    }
+}
+
+Renderer::Renderer(const Settings& settings)
+    : _settings(settings)
+{
+    if (_settings.framesInFlight == 0)
+    {
+        throw std::invalid_argument("frames in flight must be at least one!!!");
+    }
 }
 
 void Renderer::InitVulkan()
 {
-    CreateVKInstance();
-    CreateValidationLayer();
+    PROFILE_FUNCTION();
+    auto start = std::chrono::steady_clock::now();
+    _initStages.clear();
+    _hostAllocator.Create(_settings.hostAllocator);
+    TimeInitStage("thread pool", [this]
+        {
+            uint32_t recordThreads = _settings.recordThreads;
+            if (recordThreads == 0)
+                recordThreads = (std::max)(std::thread::hardware_concurrency(), 1u) - 1;
+            _threadPool.Create(recordThreads);
+        });
+    //loads that do not depend on the device run on the workers while the device is set up
+    _pipelineCache.Prefetch(_settings.pipelineCachePath, _threadPool);
+    TimeInitStage("instance", [this] { CreateVKInstance(); });
+    if (_enableValidationLayers)
+        TimeInitStage("debug messenger", [this] { CreateValidationLayer(); });
     //the window surface needs to be created right after the instance creation,
     //because it can actually influence the physical device selection
-    CreateSurface();
-    PickPhysicalDevice();
-    CreateLogicalDevice();
-    CreateSwapChain();
-    CreateImageViews();
-    CreateGeaphicsPipline();
+    if (!_settings.headless)
+        TimeInitStage("surface", [this] { CreateSurface(); });
+    TimeInitStage("pick device", [this] { PickPhysicalDevice(); });
+    TimeInitStage("logical device", [this] { CreateLogicalDevice(); });
+    if (_settings.headless)
+        TimeInitStage("offscreen targets", [this] { CreateOffscreenTargets(); });
+    else
+        TimeInitStage("swap chain", [this] { CreateSwapChain(); });
+    TimeInitStage("image views", [this] { CreateImageViews(); });
+    TimeInitStage("render pass", [this] { CreateRenderPass(); });
+    TimeInitStage("pipelines", [this] { CreateGeaphicsPipline(); });
+    TimeInitStage("framebuffers", [this] { CreateFramebuffers(); });
+    TimeInitStage("render graph", [this] { BuildRenderGraph(); });
+    TimeInitStage("frame resources", [this] { CreateFrameResources(); });
+
+    double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(2) << "vulkan init took " << totalMs << " ms:" << std::endl;
+    for (const auto& stage : _initStages)
+    {
+        std::cout << "  " << stage.first << ": " << stage.second << " ms" << std::endl;
+    }
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+void Renderer::TimeInitStage(const char* name, const std::function<void()>& stage)
+{
+    PROFILE_SCOPE(name);
+    auto start = std::chrono::steady_clock::now();
+    stage();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    _initStages.emplace_back(name, ms);
 }
 
 
@@ -38,18 +127,368 @@ void Renderer::InitWindow()
     {
         throw std::runtime_error("window create fail!");
     }
+    glfwSetWindowUserPointer(_window, this);
+    glfwSetFramebufferSizeCallback(_window, FramebufferResizeCallback);
+    glfwSetKeyCallback(_window, KeyCallback);
+}
+
+void Renderer::FramebufferResizeCallback(GLFWwindow* window, int width, int height)
+{
+    //not every platform reports VK_ERROR_OUT_OF_DATE_KHR on resize, so track it ourselves
+    auto renderer = reinterpret_cast<Renderer*>(glfwGetWindowUserPointer(window));
+    renderer->_swapChainDirty = true;
+}
+
+void Renderer::KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+
+    //F1-F3 switch the present policy at runtime, F4 dumps the driver host allocations,
+    //F5 the gpu scopes, F6 writes a chrome trace, F7 prints the validation performance warnings
+    //and F8 the render graph, shader and pipeline statistics
+    auto renderer = reinterpret_cast<Renderer*>(glfwGetWindowUserPointer(window));
+    //a --swapchain-images override survives the switch
+    uint32_t imageCount = renderer->_settings.swapchainImageCount;
+    switch (key)
+    {
+    case GLFW_KEY_F1:
+        renderer->SetPresentPolicy(PresentPolicy::LowLatency, imageCount);
+        break;
+    case GLFW_KEY_F2:
+        renderer->SetPresentPolicy(PresentPolicy::PowerSaving, imageCount);
+        break;
+    case GLFW_KEY_F3:
+        renderer->SetPresentPolicy(PresentPolicy::Adaptive, imageCount);
+        break;
+    case GLFW_KEY_F4:
+        renderer->_hostAllocator.PrintStatistics(std::cout);
+        break;
+    case GLFW_KEY_F5:
+        renderer->_gpuProfiler.PrintStatistics(std::cout);
+        break;
+    case GLFW_KEY_F6:
+        CpuProfiler::WriteChromeTrace(renderer->_settings.tracePath.empty() ?
+            "trace.json" : renderer->_settings.tracePath);
+        break;
+    case GLFW_KEY_F7:
+        renderer->_debugSink.PrintPerformanceReport(std::cout);
+        break;
+    case GLFW_KEY_F8:
+        renderer->_renderGraph.PrintStatistics(std::cout);
+        renderer->_shaderCache.PrintStatistics(std::cout);
+        renderer->_pipelineManager.PrintStatistics(std::cout);
+        if (renderer->_gpuCullingEnabled)
+            renderer->_gpuCulling.PrintStatistics(std::cout);
+        break;
+    default:
+        break;
+    }
 }
 
 void Renderer::MainLoop()
 {
+    if (_settings.headless)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < _settings.headlessFrameCount; i++)
+        {
+            DrawFrameHeadless();
+        }
+        vkDeviceWaitIdle(_logicalDevice);
+        auto end = std::chrono::steady_clock::now();
+
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        std::cout << "rendered " << _settings.headlessFrameCount << " headless frames in "
+            << ms << " ms (" << (ms > 0.0 ? _settings.headlessFrameCount * 1000.0 / ms : 0.0)
+            << " fps)" << std::endl;
+        return;
+    }
+
     while(!glfwWindowShouldClose(_window))
     {
         glfwPollEvents();
+        DrawFrame();
+    }
+
+    //frames still in flight reference resources destroyed by cleanup
+    vkDeviceWaitIdle(_logicalDevice);
+}
+
+void Renderer::DrawFrame()
+{
+    PROFILE_FUNCTION();
+    FrameData& frame = _frames[_currentFrame];
+
+    //only block until the gpu is done with the frame that used this slot,
+    //the other frames in flight keep executing meanwhile
+    {
+        PROFILE_SCOPE("wait frame fence");
+        vkWaitForFences(_logicalDevice, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+    }
+    RecycleFrameResources();
+
+    uint32_t imageIndex = 0;
+    VkResult res;
+    {
+        PROFILE_SCOPE("acquire image");
+        res = vkAcquireNextImageKHR(_logicalDevice, _swapchain, UINT64_MAX,
+            frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    }
+    if (res == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        //nothing was signaled or submitted, the fence stays signaled for the retry
+        RecreateSwapChain();
+        return;
+    }
+    if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
+    {
+        throw std::runtime_error("failed to acquire swap chain image!!!");
+    }
+
+    //the swap chain may hand out an image that an older frame is still rendering to
+    if (_imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+    {
+        PROFILE_SCOPE("wait image fence");
+        vkWaitForFences(_logicalDevice, 1, &_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+    }
+    _imagesInFlight[imageIndex] = frame.inFlightFence;
+
+    vkResetFences(_logicalDevice, 1, &frame.inFlightFence);
+    //resetting the whole pool is cheaper than resetting single command buffers
+    vkResetCommandPool(_logicalDevice, frame.commandPool, 0);
+    RecordCommandBuffer(frame.commandBuffer, imageIndex);
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &frame.imageAvailableSemaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &_renderFinishedSemaphores[imageIndex];
+    frame.submitTime = CpuProfiler::Now();
+    {
+        PROFILE_SCOPE("submit");
+        res = vkQueueSubmit(_queueGraphics, 1, &submitInfo, frame.inFlightFence);
+    }
+    CHECK_SUCCESS(res, "failed to submit draw command buffer!!!")
+
+    VkPresentInfoKHR presentInfo{};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &_renderFinishedSemaphores[imageIndex];
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &_swapchain;
+    presentInfo.pImageIndices = &imageIndex;
+    {
+        PROFILE_SCOPE("present");
+        res = vkQueuePresentKHR(_queuePresent, &presentInfo);
+    }
+    _currentFrame = (_currentFrame + 1) % _settings.framesInFlight;
+    _frameNumber++;
+
+    if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR || _swapChainDirty)
+    {
+        _swapChainDirty = false;
+        RecreateSwapChain();
+    }
+    else if (res != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to present swap chain image!!!");
     }
 }
 
+void Renderer::DrawFrameHeadless()
+{
+    PROFILE_FUNCTION();
+    FrameData& frame = _frames[_currentFrame];
+    {
+        PROFILE_SCOPE("wait frame fence");
+        vkWaitForFences(_logicalDevice, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+    }
+    RecycleFrameResources();
+    vkResetFences(_logicalDevice, 1, &frame.inFlightFence);
+    vkResetCommandPool(_logicalDevice, frame.commandPool, 0);
+
+    //there is one offscreen target per frame in flight, so no acquire is needed
+    RecordCommandBuffer(frame.commandBuffer, _currentFrame);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
+    frame.submitTime = CpuProfiler::Now();
+    PROFILE_SCOPE("submit");
+    VkResult res = vkQueueSubmit(_queueGraphics, 1, &submitInfo, frame.inFlightFence);
+    CHECK_SUCCESS(res, "failed to submit draw command buffer!!!")
+
+    _currentFrame = (_currentFrame + 1) % _settings.framesInFlight;
+    _frameNumber++;
+}
+
+void Renderer::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    PROFILE_FUNCTION();
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkResult res = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    CHECK_SUCCESS(res, "failed to begin command buffer!!!")
+
+    //the fence of this frame was waited, so its queries from last time can be read
+    _gpuProfiler.BeginFrame(commandBuffer, _currentFrame);
+    CpuProfiler::AddGpuFrame(_gpuProfiler.GetLastFrame(), _frames[_currentFrame].submitTime);
+    {
+        GpuProfiler::Scope frameScope(_gpuProfiler, commandBuffer, "frame");
+        //changed instances go through the ring, so they are queued before it is flushed
+        if (_gpuCullingEnabled)
+            _gpuCulling.Prepare(_stagingRing, _descriptorAllocator, _viewProjection);
+        {
+            //uploads queued since the last frame land before anything in the render pass reads them
+            GpuProfiler::Scope uploadScope(_gpuProfiler, commandBuffer, "upload");
+            _stagingRing.Flush(commandBuffer, _currentFrame);
+        }
+        //update after bind, so the heap is written once and bound for the whole command buffer
+        if (_bindlessEnabled)
+        {
+            _bindlessHeap.Update();
+            _bindlessHeap.Bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+        }
+
+        //draws were submitted in any order, sorting groups them by pipeline, material and mesh
+        _drawQueue.Sort(&_threadPool);
+        _drawCount = _drawQueue.GetCount();
+
+        //barriers and layout transitions around the passes all come from the graph
+        _renderGraph.SetImage(_backbuffer, _swapchainImages[imageIndex], _imageViews[imageIndex]);
+        _recordImageIndex = imageIndex;
+        _renderGraph.Execute(commandBuffer, &_gpuProfiler);
+    }
+
+    res = vkEndCommandBuffer(commandBuffer);
+    CHECK_SUCCESS(res, "failed to record command buffer!!!")
+}
+
+void Renderer::BuildRenderGraph()
+{
+    PROFILE_FUNCTION();
+    _renderGraph.Reset();
+    //the acquire semaphore is waited at the color output stage, headless targets are left
+    //ready to be copied out instead of presented
+    _backbuffer = _renderGraph.ImportImage("backbuffer", VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        _settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        _settings.headless ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        _settings.headless ? VK_ACCESS_TRANSFER_READ_BIT : 0);
+
+    //the culling passes fill the indirect commands the main pass draws
+    if (_gpuCullingEnabled)
+        _gpuCulling.AddPasses(_renderGraph);
+
+    _renderGraph.AddPass("main",
+        [this](RenderGraph::PassBuilder& builder)
+        {
+            builder.Write(_backbuffer, RenderGraph::Access::ColorAttachment);
+            if (_gpuCullingEnabled)
+                _gpuCulling.DeclareDraws(builder);
+        },
+        [this](VkCommandBuffer commandBuffer)
+        {
+            RecordMainPass(commandBuffer);
+        });
+    _renderGraph.Compile();
+}
+
+void Renderer::RecordMainPass(VkCommandBuffer commandBuffer)
+{
+    VkClearValue clearColor{};
+    clearColor.color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+
+    VkRenderPassBeginInfo passInfo{};
+    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    passInfo.renderPass = _renderPass;
+    passInfo.framebuffer = _framebuffers[_recordImageIndex];
+    passInfo.renderArea.offset = { 0, 0 };
+    passInfo.renderArea.extent = _swapchainExtent;
+    passInfo.clearValueCount = 1;
+    passInfo.pClearValues = &clearColor;
+    //a pass takes either inline commands or secondaries, never both
+    if (_drawCount > 0)
+    {
+        vkCmdBeginRenderPass(commandBuffer, &passInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        VkCommandBufferInheritanceInfo inheritance{};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance.renderPass = _renderPass;
+        inheritance.subpass = 0;
+        inheritance.framebuffer = _framebuffers[_recordImageIndex];
+        //the statistics query of the pass scope stays active across the secondaries
+        inheritance.pipelineStatistics = _gpuProfiler.GetPipelineStatisticFlags();
+        _parallelRecorder.Record(commandBuffer, inheritance, _drawCount,
+            [this](VkCommandBuffer secondary, uint32_t begin, uint32_t end)
+            {
+                RecordDraws(secondary, begin, end);
+            });
+    }
+    else
+    {
+        vkCmdBeginRenderPass(commandBuffer, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+        //no sorted draws, the gpu driven batches are recorded inline
+        if (_gpuCullingEnabled)
+            RecordDraws(commandBuffer, 0, 0);
+    }
+    vkCmdEndRenderPass(commandBuffer);
+}
+
+void Renderer::RecordDraws(VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end)
+{
+    PROFILE_FUNCTION();
+    //secondaries inherit no state from the primary, so descriptors and dynamic state are set again
+    if (_bindlessEnabled)
+        _bindlessHeap.Bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+    VkViewport viewport{};
+    viewport.width = static_cast<float>(_swapchainExtent.width);
+    viewport.height = static_cast<float>(_swapchainExtent.height);
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    VkRect2D scissor{};
+    scissor.extent = _swapchainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    _drawQueue.Record(commandBuffer, begin, end, _bindlessEnabled ? &_bindlessHeap : nullptr);
+    //the range reaching the end also records the gpu driven batches, after the sorted draws
+    if (_gpuCullingEnabled && end == _drawCount)
+        _gpuCulling.Draw(commandBuffer, _bindlessEnabled ? &_bindlessHeap : nullptr);
+}
+
+void Renderer::RecycleFrameResources()
+{
+    PROFILE_FUNCTION();
+    //drained once a frame so the per thread rings never fill up
+    CpuProfiler::Collect();
+    //the fence of the current slot was just waited, so the frame that used it last and every
+    //frame before it have completed
+    _stagingRing.BeginFrame(_currentFrame);
+    _descriptorAllocator.BeginFrame(_currentFrame);
+    _parallelRecorder.BeginFrame(_currentFrame);
+    //the scene submits the draws of the frame about to be recorded from here on
+    _drawQueue.Clear();
+    if (_frameNumber >= _settings.framesInFlight)
+    {
+        _deletionQueue.Collect(_frameNumber - _settings.framesInFlight);
+        _bindlessHeap.Collect(_frameNumber - _settings.framesInFlight);
+    }
+    //objects released from here on may still be used by the frame about to be recorded
+    _deletionQueue.SetFrame(_frameNumber);
+    _bindlessHeap.SetFrame(_frameNumber);
+    _debugSink.SetFrame(_frameNumber);
+}
+
 void Renderer::CreateVKInstance()
 {
+    PROFILE_FUNCTION();
     //check validation layer support
     if (_enableValidationLayers)
     {
@@ -57,6 +496,8 @@ void Renderer::CreateVKInstance()
         {
             throw std::runtime_error("not support validation layer!!!");
         }
+        //has to run before vkCreateInstance, the instance reports through it as well
+        _debugSink.Create(_settings.validationPerformanceReport);
     }
 
     //fill application infomation
@@ -66,7 +507,20 @@ void Renderer::CreateVKInstance()
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "Engine Learn";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    //1.1 is needed to read device uuids and 1.2 for descriptor indexing,
+    //vkEnumerateInstanceVersion is missing on 1.0 loaders
+    auto enumerateVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(
+        nullptr, "vkEnumerateInstanceVersion");
+    uint32_t loaderVersion = VK_API_VERSION_1_0;
+    if (enumerateVersion)
+        enumerateVersion(&loaderVersion);
+    if (loaderVersion >= VK_API_VERSION_1_2)
+        _instanceApiVersion = VK_API_VERSION_1_2;
+    else if (loaderVersion >= VK_API_VERSION_1_1)
+        _instanceApiVersion = VK_API_VERSION_1_1;
+    else
+        _instanceApiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = _instanceApiVersion;
     
     // uint32_t vkExtensionCount;
     // vkEnumerateInstanceExtensionProperties(nullptr, &vkExtensionCount, nullptr);
@@ -97,7 +551,7 @@ void Renderer::CreateVKInstance()
         info.pNext = nullptr;
     }
     
-    VkResult res = vkCreateInstance(&info, nullptr, &_instance);
+    VkResult res = vkCreateInstance(&info, _hostAllocator.Get(VK_OBJECT_TYPE_INSTANCE), &_instance);
     CHECK_SUCCESS(res, "failed to create vk instance!!!")
 }
 
@@ -129,28 +583,38 @@ bool Renderer::CheckValidationLayerSupport()
 
 std::vector<const char*> Renderer::GetRequiredExtensions()
 {
-    uint32_t extensionCount = 0;
-    const char** extensions;
-    extensions = glfwGetRequiredInstanceExtensions(&extensionCount);
-    // for(int i = 0; i < extensionCount; i++)
-    // {
-    //     std::cout << extensions[i] << std::endl;
-    // }
-    std::vector<const char*> resExt(extensions, extensions + extensionCount);
+    std::vector<const char*> resExt;
+    //headless mode never initializes glfw, so it has no surface extensions to ask for
+    if (!_settings.headless)
+    {
+        uint32_t extensionCount = 0;
+        const char** extensions;
+        extensions = glfwGetRequiredInstanceExtensions(&extensionCount);
+        // for(int i = 0; i < extensionCount; i++)
+        // {
+        //     std::cout << extensions[i] << std::endl;
+        // }
+        resExt.assign(extensions, extensions + extensionCount);
+    }
     if(_enableValidationLayers)
         resExt.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     return resExt;
 }
 
+const std::vector<const char*>& Renderer::GetDeviceExtensions()
+{
+    return _settings.headless ? _headlessDeviceExtensions : _deviceExtensions;
+}
+
 void Renderer::CreateSwapChain()
 {
+    PROFILE_FUNCTION();
     SwapChain sc = QueryPhysicalDeviceSwapChainSupport(_physicalDevice);
     VkExtent2D extent = ChooseSwapChainCapbilities(sc.capabilities);
     VkSurfaceFormatKHR format = ChooseSwapChainSurfaceFormat(sc.formats);
     VkPresentModeKHR presentModel = ChooseSwapChainPresentModel(sc.presentModels);
 
-    uint32_t imageCount = sc.capabilities.minImageCount + 1;
-    imageCount = std::clamp(imageCount, sc.capabilities.minImageCount, sc.capabilities.maxImageCount);
+    uint32_t imageCount = ChooseSwapChainImageCount(sc.capabilities, presentModel);
 
     VkSwapchainCreateInfoKHR info{};
     info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -162,12 +626,13 @@ void Renderer::CreateSwapChain()
     info.imageArrayLayers = 1;
     info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
-    QueueFamilyIndices indices = QueryPhysicalDeviceQueueFamilies(_physicalDevice);
+    const QueueFamilyIndices& indices = _queueFamilies;
+    //must outlive vkCreateSwapchainKHR, info only keeps a pointer to it
+    std::vector<uint32_t> tmpIndices = { indices.graphicsFamily.value(), indices.presentFamily.value() };
     if (indices.graphicsFamily != indices.presentFamily)
     {
         info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
         info.queueFamilyIndexCount = 2;
-        std::vector<uint32_t> tmpIndices = { indices.graphicsFamily.value(), indices.presentFamily.value() };
         info.pQueueFamilyIndices = tmpIndices.data();
     }
     else
@@ -179,10 +644,16 @@ void Renderer::CreateSwapChain()
     info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     info.presentMode = presentModel;
     info.clipped = VK_TRUE;
-    info.oldSwapchain = nullptr;
+    //lets the driver recycle the images of the swap chain being replaced
+    info.oldSwapchain = _swapchain;
 
-    VkResult res = vkCreateSwapchainKHR(_logicalDevice, &info, nullptr, &_swapchain);
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    VkResult res = vkCreateSwapchainKHR(_logicalDevice, &info, _hostAllocator.Get(VK_OBJECT_TYPE_SWAPCHAIN_KHR), &swapchain);
     CHECK_SUCCESS(res, "failed to create swap chain!!!")
+    _swapchain = swapchain;
+
+    std::cout << "swap chain: " << GetPresentModelName(presentModel)
+        << ", " << imageCount << " images" << std::endl;
 
     vkGetSwapchainImagesKHR(_logicalDevice, _swapchain, &imageCount, nullptr);
     _swapchainImages.resize(imageCount);
@@ -191,6 +662,61 @@ void Renderer::CreateSwapChain()
     _swapchainExtent = extent;
 }
 
+void Renderer::RecreateSwapChain()
+{
+    PROFILE_FUNCTION();
+    //a minimized window has a zero sized framebuffer, nothing can be presented until it is restored
+    int width = 0;
+    int height = 0;
+    glfwGetFramebufferSize(_window, &width, &height);
+    while (width == 0 || height == 0)
+    {
+        if (glfwWindowShouldClose(_window))
+            return;
+        glfwWaitEvents();
+        glfwGetFramebufferSize(_window, &width, &height);
+    }
+
+    //frames in flight may still render into the old objects, so they go through the deletion
+    //queue instead of being destroyed and the device is never drained
+    VkSwapchainKHR oldSwapchain = _swapchain;
+    for (auto& framebuffer : _framebuffers)
+    {
+        _deletionQueue.Push(VK_OBJECT_TYPE_FRAMEBUFFER, framebuffer);
+    }
+    for (auto& imageView : _imageViews)
+    {
+        _deletionQueue.Push(VK_OBJECT_TYPE_IMAGE_VIEW, imageView);
+    }
+    //an earlier present may still wait on them
+    for (auto& semaphore : _renderFinishedSemaphores)
+    {
+        _deletionQueue.Push(VK_OBJECT_TYPE_SEMAPHORE, semaphore);
+    }
+    VkFormat oldFormat = _swapchainImageFormat;
+    _framebuffers.clear();
+    _swapchainImages.clear();
+    _imageViews.clear();
+
+    //the old swap chain is still alive, so its images are never handed back and every view is new
+    CreateSwapChain();
+    CreateImageViews();
+
+    //the render pass only depends on the format, which rarely changes on resize
+    if (oldFormat != _swapchainImageFormat)
+    {
+        _deletionQueue.Push(VK_OBJECT_TYPE_RENDER_PASS, _renderPass);
+        CreateRenderPass();
+    }
+    CreateFramebuffers();
+    BuildRenderGraph();
+    //the old swap chain stays alive until its last presented image is done
+    _deletionQueue.Push(VK_OBJECT_TYPE_SWAPCHAIN_KHR, oldSwapchain);
+
+    _imagesInFlight.assign(_swapchainImages.size(), VK_NULL_HANDLE);
+    CreateRenderFinishedSemaphores();
+}
+
 Renderer::SwapChain Renderer::QueryPhysicalDeviceSwapChainSupport(VkPhysicalDevice device)
 {
     SwapChain sc;
@@ -221,25 +747,90 @@ Renderer::SwapChain Renderer::QueryPhysicalDeviceSwapChainSupport(VkPhysicalDevi
 
 VkSurfaceFormatKHR Renderer::ChooseSwapChainSurfaceFormat(std::vector<VkSurfaceFormatKHR>& formats)
 {
-    for(const auto & format : formats)
+    const VkFormat preferredFormats[] = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB };
+    for (VkFormat preferred : preferredFormats)
     {
-        if(format.format == VK_FORMAT_B8G8R8A8_SRGB &&
-            format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+        for(const auto & format : formats)
         {
-            return format;
+            if(format.format == preferred &&
+                format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+            {
+                return format;
+            }
         }
     }
+    //the device is suitable only when it reports at least one format
+    return formats.front();
 }
 
 VkPresentModeKHR Renderer::ChooseSwapChainPresentModel(std::vector<VkPresentModeKHR>& presentModels)
 {
-    for(const auto& model : presentModels)
+    std::vector<VkPresentModeKHR> order;
+    switch (_settings.presentPolicy)
     {
-        if(model == VK_PRESENT_MODE_MAILBOX_KHR)
+    case PresentPolicy::LowLatency:
+        order = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+        break;
+    case PresentPolicy::Adaptive:
+        order = { VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+        break;
+    case PresentPolicy::PowerSaving:
+        break;
+    }
+
+    for (VkPresentModeKHR preferred : order)
+    {
+        for(const auto& model : presentModels)
         {
-            return model;
+            if(model == preferred)
+            {
+                return model;
+            }
         }
     }
+    //FIFO is the only mode every implementation has to support
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+uint32_t Renderer::ChooseSwapChainImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR presentModel)
+{
+    uint32_t imageCount = _settings.swapchainImageCount;
+    if (imageCount == 0)
+    {
+        //mailbox needs a spare image to replace, fifo modes buffer one extra image to absorb
+        //frame time spikes, power saving keeps the minimum so the gpu idles between vblanks
+        if (_settings.presentPolicy == PresentPolicy::PowerSaving)
+            imageCount = capabilities.minImageCount;
+        else if (presentModel == VK_PRESENT_MODE_MAILBOX_KHR)
+            imageCount = (std::max)(capabilities.minImageCount + 1, 3u);
+        else
+            imageCount = capabilities.minImageCount + 1;
+    }
+
+    imageCount = (std::max)(imageCount, capabilities.minImageCount);
+    //a max image count of zero means there is no upper limit
+    if (capabilities.maxImageCount > 0)
+        imageCount = (std::min)(imageCount, capabilities.maxImageCount);
+    return imageCount;
+}
+
+const char* Renderer::GetPresentModelName(VkPresentModeKHR presentModel)
+{
+    switch (presentModel)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "IMMEDIATE";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "MAILBOX";
+    case VK_PRESENT_MODE_FIFO_KHR: return "FIFO";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+    default: return "UNKNOWN";
+    }
+}
+
+void Renderer::SetPresentPolicy(PresentPolicy policy, uint32_t swapchainImageCount)
+{
+    _settings.presentPolicy = policy;
+    _settings.swapchainImageCount = swapchainImageCount;
+    _swapChainDirty = true;
 }
 
 VkExtent2D Renderer::ChooseSwapChainCapbilities(VkSurfaceCapabilitiesKHR capabilities)
@@ -272,13 +863,60 @@ VkExtent2D Renderer::ChooseSwapChainCapbilities(VkSurfaceCapabilitiesKHR capabil
 
 void Renderer::CreateSurface()
 {
+    PROFILE_FUNCTION();
+#ifdef _WIN32
     VkWin32SurfaceCreateInfoKHR surfaceInfo{};
     surfaceInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
     surfaceInfo.hwnd = glfwGetWin32Window(_window);
     surfaceInfo.hinstance = GetModuleHandle(nullptr);
 
-    VkResult res = vkCreateWin32SurfaceKHR(_instance, &surfaceInfo, nullptr, &_surface);
+    VkResult res = vkCreateWin32SurfaceKHR(_instance, &surfaceInfo, _hostAllocator.Get(VK_OBJECT_TYPE_SURFACE_KHR), &_surface);
     CHECK_SUCCESS(res, "failed to create win32 surface!!!")
+#else
+    VkResult res = glfwCreateWindowSurface(_instance, _window, _hostAllocator.Get(VK_OBJECT_TYPE_SURFACE_KHR), &_surface);
+    CHECK_SUCCESS(res, "failed to create window surface!!!")
+#endif
+}
+
+void Renderer::CreateOffscreenTargets()
+{
+    PROFILE_FUNCTION();
+    _swapchainImageFormat = _offscreenFormat;
+    _swapchainExtent = { _width, _height };
+    _swapchainImages.resize(_settings.framesInFlight);
+    _offscreenMemory.resize(_settings.framesInFlight);
+
+    for (size_t i = 0; i < _swapchainImages.size(); i++)
+    {
+        VkImageCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = _offscreenFormat;
+        info.extent = { _width, _height, 1 };
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        //transfer src so finished frames can be read back or copied out
+        info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        _memoryAllocator.CreateImage(info,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            0,
+            _swapchainImages[i],
+            _offscreenMemory[i]);
+    }
+}
+
+void Renderer::DestroyOffscreenTargets()
+{
+    for (size_t i = 0; i < _swapchainImages.size(); i++)
+    {
+        _memoryAllocator.DestroyImage(_swapchainImages[i], _offscreenMemory[i]);
+    }
+    _swapchainImages.clear();
+    _offscreenMemory.clear();
 }
 
 void Renderer::SetDebugCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& info)
@@ -292,20 +930,8 @@ void Renderer::SetDebugCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& info)
     info.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
             VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
             VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-    info.pfnUserCallback = (PFN_vkDebugUtilsMessengerCallbackEXT)DebugCallback;
-    info.pUserData = nullptr;
-}
-
-VkBool32 Renderer::DebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-                                 VkDebugUtilsMessageTypeFlagBitsEXT messageType,
-                                 const VkDebugUtilsMessengerCallbackDataEXT* callbackData,
-                                 void* userData)
-{
-    if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
-    {
-        std::cout << callbackData->pMessage << std::endl;
-    }
-    return VK_FALSE;
+    info.pfnUserCallback = DebugMessageSink::Callback;
+    info.pUserData = &_debugSink;
 }
 
 VkResult Renderer::CreateDebugUtilsMessengerEXT(VkInstance instance, 
@@ -336,6 +962,7 @@ void Renderer::DestoryDebugUtilsMessengerEXT(VkInstance instance,
 
 void Renderer::PickPhysicalDevice()
 {
+    PROFILE_FUNCTION();
     uint32_t physicalDeviceCount = 0;
     vkEnumeratePhysicalDevices(_instance, &physicalDeviceCount, nullptr);
     if (physicalDeviceCount == 0)
@@ -344,12 +971,39 @@ void Renderer::PickPhysicalDevice()
     }
     std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
     vkEnumeratePhysicalDevices(_instance, &physicalDeviceCount, physicalDevices.data());
+
+    std::string filter = GetEnvironmentValue("VULKAN_LEARN_DEVICE");
+    if (filter.empty())
+        filter = _settings.preferredDevice;
+
+    //every device is rated and logged before one is picked, so the log lists all of them
+    int64_t bestScore = -1;
+    std::string bestReason;
+    VkPhysicalDevice overrideDevice = VK_NULL_HANDLE;
     for (auto& physical : physicalDevices)
     {
-        if (IsPhysicalDeviceSuitable(physical))
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physical, &properties);
+        if (!IsPhysicalDeviceSuitable(physical))
+        {
+            std::cout << "device " << properties.deviceName << ": not suitable" << std::endl;
+            continue;
+        }
+
+        std::string reasons;
+        int64_t score = RatePhysicalDevice(physical, reasons);
+        std::cout << "device " << properties.deviceName << ": score " << score
+            << " (" << reasons << ")" << std::endl;
+
+        if (!filter.empty() && overrideDevice == VK_NULL_HANDLE && MatchPhysicalDevice(physical, filter))
         {
+            overrideDevice = physical;
+        }
+        if (score > bestScore)
+        {
+            bestScore = score;
             _physicalDevice = physical;
-            break;
+            bestReason = "highest score " + std::to_string(score);
         }
     }
 
@@ -357,11 +1011,133 @@ void Renderer::PickPhysicalDevice()
     {
         throw std::runtime_error("no suitable physical device!!!");
     }
+
+    if (overrideDevice != VK_NULL_HANDLE)
+    {
+        //an explicit override beats any score
+        _physicalDevice = overrideDevice;
+        bestReason = "matches override \"" + filter + "\"";
+    }
+    else if (!filter.empty())
+    {
+        std::cout << "no suitable device matches override \"" << filter << "\", using the best scored device" << std::endl;
+    }
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+    std::cout << "selected device " << properties.deviceName << " [" << GetPhysicalDeviceUUID(_physicalDevice)
+        << "]: " << bestReason << std::endl;
+}
+
+int64_t Renderer::RatePhysicalDevice(VkPhysicalDevice device, std::string& reasons)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+    QueueFamilyIndices indices = QueryPhysicalDeviceQueueFamilies(device);
+
+    std::ostringstream log;
+    int64_t score = 0;
+
+    //the device type dominates, a software rasterizer must never win over real hardware
+    int64_t typeScore = 0;
+    switch (properties.deviceType)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: typeScore = 100000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: typeScore = 50000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: typeScore = 20000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: typeScore = 0; break;
+    default: typeScore = 10000; break;
+    }
+    score += typeScore;
+    log << GetDeviceTypeName(properties.deviceType) << " +" << typeScore;
+
+    VkDeviceSize localHeapSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            localHeapSize = (std::max)(localHeapSize, memoryProperties.memoryHeaps[i].size);
+    }
+    int64_t heapScore = static_cast<int64_t>(localHeapSize >> 20) / 64;
+    score += heapScore;
+    log << ", " << (localHeapSize >> 20) << " MiB local heap +" << heapScore;
+
+    if (indices.transferFamily.has_value())
+    {
+        score += 500;
+        log << ", transfer queue +500";
+    }
+    if (indices.computeFamily.has_value())
+    {
+        score += 500;
+        log << ", async compute queue +500";
+    }
+
+    if (_settings.bindless && CheckDescriptorIndexingSupport(device))
+    {
+        score += 1000;
+        log << ", descriptor indexing +1000";
+    }
+
+    int64_t limitScore = properties.limits.maxImageDimension2D / 1024;
+    score += limitScore;
+    log << ", max image " << properties.limits.maxImageDimension2D << " +" << limitScore;
+
+    reasons = log.str();
+    return score;
+}
+
+bool Renderer::MatchPhysicalDevice(VkPhysicalDevice device, const std::string& filter)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    std::string lowerFilter = ToLower(filter);
+    if (ToLower(properties.deviceName).find(lowerFilter) != std::string::npos)
+        return true;
+
+    //uuids compare without dashes so both the plain and the canonical form work
+    std::string uuid = GetPhysicalDeviceUUID(device);
+    lowerFilter.erase(std::remove(lowerFilter.begin(), lowerFilter.end(), '-'), lowerFilter.end());
+    uuid.erase(std::remove(uuid.begin(), uuid.end(), '-'), uuid.end());
+    return !uuid.empty() && uuid == lowerFilter;
+}
+
+std::string Renderer::GetPhysicalDeviceUUID(VkPhysicalDevice device)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    if (_instanceApiVersion < VK_API_VERSION_1_1 || properties.apiVersion < VK_API_VERSION_1_1)
+        return std::string();
+
+    auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2)vkGetInstanceProcAddr(
+        _instance, "vkGetPhysicalDeviceProperties2");
+    if (!getProperties2)
+        return std::string();
+
+    VkPhysicalDeviceIDProperties idProperties{};
+    idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &idProperties;
+    getProperties2(device, &properties2);
+
+    std::ostringstream uuid;
+    uuid << std::hex << std::setfill('0');
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+    {
+        if (i == 4 || i == 6 || i == 8 || i == 10)
+            uuid << '-';
+        uuid << std::setw(2) << static_cast<uint32_t>(idProperties.deviceUUID[i]);
+    }
+    return uuid.str();
 }
 
 bool Renderer::IsPhysicalDeviceSuitable(VkPhysicalDevice device)
 {
     QueueFamilyIndices indices = QueryPhysicalDeviceQueueFamilies(device);
+    //without a surface there is no swap chain support to check
+    if (_settings.headless)
+        return indices.IsComplete();
     bool support = CheckPhysicalExtensionsSupport(device);
     if (support)
     {
@@ -372,13 +1148,55 @@ bool Renderer::IsPhysicalDeviceSuitable(VkPhysicalDevice device)
     return false;
 }
 
+bool Renderer::CheckDescriptorIndexingSupport(VkPhysicalDevice device)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    if (_instanceApiVersion < VK_API_VERSION_1_2 || properties.apiVersion < VK_API_VERSION_1_2)
+        return false;
+
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &features12;
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    //everything BindlessHeap relies on, non uniform indexing lets a draw pick its texture per invocation
+    return features12.descriptorIndexing &&
+        features12.runtimeDescriptorArray &&
+        features12.descriptorBindingPartiallyBound &&
+        features12.descriptorBindingUpdateUnusedWhilePending &&
+        features12.descriptorBindingSampledImageUpdateAfterBind &&
+        features12.descriptorBindingStorageBufferUpdateAfterBind &&
+        features12.shaderSampledImageArrayNonUniformIndexing;
+}
+
+bool Renderer::CheckIndirectCountSupport(VkPhysicalDevice device)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    if (_instanceApiVersion < VK_API_VERSION_1_2 || properties.apiVersion < VK_API_VERSION_1_2)
+        return false;
+
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &features12;
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    //a batch is drawn with one call whose draw count the culling pass wrote, and every command
+    //hands its object index to the vertex shader through firstInstance
+    return features.features.multiDrawIndirect && features.features.drawIndirectFirstInstance &&
+        features12.drawIndirectCount;
+}
+
 bool Renderer::CheckPhysicalExtensionsSupport(VkPhysicalDevice device)
 {
     uint32_t extensionCount = 0;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
     std::vector<VkExtensionProperties> extensionProperties(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensionProperties.data());
-    for(auto extension : _deviceExtensions)
+    for(auto extension : GetDeviceExtensions())
     {
         bool res = false;
         for(auto property : extensionProperties)
@@ -406,41 +1224,63 @@ Renderer::QueueFamilyIndices Renderer::QueryPhysicalDeviceQueueFamilies(VkPhysic
     vkGetPhysicalDeviceQueueFamilyProperties(device,
         &queueFamilyCount, 
         queueFamilyProperties.data());
-    for (int i = 0; i < queueFamilyProperties.size(); i++)
+    for (uint32_t i = 0; i < queueFamilyCount; i++)
     {
         VkQueueFamilyProperties properties = queueFamilyProperties.at(i);
-        if (properties.queueFlags & VK_QUEUE_GRAPHICS_BIT)
-        {
+        bool graphics = (properties.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        bool compute = (properties.queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+        //graphics and compute queues implicitly support transfer
+        bool transfer = (properties.queueFlags & VK_QUEUE_TRANSFER_BIT) != 0 || graphics || compute;
+
+        if (graphics && !indices.graphicsFamily.has_value())
             indices.graphicsFamily = i;
-            if(indices.presentFamily.has_value())
-                break;
-        }
+
+        //usually backed by the copy engine, uploads there do not compete with rendering
+        if (transfer && !graphics && !compute && !indices.transferFamily.has_value())
+            indices.transferFamily = i;
+
+        if (compute && !graphics && !indices.computeFamily.has_value())
+            indices.computeFamily = i;
+
+        //headless frames never leave the graphics queue
+        if (_settings.headless)
+            continue;
 
         VkBool32 presentSupport = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _surface, &presentSupport);
-        if(presentSupport)
+        //prefer presenting from the graphics family to avoid a queue ownership transfer
+        if(presentSupport && (!indices.presentFamily.has_value() ||
+            (graphics && indices.graphicsFamily == static_cast<uint32_t>(i))))
         {
             indices.presentFamily = i;
-            if(indices.graphicsFamily.has_value())
-                break;
         }
     }
+
+    if (_settings.headless)
+        indices.presentFamily = indices.graphicsFamily;
     return indices;
 }
 
 void Renderer::CreateLogicalDevice()
 {
+    PROFILE_FUNCTION();
     QueueFamilyIndices indices = QueryPhysicalDeviceQueueFamilies(_physicalDevice);
+    //families without a dedicated queue share the graphics queue
+    uint32_t transferFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+    uint32_t computeFamily = indices.computeFamily.value_or(indices.graphicsFamily.value());
     std::set<uint32_t> queueIndices = { indices.graphicsFamily.value(),
-                                        indices.presentFamily.value()};
+                                        indices.presentFamily.value(),
+                                        transferFamily,
+                                        computeFamily };
+    //must outlive vkCreateDevice, the create infos only keep a pointer to it
+    const float priority = 1.0f;
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfoList;
     for(const unsigned int& indice : queueIndices)
     {
         VkDeviceQueueCreateInfo queueInfo{};
         queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueInfo.queueCount = 1;
-        queueInfo.queueFamilyIndex = indices.graphicsFamily.value();
-        float priority = 1.0f;
+        queueInfo.queueFamilyIndex = indice;
         queueInfo.pQueuePriorities = &priority;
         queueCreateInfoList.push_back(queueInfo);
     }
@@ -450,12 +1290,45 @@ void Renderer::CreateLogicalDevice()
     info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO; 
     info.pQueueCreateInfos = queueCreateInfoList.data();
     info.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfoList.size());
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(_physicalDevice, &supportedFeatures);
     VkPhysicalDeviceFeatures deviceFeature{};
+    //passes recorded into secondaries are counted by a query of the primary, which needs inheritedQueries
+    _pipelineStatisticsEnabled = _settings.pipelineStatistics && supportedFeatures.pipelineStatisticsQuery &&
+        supportedFeatures.inheritedQueries;
+    if (_settings.pipelineStatistics && !_pipelineStatisticsEnabled)
+        std::cout << "pipeline statistics queries are not supported" << std::endl;
+    deviceFeature.pipelineStatisticsQuery = _pipelineStatisticsEnabled ? VK_TRUE : VK_FALSE;
+    deviceFeature.inheritedQueries = _pipelineStatisticsEnabled ? VK_TRUE : VK_FALSE;
+    _gpuCullingEnabled = _settings.gpuCulling && CheckIndirectCountSupport(_physicalDevice);
+    if (_settings.gpuCulling && !_gpuCullingEnabled)
+        std::cout << "indirect count draws are not supported, gpu culling disabled" << std::endl;
+    deviceFeature.multiDrawIndirect = _gpuCullingEnabled ? VK_TRUE : VK_FALSE;
+    deviceFeature.drawIndirectFirstInstance = _gpuCullingEnabled ? VK_TRUE : VK_FALSE;
     info.pEnabledFeatures = &deviceFeature;
-    info.enabledExtensionCount = static_cast<uint32_t>(_deviceExtensions.size());
-    info.ppEnabledExtensionNames = _deviceExtensions.data();
+    _bindlessEnabled = _settings.bindless && CheckDescriptorIndexingSupport(_physicalDevice);
+    if (_settings.bindless && !_bindlessEnabled)
+        std::cout << "descriptor indexing is not supported, bindless disabled" << std::endl;
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    if (_bindlessEnabled)
+    {
+        features12.descriptorIndexing = VK_TRUE;
+        features12.runtimeDescriptorArray = VK_TRUE;
+        features12.descriptorBindingPartiallyBound = VK_TRUE;
+        features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        features12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    }
+    features12.drawIndirectCount = _gpuCullingEnabled ? VK_TRUE : VK_FALSE;
+    if (_bindlessEnabled || _gpuCullingEnabled)
+        info.pNext = &features12;
+    const std::vector<const char*>& deviceExtensions = GetDeviceExtensions();
+    info.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+    info.ppEnabledExtensionNames = deviceExtensions.data();
 
-    VkResult res = vkCreateDevice(_physicalDevice, &info, nullptr, &_logicalDevice);
+    VkResult res = vkCreateDevice(_physicalDevice, &info, _hostAllocator.Get(VK_OBJECT_TYPE_DEVICE), &_logicalDevice);
     CHECK_SUCCESS(res, "can't to create logical device!!!");
 
 
@@ -468,14 +1341,43 @@ void Renderer::CreateLogicalDevice()
         indices.presentFamily.value(),
         0,
         &_queuePresent);
+
+    vkGetDeviceQueue(_logicalDevice,
+        transferFamily,
+        0,
+        &_queueTransfer);
+
+    vkGetDeviceQueue(_logicalDevice,
+        computeFamily,
+        0,
+        &_queueCompute);
+
+    _queueFamilies = indices;
+    std::cout << "queue families: graphics " << indices.graphicsFamily.value()
+        << ", present " << indices.presentFamily.value()
+        << ", transfer " << transferFamily << (indices.transferFamily ? " (dedicated)" : "")
+        << ", compute " << computeFamily << (indices.computeFamily ? " (dedicated)" : "")
+        << std::endl;
+
+    _memoryAllocator.Create(_physicalDevice, _logicalDevice, _instanceApiVersion, &_hostAllocator);
+    _deletionQueue.Create(_logicalDevice, &_memoryAllocator, &_hostAllocator);
+    _descriptorLayoutCache.Create(_logicalDevice, &_hostAllocator);
+    _renderGraph.Create(_logicalDevice, &_memoryAllocator, &_deletionQueue, &_hostAllocator);
+    if (_bindlessEnabled)
+    {
+        _bindlessHeap.Create(_physicalDevice, _logicalDevice, &_hostAllocator,
+            _settings.bindlessTextureCapacity, _settings.bindlessBufferCapacity);
+    }
 }
 
 
 
 void Renderer::Run()
 {
-    InitWindow();
-    CheckValidationLayerSupport();
+    CpuProfiler::SetEnabled(_settings.cpuProfiler);
+    CpuProfiler::SetThreadName("main");
+    if (!_settings.headless)
+        InitWindow();
     InitVulkan();
     MainLoop();
     Cleanup();
@@ -483,53 +1385,255 @@ void Renderer::Run()
 
 void Renderer::Cleanup()
 {
+    if (!_settings.tracePath.empty())
+        CpuProfiler::WriteChromeTrace(_settings.tracePath);
+    _hostAllocator.PrintStatistics(std::cout);
+    DestroyFrameResources();
+    _renderGraph.Destroy();
+    _deletionQueue.Flush();
+    _descriptorLayoutCache.Destroy();
+    _bindlessHeap.Destroy();
+    _gpuCulling.Destroy();
+    _drawQueue.Destroy();
+    _pipelineManager.Destroy();
+    _shaderCache.Destroy();
+    _pipelineCache.Save();
+    _pipelineCache.Destroy();
+    for (auto& framebuffer : _framebuffers)
+    {
+        vkDestroyFramebuffer(_logicalDevice, framebuffer, _hostAllocator.Get(VK_OBJECT_TYPE_FRAMEBUFFER));
+    }
+    vkDestroyRenderPass(_logicalDevice, _renderPass, _hostAllocator.Get(VK_OBJECT_TYPE_RENDER_PASS));
     for (auto& imageView : _imageViews)
     {
-        vkDestroyImageView(_logicalDevice, imageView, nullptr);
+        vkDestroyImageView(_logicalDevice, imageView, _hostAllocator.Get(VK_OBJECT_TYPE_IMAGE_VIEW));
+    }
+    if (_settings.headless)
+    {
+        DestroyOffscreenTargets();
     }
-    vkDestroySwapchainKHR(_logicalDevice, _swapchain, nullptr);
-    vkDestroySurfaceKHR(_instance, _surface, nullptr);
-    vkDestroyDevice(_logicalDevice, nullptr);
+    else
+    {
+        vkDestroySwapchainKHR(_logicalDevice, _swapchain, _hostAllocator.Get(VK_OBJECT_TYPE_SWAPCHAIN_KHR));
+        vkDestroySurfaceKHR(_instance, _surface, _hostAllocator.Get(VK_OBJECT_TYPE_SURFACE_KHR));
+    }
+    _memoryAllocator.PrintStatistics(std::cout);
+    _memoryAllocator.Destroy();
+    vkDestroyDevice(_logicalDevice, _hostAllocator.Get(VK_OBJECT_TYPE_DEVICE));
+    //flushed while the messenger still points at it, later messages are printed right away
+    _debugSink.Destroy();
     if(_enableValidationLayers)
-        DestoryDebugUtilsMessengerEXT(_instance, nullptr);
-    vkDestroyInstance(_instance, nullptr);
-    glfwDestroyWindow(_window);
-    glfwTerminate();
+        DestoryDebugUtilsMessengerEXT(_instance, _hostAllocator.Get(VK_OBJECT_TYPE_DEBUG_UTILS_MESSENGER_EXT));
+    vkDestroyInstance(_instance, _hostAllocator.Get(VK_OBJECT_TYPE_INSTANCE));
+    _hostAllocator.Destroy();
+    _threadPool.Destroy();
+    if (!_settings.headless)
+    {
+        glfwDestroyWindow(_window);
+        glfwTerminate();
+    }
 }
 
 void Renderer::CreateValidationLayer()
 {
     VkDebugUtilsMessengerCreateInfoEXT info{};
     SetDebugCreateInfo(info);
-    VkResult res = CreateDebugUtilsMessengerEXT(_instance, &info, nullptr);
+    VkResult res = CreateDebugUtilsMessengerEXT(_instance, &info, _hostAllocator.Get(VK_OBJECT_TYPE_DEBUG_UTILS_MESSENGER_EXT));
     CHECK_SUCCESS(res, "failed to create debug messenger!!!")
 }
 
 void Renderer::CreateImageViews()
 {
     _imageViews.resize(_swapchainImages.size());
-    for (int i = 0; i < _swapchainImages.size(); i++)
-    {
-        VkImageViewCreateInfo info{};
-        info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        info.image = _swapchainImages[i];
-        info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        info.format = _swapchainImageFormat;
-        info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-        info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-        info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-        info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-        info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        info.subresourceRange.baseMipLevel = 0;
-        info.subresourceRange.levelCount = 1;
-        info.subresourceRange.baseArrayLayer = 0;
-        info.subresourceRange.layerCount = 1;
-        VkResult res = vkCreateImageView(_logicalDevice, &info, nullptr, &_imageViews[i]);
-        CHECK_SUCCESS(res, "failed to create image view!!!")
+    for (size_t i = 0; i < _swapchainImages.size(); i++)
+    {
+        _imageViews[i] = CreateImageView(_swapchainImages[i], _swapchainImageFormat);
     }
 }
 
+VkImageView Renderer::CreateImageView(VkImage image, VkFormat format)
+{
+    VkImageViewCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    info.image = image;
+    info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    info.format = format;
+    info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    info.subresourceRange.baseMipLevel = 0;
+    info.subresourceRange.levelCount = 1;
+    info.subresourceRange.baseArrayLayer = 0;
+    info.subresourceRange.layerCount = 1;
+    VkImageView imageView = VK_NULL_HANDLE;
+    VkResult res = vkCreateImageView(_logicalDevice, &info, _hostAllocator.Get(VK_OBJECT_TYPE_IMAGE_VIEW), &imageView);
+    CHECK_SUCCESS(res, "failed to create image view!!!")
+    return imageView;
+}
+
 void Renderer::CreateGeaphicsPipline()
 {
+    PROFILE_FUNCTION();
+    //every pipeline created below goes through the cache so a warm start skips compilation
+    _pipelineCache.Create(_physicalDevice, _logicalDevice, _settings.pipelineCachePath, &_hostAllocator);
+    //and every shader stage comes from the module cache, shared by all pipelines
+    _shaderCache.Create(_logicalDevice, &_hostAllocator);
+    uint32_t compileThreads = _settings.pipelineCompileThreads;
+    if (compileThreads == 0)
+        compileThreads = (std::max)(std::thread::hardware_concurrency() / 4, 1u);
+    //pipelines are requested through the manager, which shares identical states and compiles
+    //new ones in the background
+    _pipelineManager.Create(_logicalDevice, &_hostAllocator, &_pipelineCache, &_shaderCache, compileThreads);
+    _drawQueue.Create(&_pipelineManager);
+    if (_gpuCullingEnabled)
+    {
+        _gpuCulling.Create(_logicalDevice, &_hostAllocator, &_memoryAllocator, &_descriptorLayoutCache,
+            &_shaderCache, &_pipelineCache, &_pipelineManager, &_threadPool, _settings.shaderDirectory,
+            _settings.gpuCullingInstanceCapacity, _settings.gpuCullingMeshCapacity,
+            _settings.gpuCullingCommandCapacity);
+    }
+}
+
+void Renderer::CreateRenderPass()
+{
+    PROFILE_FUNCTION();
+    VkAttachmentDescription colorAttachment{};
+    colorAttachment.format = _swapchainImageFormat;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    //the render graph transitions the attachment before and after the pass
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorReference{};
+    colorReference.attachment = 0;
+    colorReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+
+    VkRenderPassCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    info.attachmentCount = 1;
+    info.pAttachments = &colorAttachment;
+    info.subpassCount = 1;
+    info.pSubpasses = &subpass;
+
+    VkResult res = vkCreateRenderPass(_logicalDevice, &info, _hostAllocator.Get(VK_OBJECT_TYPE_RENDER_PASS), &_renderPass);
+    CHECK_SUCCESS(res, "failed to create render pass!!!")
+}
+
+void Renderer::CreateFramebuffers()
+{
+    PROFILE_FUNCTION();
+    _framebuffers.resize(_imageViews.size());
+    for (size_t i = 0; i < _imageViews.size(); i++)
+    {
+        VkFramebufferCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        info.renderPass = _renderPass;
+        info.attachmentCount = 1;
+        info.pAttachments = &_imageViews[i];
+        info.width = _swapchainExtent.width;
+        info.height = _swapchainExtent.height;
+        info.layers = 1;
+        VkResult res = vkCreateFramebuffer(_logicalDevice, &info, _hostAllocator.Get(VK_OBJECT_TYPE_FRAMEBUFFER), &_framebuffers[i]);
+        CHECK_SUCCESS(res, "failed to create framebuffer!!!")
+    }
+}
+
+void Renderer::CreateFrameResources()
+{
+    PROFILE_FUNCTION();
+    const QueueFamilyIndices& indices = _queueFamilies;
+
+    _frames.resize(_settings.framesInFlight);
+    for (auto& frame : _frames)
+    {
+        //one transient pool per frame, reset as a whole once the frame fence is signaled
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
+        VkResult res = vkCreateCommandPool(_logicalDevice, &poolInfo, _hostAllocator.Get(VK_OBJECT_TYPE_COMMAND_POOL), &frame.commandPool);
+        CHECK_SUCCESS(res, "failed to create command pool!!!")
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        res = vkAllocateCommandBuffers(_logicalDevice, &allocInfo, &frame.commandBuffer);
+        CHECK_SUCCESS(res, "failed to allocate command buffer!!!")
 
-}
\ No newline at end of file
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        res = vkCreateSemaphore(_logicalDevice, &semaphoreInfo, _hostAllocator.Get(VK_OBJECT_TYPE_SEMAPHORE),
+            &frame.imageAvailableSemaphore);
+        CHECK_SUCCESS(res, "failed to create semaphore!!!")
+
+        //created signaled so the first wait of every frame slot returns immediately
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        res = vkCreateFence(_logicalDevice, &fenceInfo, _hostAllocator.Get(VK_OBJECT_TYPE_FENCE), &frame.inFlightFence);
+        CHECK_SUCCESS(res, "failed to create fence!!!")
+    }
+
+    _imagesInFlight.assign(_swapchainImages.size(), VK_NULL_HANDLE);
+    CreateRenderFinishedSemaphores();
+    _currentFrame = 0;
+
+    _stagingRing.Create(&_memoryAllocator, _settings.stagingRingSize, _settings.framesInFlight);
+    _descriptorAllocator.Create(_logicalDevice, &_hostAllocator, _settings.framesInFlight);
+    _parallelRecorder.Create(_logicalDevice, &_hostAllocator, &_threadPool,
+        indices.graphicsFamily.value(), _settings.framesInFlight);
+    if (_settings.gpuProfiler)
+    {
+        _gpuProfiler.Create(_physicalDevice, _logicalDevice, &_hostAllocator, indices.graphicsFamily.value(),
+            _settings.framesInFlight, _pipelineStatisticsEnabled);
+    }
+}
+
+void Renderer::CreateRenderFinishedSemaphores()
+{
+    //the old ones were handed to the deletion queue or destroyed by the caller
+    _renderFinishedSemaphores.assign(_swapchainImages.size(), VK_NULL_HANDLE);
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (auto& semaphore : _renderFinishedSemaphores)
+    {
+        VkResult res = vkCreateSemaphore(_logicalDevice, &semaphoreInfo,
+            _hostAllocator.Get(VK_OBJECT_TYPE_SEMAPHORE), &semaphore);
+        CHECK_SUCCESS(res, "failed to create semaphore!!!")
+    }
+}
+
+void Renderer::DestroyFrameResources()
+{
+    for (auto& frame : _frames)
+    {
+        vkDestroyFence(_logicalDevice, frame.inFlightFence, _hostAllocator.Get(VK_OBJECT_TYPE_FENCE));
+        vkDestroySemaphore(_logicalDevice, frame.imageAvailableSemaphore, _hostAllocator.Get(VK_OBJECT_TYPE_SEMAPHORE));
+        //command buffers are freed together with their pool
+        vkDestroyCommandPool(_logicalDevice, frame.commandPool, _hostAllocator.Get(VK_OBJECT_TYPE_COMMAND_POOL));
+    }
+    for (auto& semaphore : _renderFinishedSemaphores)
+    {
+        vkDestroySemaphore(_logicalDevice, semaphore, _hostAllocator.Get(VK_OBJECT_TYPE_SEMAPHORE));
+    }
+    _renderFinishedSemaphores.clear();
+    _frames.clear();
+    _imagesInFlight.clear();
+    _stagingRing.Destroy();
+    _descriptorAllocator.Destroy();
+    _parallelRecorder.Destroy();
+    _gpuProfiler.Destroy();
+}
@@ -1,10 +1,14 @@
 #pragma once
 
+#ifdef _WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#ifdef _WIN32
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3native.h>
+#endif
 
 #include <vulkan/vulkan.h>
 #include <iostream>
@@ -12,6 +16,27 @@
 #include <cstdlib>
 #include <vector>
 #include <optional>
+#include <string>
+#include <cstring>
+#include <functional>
+
+#include "HostAllocator.h"
+#include "PipelineCache.h"
+#include "ShaderCache.h"
+#include "PipelineManager.h"
+#include "DrawQueue.h"
+#include "GpuCulling.h"
+#include "MemoryAllocator.h"
+#include "StagingRing.h"
+#include "DeletionQueue.h"
+#include "DescriptorAllocator.h"
+#include "BindlessHeap.h"
+#include "ThreadPool.h"
+#include "ParallelRecorder.h"
+#include "RenderGraph.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
+#include "DebugMessageSink.h"
 
 
 class Renderer
@@ -21,6 +46,9 @@ public:
     {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        //families without graphics support, these queues run alongside the graphics queue
+        std::optional<uint32_t> transferFamily;
+        std::optional<uint32_t> computeFamily;
         bool IsComplete()
         {
             return graphicsFamily.has_value() && presentFamily.has_value();
@@ -33,15 +61,117 @@ public:
         std::vector<VkSurfaceFormatKHR> formats;
         std::vector<VkPresentModeKHR> presentModels;
     };
+
+    //how the swap chain trades input latency against frame pacing and power
+    enum class PresentPolicy
+    {
+        //MAILBOX, then IMMEDIATE, then FIFO
+        LowLatency,
+        //FIFO only, fewest images
+        PowerSaving,
+        //FIFO_RELAXED, then FIFO, tears instead of stalling when a frame is late
+        Adaptive,
+    };
+
+    struct Settings
+    {
+        //number of frames the cpu may record ahead of the gpu
+        uint32_t framesInFlight = 2;
+        //render into device local offscreen images without glfw, a window or a surface
+        bool headless = false;
+        //frames rendered before a headless run returns
+        uint32_t headlessFrameCount = 100;
+        //pipeline cache blob relative to the working directory, an empty path disables persisting it
+        std::string pipelineCachePath = "pipeline_cache.bin";
+        PresentPolicy presentPolicy = PresentPolicy::LowLatency;
+        //swap chain image count, 0 lets the present policy decide
+        uint32_t swapchainImageCount = 0;
+        //force a physical device by name substring or uuid, the VULKAN_LEARN_DEVICE
+        //environment variable takes precedence
+        std::string preferredDevice;
+        //host visible ring every upload goes through, shared by all frames in flight
+        VkDeviceSize stagingRingSize = 32ull << 20;
+        //route driver host allocations through HostAllocator to track them per object type
+        bool hostAllocator = true;
+        //one update after bind descriptor set indexed from push constants, needs descriptor
+        //indexing and falls back to per frame descriptor sets without it
+        bool bindless = false;
+        uint32_t bindlessTextureCapacity = 4096;
+        uint32_t bindlessBufferCapacity = 4096;
+        //background threads compiling pipelines, 0 uses a quarter of the hardware threads
+        uint32_t pipelineCompileThreads = 0;
+        //worker threads recording draws into secondary command buffers, 0 uses one per spare hardware thread
+        uint32_t recordThreads = 0;
+        //timestamp queries around every render graph pass
+        bool gpuProfiler = true;
+        //also count vertices, primitives and shader invocations per pass, needs pipelineStatisticsQuery
+        //and inheritedQueries
+        bool pipelineStatistics = false;
+        //cpu zones recorded into per thread rings, cheap enough to leave on
+        bool cpuProfiler = true;
+        //chrome trace of the cpu zones and gpu scopes written at shutdown, empty writes none
+        std::string tracePath;
+        //group validation performance warnings per frame and print them at shutdown
+        bool validationPerformanceReport = false;
+        //cull instances in a compute pass and draw the survivors with indirect count draws,
+        //needs multiDrawIndirect and drawIndirectCount
+        bool gpuCulling = false;
+        uint32_t gpuCullingInstanceCapacity = 1u << 20;
+        uint32_t gpuCullingMeshCapacity = 4096;
+        uint32_t gpuCullingCommandCapacity = 1u << 20;
+        //compiled SPIR-V, relative to the working directory
+        std::string shaderDirectory = "Shaders/";
+    };
+
+    //every resource the cpu touches while recording a frame is duplicated per frame in flight
+    struct FrameData
+    {
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
+        VkFence inFlightFence = VK_NULL_HANDLE;
+        //cpu time of the last submit, anchors the gpu scopes of the frame in the trace
+        uint64_t submitTime = 0;
+    };
+
+    Renderer() = default;
+    explicit Renderer(const Settings& settings);
+
     void Run();
+    //takes effect at the next frame by recreating the swap chain
+    void SetPresentPolicy(PresentPolicy policy, uint32_t swapchainImageCount = 0);
 private:
     void InitVulkan();
+    //runs one init step and records how long it took for the startup report
+    void TimeInitStage(const char* name, const std::function<void()>& stage);
     void InitWindow();
     void Cleanup();
     void MainLoop();
     void CreateImageViews();
+    VkImageView CreateImageView(VkImage image, VkFormat format);
+
+    //render pass
+    void CreateRenderPass();
+    void CreateFramebuffers();
+
+    //render graph
+    void BuildRenderGraph();
+    void RecordMainPass(VkCommandBuffer commandBuffer);
+
+    //frames in flight
+    void CreateFrameResources();
+    void DestroyFrameResources();
+    //one render finished semaphore per swap chain image, recreated with the swap chain
+    void CreateRenderFinishedSemaphores();
+    void DrawFrame();
+    void DrawFrameHeadless();
+    void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void RecycleFrameResources();
+    //called concurrently from the recording threads, each with its own secondary command buffer
+    void RecordDraws(VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end);
 
     std::vector<const char*> GetRequiredExtensions();
+    const std::vector<const char*>& GetDeviceExtensions();
 
     //graphics pipline
     void CreateGeaphicsPipline();
@@ -53,11 +183,6 @@ private:
     bool CheckValidationLayerSupport();
     void CreateValidationLayer();
     void SetDebugCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& info);
-    static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
-        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-        VkDebugUtilsMessageTypeFlagBitsEXT messageType,
-        const VkDebugUtilsMessengerCallbackDataEXT* callbackData,
-        void* userData);
     VkResult CreateDebugUtilsMessengerEXT(VkInstance instance,
         const VkDebugUtilsMessengerCreateInfoEXT* info,
         const VkAllocationCallbacks* allocator);
@@ -66,13 +191,22 @@ private:
 
     //swap chain
     void CreateSwapChain();
+    void RecreateSwapChain();
+    static void FramebufferResizeCallback(GLFWwindow* window, int width, int height);
+    static void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
     SwapChain QueryPhysicalDeviceSwapChainSupport(VkPhysicalDevice device);
     VkSurfaceFormatKHR ChooseSwapChainSurfaceFormat(std::vector<VkSurfaceFormatKHR>& formats);
     VkPresentModeKHR ChooseSwapChainPresentModel(std::vector<VkPresentModeKHR>& presentModels);
+    uint32_t ChooseSwapChainImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR presentModel);
+    static const char* GetPresentModelName(VkPresentModeKHR presentModel);
     VkExtent2D ChooseSwapChainCapbilities(VkSurfaceCapabilitiesKHR capabilities);
 
     //surface
     void CreateSurface();
+
+    //headless
+    void CreateOffscreenTargets();
+    void DestroyOffscreenTargets();
     
     //logical device
     void CreateLogicalDevice();
@@ -80,19 +214,30 @@ private:
     //physical deveic
     void PickPhysicalDevice();
     bool IsPhysicalDeviceSuitable(VkPhysicalDevice device);
+    int64_t RatePhysicalDevice(VkPhysicalDevice device, std::string& reasons);
+    bool MatchPhysicalDevice(VkPhysicalDevice device, const std::string& filter);
+    std::string GetPhysicalDeviceUUID(VkPhysicalDevice device);
     bool CheckPhysicalExtensionsSupport(VkPhysicalDevice device);
+    bool CheckDescriptorIndexingSupport(VkPhysicalDevice device);
+    bool CheckIndirectCountSupport(VkPhysicalDevice device);
     
     //queue families
     QueueFamilyIndices QueryPhysicalDeviceQueueFamilies(VkPhysicalDevice device);
 private:
+    Settings _settings;
+
     //window infomation
     GLFWwindow* _window = nullptr;
     const uint32_t _width = 800;
     const uint32_t _height = 600;
     std::string _title = "Vulkan Learn";
 
+    //driver host allocations, passed to every vkCreate and vkDestroy call
+    HostAllocator _hostAllocator;
+
     // vulkan infomation
     VkInstance _instance = nullptr;
+    uint32_t _instanceApiVersion = VK_API_VERSION_1_0;
 
     //validation infomation
     const std::vector<const char*> _validationLayers =
@@ -106,6 +251,8 @@ private:
     const bool _enableValidationLayers = true;
 #endif
     VkDebugUtilsMessengerEXT _debugMessenger;
+    //validation messages are printed from a flusher thread instead of inside the driver call
+    DebugMessageSink _debugSink;
 
     //physical device
     VkPhysicalDevice _physicalDevice = nullptr;
@@ -119,15 +266,86 @@ private:
     //queue
     VkQueue _queueGraphics = nullptr;
     VkQueue _queuePresent = nullptr;
+    //fall back to the graphics queue when the device has no dedicated family
+    VkQueue _queueTransfer = nullptr;
+    VkQueue _queueCompute = nullptr;
+    QueueFamilyIndices _queueFamilies;
 
     //swap chain
     const std::vector<const char*> _deviceExtensions =
     {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME
     };
-    VkSwapchainKHR _swapchain;
+    //headless rendering presents nothing, so no device extension is required
+    const std::vector<const char*> _headlessDeviceExtensions;
+    VkSwapchainKHR _swapchain = VK_NULL_HANDLE;
     std::vector<VkImage> _swapchainImages;
     VkFormat _swapchainImageFormat;
     VkExtent2D _swapchainExtent;
     std::vector<VkImageView> _imageViews;
+    //set on resize or policy change, the swap chain is recreated after the next present
+    bool _swapChainDirty = false;
+
+    //headless offscreen targets, they stand in for the swap chain images
+    const VkFormat _offscreenFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    std::vector<MemoryAllocation> _offscreenMemory;
+
+    //device memory
+    MemoryAllocator _memoryAllocator;
+    StagingRing _stagingRing;
+    DeletionQueue _deletionQueue;
+
+    //descriptors
+    DescriptorLayoutCache _descriptorLayoutCache;
+    DescriptorAllocator _descriptorAllocator;
+    //only created when bindless was requested and the device supports descriptor indexing
+    bool _bindlessEnabled = false;
+    BindlessHeap _bindlessHeap;
+
+    //graphics pipline
+    PipelineCache _pipelineCache;
+    ShaderCache _shaderCache;
+    PipelineManager _pipelineManager;
+
+    //render pass
+    VkRenderPass _renderPass = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> _framebuffers;
+
+    //render graph, rebuilt with the swap chain
+    RenderGraph _renderGraph;
+    RenderGraph::Handle _backbuffer = RenderGraph::kInvalidHandle;
+    //swap chain image the graph is currently being recorded for
+    uint32_t _recordImageIndex = 0;
+
+    //profiling
+    GpuProfiler _gpuProfiler;
+    bool _pipelineStatisticsEnabled = false;
+
+    //frames in flight
+    std::vector<FrameData> _frames;
+    //fence of the frame that last rendered into each swap chain image
+    std::vector<VkFence> _imagesInFlight;
+    //signaled by the submit rendering into each swap chain image and waited on by its present.
+    //no fence tells when a present is done with its semaphore, so a frame slot cannot own it,
+    //only the next acquire of the same image guarantees that
+    std::vector<VkSemaphore> _renderFinishedSemaphores;
+    uint32_t _currentFrame = 0;
+    //total frames submitted, used to tell when retired objects are no longer referenced
+    uint64_t _frameNumber = 0;
+
+    //multithreaded recording
+    ThreadPool _threadPool;
+    ParallelRecorder _parallelRecorder;
+    //draws of the frame sorted by state, _drawCount is taken from it once sorted
+    DrawQueue _drawQueue;
+    //draws recorded per frame, small frames are recorded inline on the main thread
+    uint32_t _drawCount = 0;
+    //only created when gpu culling was requested and the device supports indirect count draws
+    bool _gpuCullingEnabled = false;
+    GpuCulling _gpuCulling;
+    //camera of the frame, set by the scene before the frame is recorded
+    glm::mat4 _viewProjection = glm::mat4(1.0f);
+
+    //wall time of every InitVulkan stage in order, reported once init is done
+    std::vector<std::pair<const char*, double>> _initStages;
 };
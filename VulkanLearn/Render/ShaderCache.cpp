@@ -0,0 +1,231 @@
+#include "ShaderCache.h"
+#include "VulkanCheck.h"
+
+#include <stdexcept>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const uint32_t kSpirvMagic = 0x07230203;
+
+    //read only view of a whole file, unmapped when it goes out of scope
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::string& path)
+        {
+#ifdef _WIN32
+            _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (_file == INVALID_HANDLE_VALUE)
+                return;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+                return;
+            _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (_mapping == nullptr)
+                return;
+            _data = MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+            _size = _data ? static_cast<size_t>(size.QuadPart) : 0;
+#else
+            _file = open(path.c_str(), O_RDONLY);
+            if (_file < 0)
+                return;
+            struct stat info;
+            if (fstat(_file, &info) != 0 || info.st_size == 0)
+                return;
+            void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, _file, 0);
+            if (data == MAP_FAILED)
+                return;
+            _data = data;
+            _size = static_cast<size_t>(info.st_size);
+#endif
+        }
+
+        ~MappedFile()
+        {
+#ifdef _WIN32
+            if (_data)
+                UnmapViewOfFile(_data);
+            if (_mapping)
+                CloseHandle(_mapping);
+            if (_file != INVALID_HANDLE_VALUE)
+                CloseHandle(_file);
+#else
+            if (_data)
+                munmap(_data, _size);
+            if (_file >= 0)
+                close(_file);
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        //mappings are page aligned, so the words can be read in place
+        const uint32_t* GetWords() const { return static_cast<const uint32_t*>(_data); }
+        size_t GetSize() const { return _size; }
+
+    private:
+#ifdef _WIN32
+        HANDLE _file = INVALID_HANDLE_VALUE;
+        HANDLE _mapping = nullptr;
+#else
+        int _file = -1;
+#endif
+        void* _data = nullptr;
+        size_t _size = 0;
+    };
+}
+
+void ShaderCache::Create(VkDevice device, const HostAllocator* hostAllocator)
+{
+    _device = device;
+    _hostAllocator = hostAllocator;
+    _statistics = Statistics();
+}
+
+void ShaderCache::Destroy()
+{
+    if (_device == VK_NULL_HANDLE)
+        return;
+    //every module in the path map is also in the content map
+    for (auto& entry : _byContent)
+    {
+        for (auto& module : entry.second)
+        {
+            vkDestroyShaderModule(_device, module.module, _hostAllocator->Get(VK_OBJECT_TYPE_SHADER_MODULE));
+        }
+    }
+    _byContent.clear();
+    _byPath.clear();
+    _device = VK_NULL_HANDLE;
+}
+
+VkShaderModule ShaderCache::Load(const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _byPath.find(path);
+        if (it != _byPath.end())
+        {
+            _statistics.loads++;
+            _statistics.pathHits++;
+            return it->second;
+        }
+    }
+
+    //mapped outside the lock so threads loading different files do not wait on each other's io
+    MappedFile file(path);
+    if (file.GetWords() == nullptr)
+        throw std::runtime_error("failed to map shader file " + path + "!!!");
+    if (file.GetSize() % 4 != 0 || file.GetSize() < 20 || file.GetWords()[0] != kSpirvMagic)
+        throw std::runtime_error("not a SPIR-V binary: " + path + "!!!");
+
+    VkShaderModule module = GetOrCreate(file.GetWords(), file.GetSize());
+    std::lock_guard<std::mutex> lock(_mutex);
+    _statistics.loads++;
+    _statistics.bytesMapped += file.GetSize();
+    //a thread loading the same path meanwhile got the same module from the content map
+    _byPath.emplace(path, module);
+    return module;
+}
+
+VkShaderModule ShaderCache::Load(const uint32_t* code, size_t size)
+{
+    if (size % 4 != 0 || size < 20 || code[0] != kSpirvMagic)
+        throw std::runtime_error("not a SPIR-V binary!!!");
+    VkShaderModule module = GetOrCreate(code, size);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _statistics.loads++;
+    return module;
+}
+
+VkShaderModule ShaderCache::GetOrCreate(const uint32_t* code, size_t size)
+{
+    uint64_t hash = HashCode(code, size);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        VkShaderModule module = Find(hash, code, size);
+        if (module != VK_NULL_HANDLE)
+        {
+            _statistics.contentHits++;
+            return module;
+        }
+    }
+
+    //the driver copies the code, the mapping can go away right after
+    VkShaderModuleCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    info.codeSize = size;
+    info.pCode = code;
+    VkShaderModule module = VK_NULL_HANDLE;
+    VkResult res = vkCreateShaderModule(_device, &info, _hostAllocator->Get(VK_OBJECT_TYPE_SHADER_MODULE), &module);
+    CHECK_SUCCESS(res, "failed to create shader module!!!")
+    std::vector<uint32_t> copy(code, code + size / 4);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    //another thread created the same code while this one was in the driver, the first one stays
+    VkShaderModule existing = Find(hash, code, size);
+    if (existing != VK_NULL_HANDLE)
+    {
+        _statistics.contentHits++;
+        lock.unlock();
+        vkDestroyShaderModule(_device, module, _hostAllocator->Get(VK_OBJECT_TYPE_SHADER_MODULE));
+        return existing;
+    }
+    _byContent[hash].push_back({ std::move(copy), module });
+    _statistics.modules++;
+    return module;
+}
+
+VkShaderModule ShaderCache::Find(uint64_t hash, const uint32_t* code, size_t size) const
+{
+    auto it = _byContent.find(hash);
+    if (it == _byContent.end())
+        return VK_NULL_HANDLE;
+    for (const auto& module : it->second)
+    {
+        if (module.code.size() * 4 == size && std::memcmp(module.code.data(), code, size) == 0)
+            return module.module;
+    }
+    return VK_NULL_HANDLE;
+}
+
+uint64_t ShaderCache::HashCode(const uint32_t* code, size_t size)
+{
+    //FNV-1a over whole words, SPIR-V is a word stream anyway
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size / 4; i++)
+    {
+        hash ^= code[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+ShaderCache::Statistics ShaderCache::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _statistics;
+}
+
+void ShaderCache::PrintStatistics(std::ostream& out) const
+{
+    Statistics statistics = GetStatistics();
+    out << "shader cache: " << statistics.modules << " modules for " << statistics.loads << " loads, "
+        << statistics.pathHits << " path hits, " << statistics.contentHits << " deduplicated, "
+        << (statistics.bytesMapped >> 10) << " KiB mapped" << std::endl;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <ostream>
+#include <cstdint>
+
+#include "HostAllocator.h"
+
+//VkShaderModule per SPIR-V file, shared by every pipeline. files are memory mapped and handed to
+//the driver straight from the mapping, and modules are deduplicated by content so identical
+//stages compiled into differently named permutations are only created once. the hash only finds
+//candidates, a copy of every module's code is kept to compare them byte for byte
+class ShaderCache
+{
+public:
+    struct Statistics
+    {
+        uint32_t modules = 0;
+        uint32_t loads = 0;
+        //loads answered by an earlier load of the same path
+        uint32_t pathHits = 0;
+        //new paths whose content matched a module that already existed
+        uint32_t contentHits = 0;
+        uint64_t bytesMapped = 0;
+    };
+
+    void Create(VkDevice device, const HostAllocator* hostAllocator);
+    void Destroy();
+
+    //safe to call from any thread, throws when the file is missing or not SPIR-V
+    VkShaderModule Load(const std::string& path);
+    //for code that is not backed by a file, e.g. embedded in the executable
+    VkShaderModule Load(const uint32_t* code, size_t size);
+
+    Statistics GetStatistics() const;
+    void PrintStatistics(std::ostream& out) const;
+
+private:
+    struct Module
+    {
+        std::vector<uint32_t> code;
+        VkShaderModule module;
+    };
+
+    //hashes outside the lock and creates new modules outside it too, so threads loading
+    //different shaders overlap in the driver
+    VkShaderModule GetOrCreate(const uint32_t* code, size_t size);
+    //caller holds the mutex
+    VkShaderModule Find(uint64_t hash, const uint32_t* code, size_t size) const;
+    static uint64_t HashCode(const uint32_t* code, size_t size);
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    const HostAllocator* _hostAllocator = nullptr;
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, VkShaderModule> _byPath;
+    //every module whose code has the hash, different code only shares one on a collision
+    std::unordered_map<uint64_t, std::vector<Module>> _byContent;
+    Statistics _statistics;
+};
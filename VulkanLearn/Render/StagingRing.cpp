@@ -0,0 +1,385 @@
+#include "StagingRing.h"
+#include "VulkanCheck.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    //copy offsets into images must be a multiple of the texel size and of 4,
+    //16 covers every uncompressed format and the block size of bc formats
+    const VkDeviceSize kImageCopyAlignment = 16;
+    const VkDeviceSize kBufferCopyAlignment = 4;
+
+    //every stage that may read uploaded data
+    const VkPipelineStageFlags kReadStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+}
+
+void StagingRing::Create(MemoryAllocator* allocator, VkDeviceSize size, uint32_t frameCount)
+{
+    _allocator = allocator;
+
+    VkBufferCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    //uniform and storage usage let shaders read per frame data straight from the ring
+    info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    //coherent memory needs no flush after writing through the mapped pointer
+    _allocator->CreateBuffer(info,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        0,
+        _buffer,
+        _memory);
+    if (_memory.mapped == nullptr)
+    {
+        throw std::runtime_error("staging ring memory is not mapped!!!");
+    }
+
+    _ring.Create(size, frameCount);
+    _peakUsed = 0;
+    _failedUploads = 0;
+}
+
+void StagingRing::Destroy()
+{
+    if (_buffer == VK_NULL_HANDLE)
+        return;
+
+    std::cout << "staging ring: peak " << _peakUsed << " of " << _ring.GetSize() << " bytes, "
+        << _failedUploads << " uploads deferred" << std::endl;
+    _allocator->DestroyBuffer(_buffer, _memory);
+    _bufferCopies.clear();
+    _imageCopies.clear();
+    _imageStates.clear();
+}
+
+void StagingRing::BeginFrame(uint32_t frameIndex)
+{
+    _ring.ReleaseFrame(frameIndex);
+}
+
+bool StagingRing::Write(const void* data, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+    if (!_ring.Allocate(size, alignment, offset))
+    {
+        _failedUploads++;
+        return false;
+    }
+    _peakUsed = (std::max)(_peakUsed, _ring.GetUsed());
+    if (data != nullptr)
+    {
+        std::memcpy(static_cast<char*>(_memory.mapped) + offset, data, static_cast<size_t>(size));
+    }
+    return true;
+}
+
+bool StagingRing::UploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+    VkDeviceSize srcOffset = 0;
+    if (!Write(data, size, kBufferCopyAlignment, srcOffset))
+        return false;
+
+    BufferCopy copy;
+    copy.buffer = buffer;
+    copy.region.srcOffset = srcOffset;
+    copy.region.dstOffset = offset;
+    copy.region.size = size;
+    _bufferCopies.push_back(copy);
+    return true;
+}
+
+bool StagingRing::UploadImage(VkImage image, const VkBufferImageCopy& region, const void* data, VkDeviceSize size,
+    VkImageLayout finalLayout)
+{
+    VkDeviceSize srcOffset = 0;
+    if (!Write(data, size, kImageCopyAlignment, srcOffset))
+        return false;
+
+    ImageCopy copy;
+    copy.image = image;
+    copy.region = region;
+    copy.region.bufferOffset = srcOffset;
+    copy.finalLayout = finalLayout;
+    _imageCopies.push_back(copy);
+    return true;
+}
+
+void StagingRing::ReleaseImage(VkImage image)
+{
+    for (auto it = _imageStates.begin(); it != _imageStates.end();)
+    {
+        if (it->first.image == image)
+            it = _imageStates.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool StagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, void*& mapped)
+{
+    if (!Write(nullptr, size, alignment, offset))
+        return false;
+    mapped = static_cast<char*>(_memory.mapped) + offset;
+    return true;
+}
+
+void StagingRing::Flush(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+    //everything written so far is read by this frame, including raw allocations without a copy
+    _ring.EndFrame(frameIndex);
+    if (_bufferCopies.empty() && _imageCopies.empty())
+        return;
+
+    //destinations may still be read by earlier frames, e.g. instance data a compute pass culls
+    //against, the copies only have to wait for those reads so no memory barrier is needed
+    if (!_bufferCopies.empty())
+    {
+        vkCmdPipelineBarrier(commandBuffer, kReadStages, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 0, nullptr);
+    }
+
+    //regions of one copy command must not overlap and are written in no defined order, so
+    //uploads hitting the same range again go into a later batch behind a barrier and land in
+    //submission order. the check is skipped in the common case of no overlap at all
+    if (!HasOverlappingCopies())
+    {
+        RecordBufferCopies(commandBuffer, 0, _bufferCopies.size());
+    }
+    else
+    {
+        for (size_t first = 0; first < _bufferCopies.size();)
+        {
+            size_t last = first + 1;
+            for (; last < _bufferCopies.size(); last++)
+            {
+                const BufferCopy& copy = _bufferCopies[last];
+                bool overlaps = false;
+                for (size_t i = first; i < last && !overlaps; i++)
+                {
+                    const BufferCopy& other = _bufferCopies[i];
+                    overlaps = other.buffer == copy.buffer &&
+                        other.region.dstOffset < copy.region.dstOffset + copy.region.size &&
+                        copy.region.dstOffset < other.region.dstOffset + other.region.size;
+                }
+                if (overlaps)
+                    break;
+            }
+            RecordBufferCopies(commandBuffer, first, last);
+            if (last < _bufferCopies.size())
+            {
+                VkMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                vkCmdPipelineBarrier(commandBuffer,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    0, 1, &barrier, 0, nullptr, 0, nullptr);
+            }
+            first = last;
+        }
+    }
+
+    _barriers.clear();
+    if (!_imageCopies.empty())
+    {
+        RecordImageCopies(commandBuffer);
+    }
+
+    //a single barrier makes every copy visible to whatever reads the data this frame
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_INDEX_READ_BIT |
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+        VK_ACCESS_UNIFORM_READ_BIT |
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+        VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, kReadStages, 0,
+        _bufferCopies.empty() ? 0 : 1, &memoryBarrier,
+        0, nullptr,
+        static_cast<uint32_t>(_barriers.size()), _barriers.data());
+
+    _bufferCopies.clear();
+    _imageCopies.clear();
+}
+
+bool StagingRing::HasOverlappingCopies()
+{
+    _sortedCopies.assign(_bufferCopies.begin(), _bufferCopies.end());
+    std::sort(_sortedCopies.begin(), _sortedCopies.end(), [](const BufferCopy& a, const BufferCopy& b)
+    {
+        return a.buffer != b.buffer ? a.buffer < b.buffer : a.region.dstOffset < b.region.dstOffset;
+    });
+    for (size_t i = 1; i < _sortedCopies.size(); i++)
+    {
+        const BufferCopy& previous = _sortedCopies[i - 1];
+        if (previous.buffer == _sortedCopies[i].buffer &&
+            previous.region.dstOffset + previous.region.size > _sortedCopies[i].region.dstOffset)
+            return true;
+    }
+    return false;
+}
+
+void StagingRing::RecordBufferCopies(VkCommandBuffer commandBuffer, size_t first, size_t last)
+{
+    //nothing in the range overlaps, so grouping by destination can reorder freely
+    std::sort(_bufferCopies.begin() + first, _bufferCopies.begin() + last,
+        [](const BufferCopy& a, const BufferCopy& b) { return a.buffer < b.buffer; });
+    while (first < last)
+    {
+        size_t end = first;
+        _regions.clear();
+        while (end < last && _bufferCopies[end].buffer == _bufferCopies[first].buffer)
+        {
+            _regions.push_back(_bufferCopies[end].region);
+            end++;
+        }
+        vkCmdCopyBuffer(commandBuffer, _buffer, _bufferCopies[first].buffer,
+            static_cast<uint32_t>(_regions.size()), _regions.data());
+        first = end;
+    }
+}
+
+void StagingRing::RecordImageCopies(VkCommandBuffer commandBuffer)
+{
+    //layers written by an earlier batch of this flush are already in TRANSFER_DST_OPTIMAL
+    uint64_t flushBatch = _imageBatches + 1;
+    for (size_t first = 0; first < _imageCopies.size();)
+    {
+        uint64_t batch = ++_imageBatches;
+        _barriers.clear();
+        VkPipelineStageFlags srcStages = 0;
+        size_t last = first;
+        for (; last < _imageCopies.size(); last++)
+        {
+            const ImageCopy& copy = _imageCopies[last];
+            const VkImageSubresourceLayers& subresource = copy.region.imageSubresource;
+            bool rewritten = false;
+            for (uint32_t i = 0; i < subresource.layerCount && !rewritten; i++)
+            {
+                auto it = _imageStates.find({ copy.image, subresource.mipLevel, subresource.baseArrayLayer + i });
+                rewritten = it != _imageStates.end() && it->second.batch == batch;
+            }
+            if (rewritten)
+                break;
+
+            for (uint32_t i = 0; i < subresource.layerCount; i++)
+            {
+                uint32_t layer = subresource.baseArrayLayer + i;
+                auto inserted = _imageStates.insert({ { copy.image, subresource.mipLevel, layer },
+                    { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 } });
+                ImageState& state = inserted.first->second;
+                if (inserted.second)
+                {
+                    //nothing read the layer yet and its contents are undefined anyway
+                    srcStages |= VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+                    AppendLayerBarrier(copy.image, subresource, layer, VK_IMAGE_LAYOUT_UNDEFINED,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+                }
+                else if (state.batch < flushBatch)
+                {
+                    //frames in flight may still sample it, writing after a read only has to wait
+                    srcStages |= kReadStages;
+                    AppendLayerBarrier(copy.image, subresource, layer, state.layout,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+                }
+                state.layout = copy.finalLayout;
+                state.batch = batch;
+                state.copy = last;
+            }
+        }
+
+        if (!_barriers.empty())
+        {
+            vkCmdPipelineBarrier(commandBuffer, srcStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                0, nullptr, 0, nullptr,
+                static_cast<uint32_t>(_barriers.size()), _barriers.data());
+        }
+        for (size_t i = first; i < last; i++)
+        {
+            vkCmdCopyBufferToImage(commandBuffer, _buffer, _imageCopies[i].image,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &_imageCopies[i].region);
+        }
+        if (last < _imageCopies.size())
+        {
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+        }
+        first = last;
+    }
+
+    //each layer goes to the final layout of the last copy that wrote it
+    _barriers.clear();
+    for (size_t i = 0; i < _imageCopies.size(); i++)
+    {
+        const ImageCopy& copy = _imageCopies[i];
+        const VkImageSubresourceLayers& subresource = copy.region.imageSubresource;
+        for (uint32_t j = 0; j < subresource.layerCount; j++)
+        {
+            uint32_t layer = subresource.baseArrayLayer + j;
+            if (_imageStates[{ copy.image, subresource.mipLevel, layer }].copy != i)
+                continue;
+            AppendLayerBarrier(copy.image, subresource, layer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                copy.finalLayout, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+        }
+    }
+}
+
+void StagingRing::AppendLayerBarrier(VkImage image, const VkImageSubresourceLayers& subresource, uint32_t arrayLayer,
+    VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess)
+{
+    if (!_barriers.empty())
+    {
+        VkImageMemoryBarrier& previous = _barriers.back();
+        if (previous.image == image &&
+            previous.subresourceRange.baseMipLevel == subresource.mipLevel &&
+            previous.subresourceRange.baseArrayLayer + previous.subresourceRange.layerCount == arrayLayer &&
+            previous.oldLayout == oldLayout &&
+            previous.newLayout == newLayout)
+        {
+            previous.subresourceRange.layerCount++;
+            return;
+        }
+    }
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = subresource.aspectMask;
+    barrier.subresourceRange.baseMipLevel = subresource.mipLevel;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = arrayLayer;
+    barrier.subresourceRange.layerCount = 1;
+    _barriers.push_back(barrier);
+}
+
+bool StagingRing::ImageSubresource::operator==(const ImageSubresource& other) const
+{
+    return image == other.image && mipLevel == other.mipLevel && arrayLayer == other.arrayLayer;
+}
+
+size_t StagingRing::ImageSubresourceHash::operator()(const ImageSubresource& key) const
+{
+    //levels and layers are small, they share one word with room to spare
+    return std::hash<VkImage>()(key.image) ^
+        std::hash<uint64_t>()(static_cast<uint64_t>(key.mipLevel) << 32 | key.arrayLayer);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "MemoryAllocator.h"
+
+//one persistently mapped host coherent buffer used for every cpu to gpu upload.
+//uploads are copied into the ring right away and the transfer commands are batched
+//into the frame command buffer by Flush, the space is reclaimed with the frame fence
+class StagingRing
+{
+public:
+    void Create(MemoryAllocator* allocator, VkDeviceSize size, uint32_t frameCount);
+    void Destroy();
+
+    //call once the fence of frameIndex has been waited
+    void BeginFrame(uint32_t frameIndex);
+    //record all queued copies, must run outside of a render pass
+    void Flush(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+    //the upload functions return false when the ring is full, retry after the next frame
+    bool UploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+    //only the region's mip level and layers are touched and left in finalLayout. the first upload
+    //into a layer discards its contents, later ones keep the texels outside the region and wait
+    //for the shader reads of the frames still in flight
+    bool UploadImage(VkImage image, const VkBufferImageCopy& region, const void* data, VkDeviceSize size,
+        VkImageLayout finalLayout);
+    //forgets the layouts of an image before it is destroyed, its handle may be reused
+    void ReleaseImage(VkImage image);
+    //raw space for data the gpu reads straight from the ring, like per frame constants
+    bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, void*& mapped);
+
+    VkBuffer GetBuffer() const { return _buffer; }
+
+private:
+    struct BufferCopy
+    {
+        VkBuffer buffer;
+        VkBufferCopy region;
+    };
+
+    struct ImageCopy
+    {
+        VkImage image;
+        VkBufferImageCopy region;
+        VkImageLayout finalLayout;
+    };
+
+    struct ImageSubresource
+    {
+        VkImage image;
+        uint32_t mipLevel;
+        uint32_t arrayLayer;
+
+        bool operator==(const ImageSubresource& other) const;
+    };
+
+    struct ImageSubresourceHash
+    {
+        size_t operator()(const ImageSubresource& key) const;
+    };
+
+    struct ImageState
+    {
+        //final layout of the last upload
+        VkImageLayout layout;
+        //image batch of the last upload and its copy within that flush
+        uint64_t batch;
+        size_t copy;
+    };
+
+    bool Write(const void* data, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    //true when two queued copies write overlapping ranges of the same buffer
+    bool HasOverlappingCopies();
+    //one vkCmdCopyBuffer per destination of the copies [first, last), which must not overlap
+    void RecordBufferCopies(VkCommandBuffer commandBuffer, size_t first, size_t last);
+    //records the image copies in batches that write disjoint layers, each behind the barriers
+    //from the layers' last use, and appends the transitions to their final layouts to _barriers
+    void RecordImageCopies(VkCommandBuffer commandBuffer);
+    //extends the last barrier when it covers the layer below on the same image and level
+    void AppendLayerBarrier(VkImage image, const VkImageSubresourceLayers& subresource, uint32_t arrayLayer,
+        VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess);
+
+private:
+    MemoryAllocator* _allocator = nullptr;
+    VkBuffer _buffer = VK_NULL_HANDLE;
+    MemoryAllocation _memory;
+    RingAllocator _ring;
+
+    std::vector<BufferCopy> _bufferCopies;
+    std::vector<ImageCopy> _imageCopies;
+    //scratch arrays reused by Flush so recording does not allocate
+    std::vector<VkBufferCopy> _regions;
+    std::vector<BufferCopy> _sortedCopies;
+    std::vector<VkImageMemoryBarrier> _barriers;
+
+    //layout of every image layer an upload has written
+    std::unordered_map<ImageSubresource, ImageState, ImageSubresourceHash> _imageStates;
+    uint64_t _imageBatches = 0;
+
+    VkDeviceSize _peakUsed = 0;
+    uint64_t _failedUploads = 0;
+};
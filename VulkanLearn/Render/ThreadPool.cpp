@@ -0,0 +1,147 @@
+#include "ThreadPool.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+
+void ThreadPool::Create(uint32_t workerCount)
+{
+    Destroy();
+    _stop = false;
+    //new workers start out having seen generation 0, an older job must not look new to them
+    _generation = 0;
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        _workers.emplace_back(&ThreadPool::WorkerLoop, this, i + 1);
+    }
+}
+
+void ThreadPool::Destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& worker : _workers)
+    {
+        worker.join();
+    }
+    _workers.clear();
+}
+
+void ThreadPool::ParallelFor(uint32_t count, uint32_t minChunk, const RangeFunc& func)
+{
+    if (count == 0)
+        return;
+
+    //a few chunks per thread evens out ranges that take uneven time
+    uint32_t threadCount = GetThreadCount();
+    uint32_t chunkCount = (count + (std::max)(minChunk, 1u) - 1) / (std::max)(minChunk, 1u);
+    chunkCount = (std::min)(chunkCount, threadCount * 4);
+    if (chunkCount <= 1 || _workers.empty())
+    {
+        func(0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _func = &func;
+        _count = count;
+        _chunkCount = chunkCount;
+        _nextChunk.store(0, std::memory_order_relaxed);
+        _busyWorkers = static_cast<uint32_t>(_workers.size());
+        _generation++;
+    }
+    _wake.notify_all();
+
+    RunChunks(0);
+
+    //every worker has to check in, otherwise a late one could read the next job half written
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _busyWorkers == 0; });
+    _func = nullptr;
+    if (_error)
+    {
+        std::exception_ptr error = _error;
+        _error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::WorkerLoop(uint32_t threadIndex)
+{
+    CpuProfiler::SetThreadName(("worker " + std::to_string(threadIndex)).c_str());
+    uint64_t seenGeneration = 0;
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _stop || _generation != seenGeneration || !_tasks.empty(); });
+            //a ParallelFor waits for every worker, so its chunks go before queued tasks
+            if (_generation == seenGeneration)
+            {
+                //neither a job nor a task, so the pool is stopping
+                if (_tasks.empty())
+                    return;
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+            else
+            {
+                seenGeneration = _generation;
+            }
+        }
+        if (task)
+        {
+            task();
+            continue;
+        }
+
+        RunChunks(threadIndex);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_busyWorkers == 0)
+            _done.notify_one();
+    }
+}
+
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+    if (_workers.empty())
+    {
+        task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back(std::move(task));
+    }
+    _wake.notify_one();
+}
+
+void ThreadPool::RunChunks(uint32_t threadIndex)
+{
+    for (;;)
+    {
+        uint32_t chunk = _nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= _chunkCount)
+            break;
+        uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(_count) * chunk / _chunkCount);
+        uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(_count) * (chunk + 1) / _chunkCount);
+        try
+        {
+            (*_func)(begin, end, threadIndex);
+        }
+        catch (...)
+        {
+            //an exception leaving a worker would terminate, ParallelFor rethrows the first one
+            //and the chunks nobody took yet are skipped
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error)
+                _error = std::current_exception();
+            _nextChunk.store(_chunkCount, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <deque>
+#include <exception>
+#include <cstdint>
+
+//fixed set of worker threads for fork join work. the calling thread takes part in every
+//ParallelFor as thread 0, workers are numbered from 1, so per thread data can be indexed
+//directly with the thread index. single tasks can also be submitted to run in the background,
+//e.g. file loads overlapping device creation
+class ThreadPool
+{
+public:
+    //begin, end, thread index
+    using RangeFunc = std::function<void(uint32_t, uint32_t, uint32_t)>;
+
+    ThreadPool() = default;
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool() { Destroy(); }
+
+    //0 workers runs everything on the calling thread
+    void Create(uint32_t workerCount);
+    void Destroy();
+
+    //splits [0, count) into contiguous chunks of at least minChunk items and blocks until all ran.
+    //chunks are handed out in order, so a chunk never starts before every lower chunk was taken.
+    //the first exception thrown by func is rethrown here once every thread is done
+    void ParallelFor(uint32_t count, uint32_t minChunk, const RangeFunc& func);
+
+    //runs func on a worker and returns its result through the future, inline without workers.
+    //a ParallelFor started meanwhile also waits for workers busy with a task, so tasks are meant
+    //for startup and loading work rather than for the frame loop
+    template <typename Func>
+    auto Submit(Func&& func) -> std::future<decltype(func())>
+    {
+        using Result = decltype(func());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+        std::future<Result> future = task->get_future();
+        Enqueue([task] { (*task)(); });
+        return future;
+    }
+
+    uint32_t GetThreadCount() const { return static_cast<uint32_t>(_workers.size()) + 1; }
+
+private:
+    void WorkerLoop(uint32_t threadIndex);
+    void RunChunks(uint32_t threadIndex);
+    void Enqueue(std::function<void()> task);
+
+private:
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    bool _stop = false;
+    //bumped for every ParallelFor, workers sleep until it changes
+    uint64_t _generation = 0;
+    uint32_t _busyWorkers = 0;
+    //submitted tasks, drained before the workers stop
+    std::deque<std::function<void()>> _tasks;
+
+    //current job, only written while every worker is idle
+    const RangeFunc* _func = nullptr;
+    uint32_t _count = 0;
+    uint32_t _chunkCount = 0;
+    std::atomic<uint32_t> _nextChunk{ 0 };
+    //first exception of the current job
+    std::exception_ptr _error;
+};
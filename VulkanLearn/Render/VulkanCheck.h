@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdexcept>
+
+#define CHECK_SUCCESS(res, errorInfo) \
+if(res != VK_SUCCESS) \
+{\
+    throw std::runtime_error(errorInfo);\
+}
@@ -0,0 +1,141 @@
+//gpu driven culling, one invocation per instance. visible instances are appended to the
+//indirect commands of their batch, the layouts mirror the structs in Render/GpuCulling.h
+
+layout(local_size_x = 64) in;
+
+struct Instance
+{
+    //world space bounding sphere, xyz center and w radius
+    vec4 sphere;
+    uint batch;
+    uint mesh;
+    //becomes firstInstance, the vertex shader finds its per object data with gl_InstanceIndex
+    uint object;
+    uint pad;
+};
+
+struct Mesh
+{
+    uint indexCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint pad;
+};
+
+struct Batch
+{
+    uint commandOffset;
+    uint capacity;
+    uint pad0;
+    uint pad1;
+};
+
+//VkDrawIndexedIndirectCommand
+struct DrawCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout(set = 0, binding = 0) uniform Cull
+{
+    //normalized, a point is inside when dot(plane.xyz, p) + plane.w >= 0 for all six
+    vec4 planes[6];
+    //matrix the depth pyramid was rendered with, usually the one of the previous frame
+    mat4 pyramidViewProjection;
+    vec2 pyramidSize;
+    uint pyramidMips;
+    uint instanceCount;
+} cull;
+
+layout(std430, set = 0, binding = 1) readonly buffer Instances { Instance instances[]; };
+layout(std430, set = 0, binding = 2) readonly buffer Meshes { Mesh meshes[]; };
+layout(std430, set = 0, binding = 3) readonly buffer Batches { Batch batches[]; };
+layout(std430, set = 0, binding = 4) writeonly buffer Commands { DrawCommand commands[]; };
+//one draw count per batch, cleared before the dispatch
+layout(std430, set = 0, binding = 5) buffer Counts { uint counts[]; };
+
+#ifdef OCCLUSION
+//every texel holds the farthest depth of the texels it covers one mip below, sampled with
+//a nearest sampler
+layout(set = 0, binding = 6) uniform sampler2D depthPyramid;
+
+bool IsOccluded(vec4 sphere)
+{
+    //screen space bounds of the box around the sphere
+    vec2 minUV = vec2(1.0);
+    vec2 maxUV = vec2(0.0);
+    float nearestDepth = 1.0;
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = sphere.xyz + sphere.w * vec3((i & 1) != 0 ? 1.0 : -1.0,
+                                                   (i & 2) != 0 ? 1.0 : -1.0,
+                                                   (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = cull.pyramidViewProjection * vec4(corner, 1.0);
+        //crosses the near plane, nothing sensible can be said about it
+        if (clip.w <= 0.0)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 uv = ndc.xy * 0.5 + 0.5;
+        minUV = min(minUV, uv);
+        maxUV = max(maxUV, uv);
+        nearestDepth = min(nearestDepth, ndc.z);
+    }
+    minUV = clamp(minUV, 0.0, 1.0);
+    maxUV = clamp(maxUV, 0.0, 1.0);
+
+    //the mip where the bounds cover at most two texels per axis, four samples cover all of it
+    vec2 extent = (maxUV - minUV) * cull.pyramidSize;
+    float level = ceil(log2(max(max(extent.x, extent.y), 1.0)));
+    level = min(level, float(cull.pyramidMips - 1));
+    float farthest = max(max(textureLod(depthPyramid, minUV, level).r,
+                             textureLod(depthPyramid, vec2(maxUV.x, minUV.y), level).r),
+                         max(textureLod(depthPyramid, vec2(minUV.x, maxUV.y), level).r,
+                             textureLod(depthPyramid, maxUV, level).r));
+    return nearestDepth > farthest;
+}
+#endif
+
+bool IsInsideFrustum(vec4 sphere)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (dot(cull.planes[i].xyz, sphere.xyz) + cull.planes[i].w < -sphere.w)
+            return false;
+    }
+    return true;
+}
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= cull.instanceCount)
+        return;
+
+    Instance instance = instances[index];
+    if (!IsInsideFrustum(instance.sphere))
+        return;
+#ifdef OCCLUSION
+    if (IsOccluded(instance.sphere))
+        return;
+#endif
+
+    //draws land in whatever order the atomics hand out, a batch shares one pipeline so the
+    //order only matters for overdraw
+    Batch batch = batches[instance.batch];
+    uint slot = atomicAdd(counts[instance.batch], 1u);
+    if (slot >= batch.capacity)
+        return;
+
+    Mesh mesh = meshes[instance.mesh];
+    DrawCommand command;
+    command.indexCount = mesh.indexCount;
+    command.instanceCount = 1;
+    command.firstIndex = mesh.firstIndex;
+    command.vertexOffset = mesh.vertexOffset;
+    command.firstInstance = instance.object;
+    commands[batch.commandOffset + slot] = command;
+}
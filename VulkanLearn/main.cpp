@@ -1,10 +1,56 @@
  #include "Render/Renderer.h"
 
- int main()
+ int main(int argc, char** argv)
  {
- 	Renderer renderer;
+ 	Renderer::Settings settings;
+ 	for (int i = 1; i < argc; i++)
+ 	{
+ 		std::string arg = argv[i];
+ 		if (arg == "--headless")
+ 			settings.headless = true;
+ 		else if (arg == "--frames" && i + 1 < argc)
+ 			settings.headlessFrameCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+ 		else if (arg == "--frames-in-flight" && i + 1 < argc)
+ 			settings.framesInFlight = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+ 		else if (arg == "--present" && i + 1 < argc)
+ 		{
+ 			std::string policy = argv[++i];
+ 			if (policy == "low-latency")
+ 				settings.presentPolicy = Renderer::PresentPolicy::LowLatency;
+ 			else if (policy == "power-saving")
+ 				settings.presentPolicy = Renderer::PresentPolicy::PowerSaving;
+ 			else if (policy == "adaptive")
+ 				settings.presentPolicy = Renderer::PresentPolicy::Adaptive;
+ 		}
+ 		else if (arg == "--swapchain-images" && i + 1 < argc)
+ 			settings.swapchainImageCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+ 		else if (arg == "--device" && i + 1 < argc)
+ 			settings.preferredDevice = argv[++i];
+ 		else if (arg == "--no-host-allocator")
+ 			settings.hostAllocator = false;
+ 		else if (arg == "--bindless")
+ 			settings.bindless = true;
+ 		else if (arg == "--record-threads" && i + 1 < argc)
+ 			settings.recordThreads = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+ 		else if (arg == "--pipeline-threads" && i + 1 < argc)
+ 			settings.pipelineCompileThreads = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+ 		else if (arg == "--no-gpu-profiler")
+ 			settings.gpuProfiler = false;
+ 		else if (arg == "--pipeline-statistics")
+ 			settings.pipelineStatistics = true;
+ 		else if (arg == "--no-cpu-profiler")
+ 			settings.cpuProfiler = false;
+ 		else if (arg == "--trace" && i + 1 < argc)
+ 			settings.tracePath = argv[++i];
+ 		else if (arg == "--validation-performance-report")
+ 			settings.validationPerformanceReport = true;
+ 		else if (arg == "--gpu-culling")
+ 			settings.gpuCulling = true;
+ 	}
+
  	try
  	{
+ 		Renderer renderer(settings);
  		renderer.Run();
  	}
  	catch (const std::exception& e)